@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ccs {
+
+/*
+ * memory for short-lived contexts (see CcsContext::constrain(CcsArena &...)),
+ * all freed at once when the arena is reset or destroyed. allocating is a
+ * pointer bump, and freeing an individual object does nothing at all. the
+ * first block may be supplied by the caller, such as a buffer on the stack
+ * (see CcsStackArena); any more come from the heap, and are kept for reuse
+ * after a reset.
+ *
+ * an arena isn't thread-safe. use one per request, or per thread.
+ */
+class CcsArena {
+  struct Block {
+    Block *next;
+    size_t size;
+  };
+
+  char *next_;
+  char *end_;
+  char *buffer_;      // supplied by the caller, may be null
+  size_t bufferSize_;
+  Block *blocks_;     // allocated, in order of use
+  Block *current_;    // the heap block in use, or null for the buffer
+  size_t blockSize_;
+
+  void *allocateSlow(size_t size, size_t align);
+  static char *alignUp(char *p, size_t align) {
+    uintptr_t n = reinterpret_cast<uintptr_t>(p);
+    return reinterpret_cast<char *>((n + align - 1) & ~(uintptr_t)(align - 1));
+  }
+
+public:
+  explicit CcsArena(size_t blockSize = 4096);
+  CcsArena(void *buffer, size_t size, size_t blockSize = 4096);
+  ~CcsArena();
+  CcsArena(const CcsArena &) = delete;
+  CcsArena &operator=(const CcsArena &) = delete;
+
+  void *allocate(size_t size, size_t align) {
+    char *p = alignUp(next_, align);
+    if (next_ && p <= end_ && size <= static_cast<size_t>(end_ - p)) {
+      next_ = p + size;
+      return p;
+    }
+    return allocateSlow(size, align);
+  }
+
+  // release everything allocated so far. any context allocated from the
+  // arena must not be used (or even destroyed) after this.
+  void reset();
+
+  // bytes obtained from the heap, not counting a caller-supplied buffer
+  size_t heapBytes() const;
+};
+
+/*
+ * an arena whose first block is part of the object itself, for use as a
+ * local variable. requests needing more than Size bytes spill to the heap.
+ */
+template <size_t Size>
+class CcsStackArena : public CcsArena {
+  alignas(std::max_align_t) char storage_[Size];
+
+public:
+  CcsStackArena() : CcsArena(storage_, Size) {}
+};
+
+}
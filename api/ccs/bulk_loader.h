@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ccs {
+
+class DagBuilder;
+
+/*
+ * loads generated rules (millions of them, from a database, say) straight
+ * into a domain's dag, without building any ccs text or ast along the way.
+ * every rule is a single property setting, under a selector which is the
+ * conjunction of some steps, like a chain of RuleBuilder::select() calls.
+ *
+ * selectors and property names are interned up front, and records then
+ * refer to them by id, in columnar batches. batches are only staged: the
+ * dag is untouched until commit() adds every staged record at once, in
+ * order. each distinct selector's node is found (or made) once per commit,
+ * however many records use it. records staged but never committed are
+ * dropped along with the loader.
+ *
+ * a rule added this way behaves exactly as if it had been loaded from the
+ * equivalent ccs text, with the value as a string, and shares the dag's
+ * nodes with such rules. it takes its origin from the loader's source name
+ * and its position in the commit, counting from 1. like loading, commit()
+ * modifies the domain, and must not run concurrently with anything else.
+ */
+class CcsBulkLoader {
+  friend class CcsDomain;
+  class Impl;
+  std::unique_ptr<Impl> impl;
+
+  CcsBulkLoader(DagBuilder &dag, const std::string &source);
+
+public:
+  typedef uint32_t Selector;
+  typedef uint32_t Property;
+  typedef std::pair<std::string, std::vector<std::string>> Step;
+
+  // one record per row, so every column must be the same length, except
+  // that overrides may be left empty if none of them is an @override.
+  struct Batch {
+    std::vector<Selector> selectors;
+    std::vector<Property> properties;
+    std::vector<std::string> values;
+    std::vector<bool> overrides;
+  };
+
+  ~CcsBulkLoader();
+  CcsBulkLoader(CcsBulkLoader &&);
+  CcsBulkLoader &operator=(CcsBulkLoader &&);
+
+  // the selector matching contexts constrained by every one of the given
+  // steps, each a name with any number of values: {{"env", {"prod"}},
+  // {"region", {"us"}}} is "env.prod region.us". order and duplicates
+  // don't matter. no steps at all selects the root.
+  Selector selector(const std::vector<Step> &steps);
+  // the id of a property name, shared with every other use of the name in
+  // the domain (PropertyKey::id(), for instance).
+  Property property(const std::string &name);
+
+  // stage a batch of records. throws std::invalid_argument if the columns'
+  // lengths differ, if a selector wasn't interned by this loader, or if a
+  // property isn't one of the domain's.
+  void add(Batch batch);
+  // the number of records staged since the last commit
+  size_t staged() const;
+  // add every staged record to the domain. returns the number added.
+  size_t commit();
+};
+
+}
@@ -2,6 +2,15 @@
 
 /* Single all-in header, includes the entire CCS API. */
 
+#include "ccs/arena.h"
+#include "ccs/bulk_loader.h"
 #include "ccs/context.h"
+#include "ccs/context_cache.h"
+#include "ccs/context_template.h"
 #include "ccs/domain.h"
+#include "ccs/file_watcher.h"
+#include "ccs/matcher.h"
+#include "ccs/reloadable.h"
+#include "ccs/snapshot.h"
+#include "ccs/stats.h"
 #include "ccs/types.h"
@@ -5,34 +5,52 @@
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "ccs/types.h"
 
 namespace ccs {
 
+class CcsArena;
 class CcsTracer;
 class CcsProperty;
+class CcsSnapshot;
 class Key;
-class Node;
 class SearchState;
 
+/*
+ * contexts are immutable once created, so any number of threads may look up
+ * properties in (or constrain) the same context at once, without locking.
+ */
 class CcsContext {
-  std::shared_ptr<SearchState> searchState;
+  // counts its own references, see SearchState
+  SearchState *searchState;
 
+  friend class CcsContextCache;
+  friend class CcsContextTemplate;
   friend class CcsDomain;
-  CcsContext(std::shared_ptr<const Node> root);
-  CcsContext(const CcsContext &parent, const Key &key);
+  friend class CcsReloadableDomain;
+  friend class CcsSnapshot;
+  // takes over a reference already counted for the caller.
+  explicit CcsContext(SearchState *searchState) : searchState(searchState) {}
+  CcsContext(const CcsContext &parent, Key key);
   CcsContext(const CcsContext &parent, const std::string &name);
   CcsContext(const CcsContext &parent, const std::string &name,
       const std::vector<std::string> &values);
 
 public:
-  CcsContext(const CcsContext &) = default;
-  CcsContext &operator=(const CcsContext &) = default;
-  ~CcsContext() = default;
+  CcsContext(const CcsContext &that);
+  CcsContext(CcsContext &&that) noexcept : searchState(that.searchState)
+    { that.searchState = nullptr; }
+  CcsContext &operator=(CcsContext that) noexcept {
+    std::swap(searchState, that.searchState);
+    return *this;
+  }
+  ~CcsContext();
 
   class Builder;
+  class PropertySet;
 
   void logRuleDag(std::ostream &os) const;
 
@@ -45,7 +63,62 @@ public:
       const std::vector<std::string> &values) const
     { return CcsContext(*this, name, values); }
 
+  // as above, but the new context is allocated from the given arena (see
+  // arena.h), as is every context derived from it, other than by
+  // compact(). building such a context takes no locks or atomic operations,
+  // and nothing is freed when it goes away; it all goes with the arena.
+  // meant for short-lived, per-request contexts, with some strict rules:
+  // this context must outlive the arena's contents, and no copy of the new
+  // context, nor anything referring to it (a snapshot, or an exception
+  // thrown by a lookup) may be used, or even destroyed, once the arena has
+  // been reset or destroyed. and like the arena itself, the new context may
+  // only be used by one thread at a time.
+  CcsContext constrain(CcsArena &arena, const std::string &name,
+      const std::vector<std::string> &values = {}) const;
+
+  // an equivalent context, in which constraining (as well as in any context
+  // derived from it) only records the constraint. finding the rules that
+  // apply, @constrain included, is put off until a context is first read,
+  // and skipped entirely if it never is. this helps when contexts are often
+  // created but seldom read; the cost is a little extra on the first read.
+  CcsContext lazy() const;
+
+  // an equivalent context which doesn't refer to this one's ancestors. each
+  // context holds on to its parent, and lookups search every ancestor in
+  // turn, so for a long-lived context built with many constraints, this
+  // frees the intermediate contexts and makes lookups a single step. the
+  // context prints the same, and further constraints apply as usual.
+  // snapshot(base) can't build incrementally on a snapshot of an ancestor,
+  // though, as the compacted context has none.
+  CcsContext compact() const;
+
+  // resolve every property visible in this context into a flat, immutable
+  // table (see snapshot.h). if given a snapshot of an ancestor of this
+  // context, only the settings made below that ancestor are re-resolved.
+  CcsSnapshot snapshot() const;
+  CcsSnapshot snapshot(const CcsSnapshot &base) const;
+
   const CcsProperty &getProperty(const std::string &propertyName) const;
+  const CcsProperty &getProperty(const PropertyKeyBase &key) const;
+
+  // typed lookups with a pre-interned key. as for lookups by name, the
+  // first throws if the property is missing or can't be read as a T, while
+  // the others return the default or false.
+  template <typename T>
+  T get(const PropertyKey<T> &key) const;
+  template <typename T>
+  T get(const PropertyKey<T> &key, const T &defaultVal) const;
+  template <typename T>
+  bool getInto(T &dest, const PropertyKey<T> &key) const;
+
+  // look up several properties in a single walk up this context's
+  // ancestors, with a single tracer callback. writes one pointer per name
+  // into dest, which must have room for them all; properties which aren't
+  // set are written as null. returns the number of properties found.
+  size_t getProperties(const std::vector<std::string> &propertyNames,
+      const CcsProperty **dest) const;
+  size_t getProperties(const PropertySet &properties,
+      const CcsProperty **dest) const;
 
   const std::string &getString(const std::string &propertyName) const;
   const std::string &getString(const std::string &propertyName,
@@ -72,13 +145,24 @@ public:
   template <typename T>
   bool getInto(T &dest, const std::string &propertyName) const;
 
-  friend std::ostream &operator<<(std::ostream &, const CcsContext);
+  friend std::ostream &operator<<(std::ostream &, const CcsContext &);
 
   template<class T>
   static bool coerceString(const std::string &s, T &dest);
+  template<class T>
+  static T coerceProperty(const CcsProperty &prop,
+      const std::string &propertyName);
+  // as above, but false rather than throwing if prop can't be coerced.
+  template<class T>
+  static bool coercePropertyInto(const CcsProperty &prop, T &dest);
 
 private:
   static bool checkEmpty(std::istream &stream);
+
+  // apply the same constraints that led to this context, in the same order,
+  // to the given root, which may belong to another domain. constraints which
+  // add nothing, such as lazy()'s, are left out.
+  CcsContext rebase(const CcsContext &root) const;
 };
 
 
@@ -132,6 +216,90 @@ inline bool CcsContext::coerceString<bool>(const std::string &s,
   return false;
 }
 
+template<class T>
+T CcsContext::coerceProperty(const CcsProperty &prop,
+    const std::string &propertyName) {
+  T t;
+  if (!coerceString(prop.strValue(), t))
+    throw bad_coercion(propertyName, prop.strValue());
+  return t;
+}
+
+template<>
+inline std::string CcsContext::coerceProperty<std::string>(
+    const CcsProperty &prop, const std::string &) {
+  return prop.strValue();
+}
+
+template<>
+inline int CcsContext::coerceProperty<int>(const CcsProperty &prop,
+    const std::string &) {
+  return prop.intValue();
+}
+
+template<>
+inline double CcsContext::coerceProperty<double>(const CcsProperty &prop,
+    const std::string &) {
+  return prop.doubleValue();
+}
+
+template<>
+inline bool CcsContext::coerceProperty<bool>(const CcsProperty &prop,
+    const std::string &) {
+  return prop.boolValue();
+}
+
+template<class T>
+bool CcsContext::coercePropertyInto(const CcsProperty &prop, T &dest) {
+  return coerceString(prop.strValue(), dest);
+}
+
+template<>
+inline bool CcsContext::coercePropertyInto<std::string>(
+    const CcsProperty &prop, std::string &dest) {
+  dest = prop.strValue();
+  return true;
+}
+
+template<>
+inline bool CcsContext::coercePropertyInto<int>(const CcsProperty &prop,
+    int &dest) {
+  return prop.coerce(dest);
+}
+
+template<>
+inline bool CcsContext::coercePropertyInto<double>(const CcsProperty &prop,
+    double &dest) {
+  return prop.coerce(dest);
+}
+
+template<>
+inline bool CcsContext::coercePropertyInto<bool>(const CcsProperty &prop,
+    bool &dest) {
+  return prop.coerce(dest);
+}
+
+template <typename T>
+T CcsContext::get(const PropertyKey<T> &key) const {
+  const CcsProperty &prop = getProperty(key);
+  if (!prop.exists()) throw no_such_property(key.name(), *this);
+  return coerceProperty<T>(prop, key.name());
+}
+
+template <typename T>
+T CcsContext::get(const PropertyKey<T> &key, const T &defaultVal) const {
+  const CcsProperty &prop = getProperty(key);
+  T t;
+  if (!prop.exists() || !coercePropertyInto(prop, t)) return defaultVal;
+  return t;
+}
+
+template <typename T>
+bool CcsContext::getInto(T &dest, const PropertyKey<T> &key) const {
+  const CcsProperty &prop = getProperty(key);
+  return prop.exists() && coercePropertyInto(prop, dest);
+}
+
 template <typename T>
 T CcsContext::get(const std::string &propertyName) const {
   auto &val = getString(propertyName);
@@ -175,4 +343,35 @@ public:
       const std::vector<std::string> &values);
 };
 
+
+/*
+ * a fixed list of property names, to be looked up together with
+ * CcsContext::getProperties(). build one up front and reuse it. one built
+ * with CcsDomain::propertySet() holds the names already interned, as a
+ * PropertyKey does, so lookups in that domain's contexts skip hashing the
+ * names; anywhere else, and for one built directly from names, each lookup
+ * finds them by name.
+ */
+class CcsContext::PropertySet {
+  friend class CcsDomain;
+  std::vector<std::string> names_;
+  std::vector<unsigned> ids_;
+  uint64_t domain_;
+
+  PropertySet(std::vector<std::string> names, std::vector<unsigned> ids,
+      uint64_t domain) :
+    names_(std::move(names)), ids_(std::move(ids)), domain_(domain) {}
+
+public:
+  explicit PropertySet(std::vector<std::string> names) :
+    names_(std::move(names)), domain_(0) {}
+
+  const std::vector<std::string> &names() const { return names_; }
+  size_t size() const { return names_.size(); }
+  // the interned ids, one per name, and the domain that interned them (see
+  // PropertyKeyBase::domain()), or nothing and 0 if not built by a domain
+  const std::vector<unsigned> &ids() const { return ids_; }
+  uint64_t domain() const { return domain_; }
+};
+
 }
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ccs/context.h"
+
+namespace ccs {
+
+/*
+ * a bounded cache of derived contexts, keyed by parent context and
+ * constraint, for callers who would otherwise constrain the same context the
+ * same way over and over. values are normalized first, so order and
+ * duplicates don't matter.
+ *
+ * every cached context pins its parent chain, so with high-cardinality values
+ * (customer ids, say) an unbounded cache would grow forever. this one keeps
+ * the memory held by its entries within a byte budget, evicting the least
+ * recently used entry first. an entry's size is estimated from its own search
+ * state: the active rules, partial matches and property settings it holds.
+ * ancestors are only counted if they're cached too, and a lazy context is
+ * measured as activated when it was cached.
+ *
+ * the cache is split into independently locked shards, each with its own
+ * share of the budget, so it may be used from any number of threads at once.
+ * contexts allocated from an arena are never cached.
+ */
+class CcsContextCache {
+  class Impl;
+  std::unique_ptr<Impl> impl;
+
+public:
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries;
+    size_t bytes;
+  };
+
+  explicit CcsContextCache(size_t maxBytes = 64 << 20);
+  ~CcsContextCache();
+  CcsContextCache(const CcsContextCache &) = delete;
+  CcsContextCache &operator=(const CcsContextCache &) = delete;
+
+  // equivalent to parent.constrain(name, values), but returns the cached
+  // context if there is one, and caches the new one if not.
+  CcsContext constrain(const CcsContext &parent, const std::string &name,
+      const std::vector<std::string> &values = {});
+
+  Stats stats() const;
+  // drop every entry. the counters are kept.
+  void clear();
+};
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ccs/context.h"
+
+namespace ccs {
+
+/*
+ * a fixed sequence of constraints, such as "service > region > customer",
+ * compiled once against a domain so that contexts of that shape can be built
+ * quickly with different values. building one is equivalent to constraining
+ * a context with each name and value in turn, but every step finds the rules
+ * it activates through an index prepared at compile time, rather than by
+ * testing each rule under each active node. the root context is also built
+ * just once, up front.
+ *
+ * a template refers directly to its domain's rule dag, and keeps that alive,
+ * but its root context doesn't see rules added to the domain after it was
+ * compiled, or the effects of CcsDomain::optimize(). obtain one with
+ * CcsDomain::contextTemplate(), after loading and optimizing. if the domain
+ * changes anyway, building from a newer parent context still works, but
+ * falls back to constrain(). templates are immutable, and copies are cheap
+ * and share everything.
+ */
+class CcsContextTemplate {
+  friend class CcsDomain;
+  class Impl;
+  std::shared_ptr<const Impl> impl;
+
+  explicit CcsContextTemplate(std::shared_ptr<const Impl> impl);
+
+public:
+  const std::vector<std::string> &names() const;
+
+  // build a context from the domain's root, one value per name. throws
+  // std::invalid_argument if the number of values is wrong.
+  CcsContext build(const std::vector<std::string> &values) const;
+  // as above, starting from some other context of the same domain. for a
+  // context from any other domain, this just falls back to constrain().
+  CcsContext build(const CcsContext &parent,
+      const std::vector<std::string> &values) const;
+};
+
+}
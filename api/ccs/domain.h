@@ -4,13 +4,18 @@
 #include <memory>
 #include <iosfwd>
 #include <string>
+#include <vector>
 
+#include "ccs/bulk_loader.h"
 #include "ccs/context.h"
+#include "ccs/context_template.h"
+#include "ccs/matcher.h"
 #include "ccs/rule_builder.h"
 
 namespace ccs {
 
 class DagBuilder;
+class ParseCache;
 
 class CcsLogger {
 public:
@@ -37,6 +42,31 @@ public:
       const std::string &propertyName,
       const std::vector<const CcsProperty *> values) = 0;
   virtual void onParseError(const std::string &msg) = 0;
+  // called once for a batch lookup, with one entry in props (possibly null)
+  // per name. by default, reports each lookup individually.
+  virtual void onPropertiesFound(
+      const CcsContext &ccsContext,
+      const std::vector<std::string> &propertyNames,
+      const CcsProperty *const *props);
+  // as above, but with the names as interned by the context's domain, so
+  // that a tracer can tell them apart without comparing strings. domain and
+  // ids are as for PropertyKeyBase; an id is ~0u if the domain has never
+  // seen the name. lookups report through these. by default, they just call
+  // the ones above.
+  virtual void onInternedPropertyFound(
+      const CcsContext &ccsContext,
+      const std::string &propertyName,
+      uint64_t domain, unsigned id,
+      const CcsProperty &prop);
+  virtual void onInternedPropertyNotFound(
+      const CcsContext &ccsContext,
+      const std::string &propertyName,
+      uint64_t domain, unsigned id);
+  virtual void onInternedPropertiesFound(
+      const CcsContext &ccsContext,
+      const std::vector<std::string> &propertyNames,
+      uint64_t domain, const unsigned *ids,
+      const CcsProperty *const *props);
 
   static std::shared_ptr<CcsTracer> makeLoggingTracer(
     std::shared_ptr<CcsLogger> logger, bool logAccesses = false);
@@ -50,7 +80,95 @@ public:
       std::function<bool(std::istream &)> load) = 0;
 };
 
+/*
+ * remembers the parsed rules of each file loaded through it, keyed by file
+ * name (or import location) and checked against a fingerprint of the file's
+ * contents. when the same files are loaded again, typically into a fresh
+ * domain on reload, only those whose contents changed are parsed again.
+ * every file is still read, and the whole ruleset is built into the new
+ * domain, in the same order and with the same results as an uncached load.
+ * a cache may be shared between domains and threads.
+ *
+ * a domain also remembers what each file loaded through a cache contributed
+ * to it, so that CcsReloadableDomain can bring it up to date with just the
+ * files that changed, as long as nothing else was loaded into it.
+ *
+ * note that environment variables in string values are interpolated when a
+ * file is parsed, so a reused file keeps the values it was first parsed with.
+ */
+class CcsParseCache {
+  friend class CcsDomain;
+  std::unique_ptr<ParseCache> cache;
+
+public:
+  CcsParseCache();
+  ~CcsParseCache();
+  CcsParseCache(const CcsParseCache &) = delete;
+  CcsParseCache &operator=(const CcsParseCache &) = delete;
+
+  // number of files currently cached
+  size_t size() const;
+  // running totals of files parsed and files reused, across all loads
+  size_t parses() const;
+  size_t reuses() const;
+  void clear();
+};
+
+/*
+ * a set of definitions of a single property which may tie on specificity
+ * and override status in some context. such ties are otherwise only detected
+ * (and reported to the tracer) when a lookup happens to hit them.
+ */
+struct CcsConflict {
+  struct Definition {
+    Origin origin;
+    std::string value;
+    bool viaTally; // reachable only through a conjunction or disjunction
+  };
+
+  std::string propertyName;
+  bool override;
+  std::vector<Definition> definitions; // in load order
+};
+
+std::ostream &operator<<(std::ostream &os, const CcsConflict &conflict);
+
+/*
+ * the size of the rule dag before and after CcsDomain::optimize(), counting
+ * every node, including those of conjunctions and disjunctions, and every
+ * tally joining two nodes into one of those. merged counts the nodes merged
+ * into an equivalent one. the rest of the difference was pruned.
+ */
+struct CcsOptimizeStats {
+  size_t nodesBefore;
+  size_t nodesAfter;
+  size_t talliesBefore;
+  size_t talliesAfter;
+  size_t merged;
+};
+
+std::ostream &operator<<(std::ostream &os, const CcsOptimizeStats &stats);
+
+/*
+ * a single definition of a property, along with the selector it was defined
+ * under, in ccs syntax, as it's represented in the dag: "a.b { c { x = 1 } }"
+ * yields "(a.b c)", for instance. the empty string means the root.
+ */
+struct CcsDefinition {
+  std::string selector;
+  Origin origin;
+  std::string value;
+  bool override;
+};
+
+/*
+ * loading rules and creating property keys modify the domain, and must not
+ * run concurrently with anything else. once loading is done, contexts built
+ * from the domain may be used (and shared) freely across threads. see the
+ * README for details.
+ */
 class CcsDomain {
+  friend class CcsReloadableDomain;
   std::unique_ptr<DagBuilder> dag;
 
 public:
@@ -63,11 +181,72 @@ public:
 
   CcsDomain &loadCcsStream(std::istream &stream, const std::string &fileName,
       ImportResolver &importResolver);
+  CcsDomain &loadCcsStream(std::istream &stream, const std::string &fileName,
+      ImportResolver &importResolver, CcsParseCache &cache);
   RuleBuilder ruleBuilder();
+  // for loading generated rules in bulk (see bulk_loader.h). source names
+  // the rules' origin.
+  CcsBulkLoader bulkLoader(const std::string &source = "<bulk>");
+  // true if any stream failed to load into this domain. such a stream has
+  // already been reported to the tracer, and contributes no rules at all.
+  bool loadFailed() const;
+
+  // intern a property name for fast, typed lookups with CcsContext::get().
+  // like loading, this modifies the domain, so create keys up front rather
+  // than concurrently with lookups.
+  template <typename T>
+  PropertyKey<T> propertyKey(const std::string &name) {
+    PropertyKeyBase key = internProperty(name);
+    return PropertyKey<T>(key.id(), name, key.domain());
+  }
+  // likewise, intern a list of names for CcsContext::getProperties().
+  CcsContext::PropertySet propertySet(std::vector<std::string> names);
 
   void logRuleDag(std::ostream &os) const;
 
+  // simplify the rule dag once loading is done, so that contexts have fewer
+  // nodes to activate and search. nodes and tallies which can never
+  // contribute a property or constraint are pruned, and equivalent nodes
+  // are merged: "a b c" and "a { b c }" become one node, for instance. no
+  // context built afterwards can tell the difference. like loading, this
+  // modifies the domain, and contexts, context templates and matchers built
+  // before it may not see every rule. definitionsOf() reports a merged
+  // definition under the selector of the node it was merged into.
+  CcsOptimizeStats optimize();
+
+  // statically analyze the rule dag for potential conflicts. this is
+  // linear in the size of the dag, so it's reasonable to run after every
+  // load, or from a standalone checker.
+  std::vector<CcsConflict> findConflicts() const;
+
+  // every definition of the named property, in load order, or nothing if it
+  // was never defined. the index behind this is kept up to date as rules are
+  // added, so a lookup costs only as much as the definitions it returns.
+  std::vector<CcsDefinition> definitionsOf(
+      const std::string &propertyName) const;
+  // the names of all properties with at least one definition, sorted.
+  std::vector<std::string> definedProperties() const;
+
   CcsContext build();
+  // compile a sequence of constraint names for building contexts quickly
+  // (see context_template.h). do this after loading and optimizing.
+  CcsContextTemplate contextTemplate(const std::vector<std::string> &names);
+  // compile a sequence of constraint names into a decision tree which
+  // resolves whole contexts of that shape (see matcher.h). do this after
+  // loading and optimizing.
+  CcsMatcher matcher(const std::vector<std::string> &names);
+  // a smaller copy of this domain, for apps which always work beneath the
+  // given context of it (a fixed env and region, say). build() on the copy
+  // returns the equivalent of that context, and every context derived from
+  // it sees the same properties as the same context derived from the
+  // original, provided it's never constrained again by any name the context
+  // was. rules which could then never apply are left out, and the rules
+  // the context already satisfies are resolved once, up front. throws
+  // std::invalid_argument if the context isn't one of this domain's.
+  std::unique_ptr<CcsDomain> specialize(const CcsContext &context) const;
+
+private:
+  PropertyKeyBase internProperty(const std::string &name);
 };
 
 }
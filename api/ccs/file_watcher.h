@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ccs/domain.h"
+#include "ccs/reloadable.h"
+
+namespace ccs {
+
+/*
+ * resolves imports as file names, relative to a base directory unless
+ * they're absolute.
+ */
+class CcsFileImportResolver : public ImportResolver {
+  std::string baseDir;
+
+public:
+  explicit CcsFileImportResolver(const std::string &baseDir) :
+    baseDir(baseDir) {}
+
+  std::string path(const std::string &location) const;
+  virtual bool resolve(const std::string &location,
+      std::function<bool(std::istream &)> load);
+};
+
+/*
+ * a reloadable domain which loads a file, with imports resolved relative to
+ * that file's directory, and reloads it in the background whenever the file
+ * or anything it imported changes.
+ *
+ * on linux, changes are noticed with inotify; elsewhere, files are checked
+ * once per debounce interval. after a change, the watcher waits for things to
+ * settle for the debounce interval, then compares the contents of every file
+ * with what was last loaded, and only reloads if something actually differs.
+ * only the changed files are parsed again. the set of files watched is
+ * updated after every load, so new imports are picked up, and a file which
+ * failed to load is still watched so that a fix is noticed.
+ */
+class CcsFileWatcher {
+  class Impl;
+  std::unique_ptr<Impl> impl;
+
+public:
+  // loads the file synchronously, then starts watching. if tracer is null,
+  // a domain's default logging tracer is used.
+  explicit CcsFileWatcher(const std::string &fileName,
+      std::shared_ptr<CcsTracer> tracer = nullptr,
+      std::chrono::milliseconds debounce = std::chrono::milliseconds(200));
+  ~CcsFileWatcher();
+  CcsFileWatcher(const CcsFileWatcher &) = delete;
+  CcsFileWatcher &operator=(const CcsFileWatcher &) = delete;
+
+  CcsReloadableDomain &domain();
+
+  // the files read by the last load, whether or not it succeeded
+  std::vector<std::string> files() const;
+  // number of times files were touched, but no contents actually changed
+  uint64_t skippedReloads() const;
+};
+
+}
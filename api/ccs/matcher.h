@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ccs/context.h"
+#include "ccs/snapshot.h"
+
+namespace ccs {
+
+/*
+ * a decision tree over a fixed sequence of constraint names, for apps which
+ * only ever constrain by those names, in that order (env > region > service >
+ * host, say). matching a sequence of values takes one transition per name,
+ * ending at a leaf which holds a snapshot of every property visible in the
+ * resulting context. that's a hash lookup or two per name, with no rule
+ * activation at all.
+ *
+ * only the values mentioned somewhere in the rules (in a selector or an
+ * @constrain) can make any difference, so every other value of a name takes
+ * the same branch. such values are matched as a stand-in, shown as "name.*"
+ * in the leaf's context. branches are built the first time they're needed,
+ * so the tree only grows with the combinations of mentioned values actually
+ * seen, however many distinct values there are. for anything beyond the
+ * schema, build an ordinary context with context(), and constrain that.
+ *
+ * like a context template, a matcher keeps its domain's dag alive, but
+ * doesn't see rules added after it was compiled, or the effects of
+ * CcsDomain::optimize(). obtain one with CcsDomain::matcher(), after loading
+ * and optimizing. a matcher may be shared freely across threads, and copies
+ * share the same tree.
+ */
+class CcsMatcher {
+  friend class CcsDomain;
+  class Impl;
+  std::shared_ptr<Impl> impl;
+
+  explicit CcsMatcher(std::shared_ptr<Impl> impl);
+
+public:
+  const std::vector<std::string> &names() const;
+
+  // the properties of the context with the given values, one per name.
+  // throws std::invalid_argument if the number of values is wrong.
+  CcsSnapshot match(const std::vector<std::string> &values) const;
+  // the same context, built the ordinary way with the actual values.
+  CcsContext context(const std::vector<std::string> &values) const;
+
+  // the number of branches built so far
+  size_t size() const;
+};
+
+}
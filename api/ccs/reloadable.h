@@ -0,0 +1,254 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "ccs/context.h"
+#include "ccs/domain.h"
+
+namespace ccs {
+
+class CcsReloadableDomain;
+struct DagDiff;
+
+/*
+ * the type-independent part of a live property (see CcsLiveProperty below).
+ * everything here is only touched while holding the owning domain's reload
+ * lock.
+ */
+class CcsLiveBinding {
+  friend class CcsReloadableDomain;
+  CcsContext context;
+  std::string propertyName;
+  bool exists;
+  std::string value; // as a string, to detect changes
+
+protected:
+  CcsLiveBinding(const CcsContext &context, const std::string &propertyName) :
+    context(context), propertyName(propertyName), exists(false) {}
+
+  const std::string &name() const { return propertyName; }
+  // coerce and publish a new value, or the default if prop is null.
+  virtual void store(const CcsProperty *prop) = 0;
+
+public:
+  virtual ~CcsLiveBinding() {}
+};
+
+/*
+ * a property value that follows a CcsReloadableDomain as new versions are
+ * published. reading it is a single atomic load (for values no larger than a
+ * pointer; others are held by an atomic shared_ptr and copied out), with no
+ * lookup at all. after each reload, the property is resolved again in the
+ * new version if its definitions changed at all, and the value
+ * is replaced only if it actually changed.
+ *
+ * if the property isn't set, or can't be coerced to a T, the default is used.
+ * handles are cheap to copy; all copies share the same value. create them
+ * with CcsReloadableDomain::live().
+ */
+template <typename T>
+class CcsLiveProperty {
+  friend class CcsReloadableDomain;
+
+  static const bool Lockfree = std::is_trivially_copyable<T>::value
+      && sizeof(T) <= sizeof(void *);
+
+  template <typename U, bool = Lockfree>
+  struct Value {
+    std::atomic<U> value;
+    explicit Value(const U &u) : value(u) {}
+    U load() const { return value.load(std::memory_order_acquire); }
+    void store(const U &u) { value.store(u, std::memory_order_release); }
+  };
+
+  template <typename U>
+  struct Value<U, false> {
+    std::shared_ptr<const U> value;
+    explicit Value(const U &u) : value(std::make_shared<const U>(u)) {}
+    U load() const { return *std::atomic_load(&value); }
+    void store(const U &u)
+      { std::atomic_store(&value, std::make_shared<const U>(u)); }
+  };
+
+  class Binding : public CcsLiveBinding {
+    T defaultVal;
+
+  public:
+    Value<T> value;
+
+    Binding(const CcsContext &context, const std::string &propertyName,
+        const T &defaultVal) :
+      CcsLiveBinding(context, propertyName), defaultVal(defaultVal),
+      value(defaultVal) {}
+
+    void store(const CcsProperty *prop) override {
+      if (!prop) {
+        value.store(defaultVal);
+        return;
+      }
+      T t;
+      if (CcsContext::coercePropertyInto(*prop, t)) value.store(t);
+      else value.store(defaultVal);
+    }
+  };
+
+  std::shared_ptr<const Binding> binding;
+
+  explicit CcsLiveProperty(std::shared_ptr<const Binding> binding) :
+    binding(std::move(binding)) {}
+
+public:
+  T get() const { return binding->value.load(); }
+};
+
+/*
+ * a property whose value in some context differs between two versions of a
+ * CcsReloadableDomain.
+ */
+struct CcsChange {
+  CcsContext context; // in the newer version
+  std::string propertyName;
+  bool existed;
+  std::string oldValue;
+  bool exists;
+  std::string newValue;
+};
+
+class CcsSubscriber;
+
+/*
+ * keeps change notifications flowing to a callback registered with
+ * CcsReloadableDomain::subscribe(). notifications stop once every copy has
+ * been destroyed or cancelled, although a batch already being delivered
+ * will still complete.
+ */
+class CcsSubscription {
+  friend class CcsReloadableDomain;
+  std::shared_ptr<CcsSubscriber> subscriber;
+
+  explicit CcsSubscription(std::shared_ptr<CcsSubscriber> subscriber) :
+    subscriber(std::move(subscriber)) {}
+
+public:
+  CcsSubscription() {}
+  void cancel() { subscriber.reset(); }
+};
+
+/*
+ * a handle to a ruleset that can be replaced while other threads are reading
+ * it. each reload builds a complete CcsDomain off to the side, and only then
+ * publishes it with a single atomic pointer swap, so readers never see a
+ * partially-built dag and never wait for a reload.
+ *
+ * the domain a reload builds is usually the one published before the current
+ * one, brought up to date in place, once nothing refers to it any longer. if
+ * the loader only ever loads streams through a CcsParseCache, the rules of
+ * unchanged files are left as they are, and a reload costs about as much as
+ * the files that changed. otherwise, or if the files are loaded in a different
+ * order, or if a changed file grows a great deal, the loader is run a second
+ * time, against a fresh, empty domain.
+ *
+ * a context is pinned to the version it was built from: everything derived
+ * from it keeps reading that version, even after a newer one is published,
+ * so versions never mix within a context. an old version's dag is freed when
+ * the last context built from it goes away (or it's reused, as above). call
+ * build() again to pick up the latest version.
+ *
+ * reloads are serialized with each other. a reload that fails (the loader
+ * throws, or any stream fails to parse) publishes nothing, and the current
+ * version remains in place.
+ */
+class CcsReloadableDomain {
+public:
+  // loads rules into a domain, either empty or holding what the same loader
+  // loaded into it before (see above). called once per reload, or twice if
+  // an update in place doesn't work out.
+  typedef std::function<void(CcsDomain &)> Loader;
+
+  struct Version {
+    uint64_t number; // 0 before anything has loaded successfully
+    std::shared_ptr<const CcsDomain> domain;
+    CcsContext root;
+    // true if the domain was updated in place, rather than loaded afresh
+    bool incremental;
+  };
+
+  // performs the initial load synchronously. if it fails, version 0 (an
+  // empty domain) is published in its place. that includes the loader
+  // throwing, which is reported to the tracer rather than propagated. if
+  // tracer is null, a domain's default logging tracer is used.
+  explicit CcsReloadableDomain(Loader loader,
+      std::shared_ptr<CcsTracer> tracer = nullptr);
+  ~CcsReloadableDomain();
+  CcsReloadableDomain(const CcsReloadableDomain &) = delete;
+  CcsReloadableDomain &operator=(const CcsReloadableDomain &) = delete;
+
+  // the latest published version. never blocks on a reload in progress.
+  std::shared_ptr<const Version> current() const;
+  uint64_t version() const { return current()->number; }
+  CcsContext build() const { return current()->root; }
+
+  // re-run the loader and publish the result, returning true if a new version
+  // was published. exceptions thrown by the loader propagate to the caller.
+  bool reload();
+  // replace the loader used for this and all subsequent reloads.
+  bool reload(Loader loader);
+  // reload on a background thread. safe to call even if this handle will be
+  // destroyed before the reload finishes.
+  std::future<bool> reloadAsync();
+
+  // a handle to the value of a property in the given context, kept up to
+  // date across reloads. the context may come from any version of this
+  // domain; the same constraints are applied afresh to each new version.
+  template <typename T>
+  CcsLiveProperty<T> live(const CcsContext &context,
+      const std::string &propertyName, const T &defaultVal = T());
+
+  // each subscriber is called with a batch of all the properties it's
+  // interested in whose values changed, whenever a new version is published.
+  // callbacks run one at a time, on a notification thread of their own, so a
+  // slow subscriber never delays a reload. if several versions are published
+  // in quick succession, the changes between them may be combined into one
+  // batch. to find what changed, the rules of the two versions are compared
+  // first, and only properties whose definitions differ are looked up again.
+  typedef std::function<void(const std::vector<CcsChange> &)> ChangeCallback;
+  CcsSubscription subscribe(const CcsContext &context,
+      const std::vector<std::string> &propertyNames, ChangeCallback callback);
+  // as above, for every property in the context.
+  CcsSubscription subscribe(const CcsContext &context,
+      ChangeCallback callback);
+  // block until all notifications for versions published so far have been
+  // delivered.
+  void waitForNotifications() const;
+
+private:
+  class Impl;
+  std::shared_ptr<Impl> impl;
+
+  void addLive(std::shared_ptr<CcsLiveBinding> binding);
+  // move each live binding to the given new root, dropping any which are no
+  // longer referenced, and re-resolve those whose property the diff reports
+  // as changed (all of them, if diff is null). returns the number of changed
+  // values.
+  static size_t refreshAll(std::vector<std::weak_ptr<CcsLiveBinding>> &live,
+      const CcsContext &root, const DagDiff *diff);
+  static bool refresh(CcsLiveBinding &binding);
+};
+
+template <typename T>
+CcsLiveProperty<T> CcsReloadableDomain::live(const CcsContext &context,
+    const std::string &propertyName, const T &defaultVal) {
+  auto binding = std::make_shared<typename CcsLiveProperty<T>::Binding>(
+      context, propertyName, defaultVal);
+  addLive(binding);
+  return CcsLiveProperty<T>(std::move(binding));
+}
+
+}
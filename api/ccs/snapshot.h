@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "ccs/context.h"
+#include "ccs/types.h"
+
+namespace ccs {
+
+/*
+ * an immutable, flattened view of every property visible in a context. all
+ * settings are resolved up front (reporting any conflicts once, at creation)
+ * into a single open-addressed hash table keyed by interned name, so a
+ * lookup is one hashed probe rather than a walk up the context's ancestors.
+ * intended for long-lived contexts; obtain one with CcsContext::snapshot().
+ * copies are cheap and share the underlying table.
+ */
+class CcsSnapshot {
+  friend class CcsContext;
+  class Impl;
+  std::shared_ptr<const Impl> impl;
+
+  explicit CcsSnapshot(std::shared_ptr<const Impl> impl);
+
+public:
+  const CcsContext &context() const;
+
+  // number of properties visible in the snapshot
+  size_t size() const;
+  // approximate heap footprint of the snapshot itself, in bytes. this does
+  // not include the rule dag or the context, which are shared.
+  size_t memoryUsage() const;
+
+  const CcsProperty &getProperty(const std::string &propertyName) const;
+  const CcsProperty &getProperty(const PropertyKeyBase &key) const;
+
+  // typed lookups with a pre-interned key, as for CcsContext.
+  template <typename T>
+  T get(const PropertyKey<T> &key) const;
+  template <typename T>
+  T get(const PropertyKey<T> &key, const T &defaultVal) const;
+  template <typename T>
+  bool getInto(T &dest, const PropertyKey<T> &key) const;
+
+  const std::string &getString(const std::string &propertyName) const;
+  const std::string &getString(const std::string &propertyName,
+      const std::string &defaultVal) const;
+  bool getInto(std::string &dest, const std::string &propertyName) const;
+
+  int getInt(const std::string &propertyName) const;
+  int getInt(const std::string &propertyName, int defaultVal) const;
+  bool getInto(int &dest, const std::string &propertyName) const;
+
+  double getDouble(const std::string &propertyName) const;
+  double getDouble(const std::string &propertyName, double defaultVal) const;
+  bool getInto(double &dest, const std::string &propertyName) const;
+
+  bool getBool(const std::string &propertyName) const;
+  bool getBool(const std::string &propertyName, bool defaultVal) const;
+  bool getInto(bool &dest, const std::string &propertyName) const;
+};
+
+template <typename T>
+T CcsSnapshot::get(const PropertyKey<T> &key) const {
+  const CcsProperty &prop = getProperty(key);
+  if (!prop.exists()) throw no_such_property(key.name(), context());
+  return CcsContext::coerceProperty<T>(prop, key.name());
+}
+
+template <typename T>
+T CcsSnapshot::get(const PropertyKey<T> &key, const T &defaultVal) const {
+  const CcsProperty &prop = getProperty(key);
+  T t;
+  if (!prop.exists() || !CcsContext::coercePropertyInto(prop, t))
+    return defaultVal;
+  return t;
+}
+
+template <typename T>
+bool CcsSnapshot::getInto(T &dest, const PropertyKey<T> &key) const {
+  const CcsProperty &prop = getProperty(key);
+  return prop.exists() && CcsContext::coercePropertyInto(prop, dest);
+}
+
+}
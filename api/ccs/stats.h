@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ccs/domain.h"
+
+namespace ccs {
+
+/*
+ * a tracer that aggregates property accesses rather than logging them. counts
+ * are kept per property name, with a separate set of counters for each
+ * thread, added up when a snapshot is taken. threads never contend on a
+ * counter, and once a thread has counted a name, it finds the counters by
+ * the name's interned id, without hashing the name again. so it's cheap
+ * enough to leave enabled in production and safe to share across threads.
+ * all callbacks are also forwarded to an optional delegate, so that
+ * conflicts and parse errors can still be logged.
+ *
+ * counts per context are optional (trackContexts), and off by default: each
+ * lookup then formats its context's constraints as a string, which costs far
+ * more than the lookup itself usually does. fine for a debugging session,
+ * less so left running in production.
+ */
+class CcsStatsTracer : public CcsTracer {
+  class Impl;
+  std::unique_ptr<Impl> impl;
+
+public:
+  struct PropertyStats {
+    std::string name;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t conflicts;
+
+    uint64_t lookups() const { return hits + misses; }
+  };
+
+  struct ContextStats {
+    std::string context;
+    uint64_t lookups;
+  };
+
+  struct Snapshot {
+    // both sorted by descending lookup count
+    std::vector<PropertyStats> properties;
+    std::vector<ContextStats> contexts;
+  };
+
+  explicit CcsStatsTracer(std::shared_ptr<CcsTracer> delegate = nullptr,
+      bool trackContexts = false);
+  virtual ~CcsStatsTracer();
+  CcsStatsTracer(const CcsStatsTracer &) = delete;
+  CcsStatsTracer &operator=(const CcsStatsTracer &) = delete;
+
+  // properties and contexts with no counts at all are left out.
+  Snapshot snapshot() const;
+  // zero every count. safe to call while other threads are counting, though
+  // their concurrent lookups may or may not be counted.
+  void reset();
+
+  void dumpText(std::ostream &os) const;
+  void dumpJson(std::ostream &os) const;
+
+  virtual void onPropertyFound(
+      const CcsContext &ccsContext,
+      const std::string &propertyName,
+      const CcsProperty &prop);
+  virtual void onPropertyNotFound(
+      const CcsContext &ccsContext,
+      const std::string &propertyName);
+  virtual void onConflict(
+      const CcsContext &ccsContext,
+      const std::string &propertyName,
+      const std::vector<const CcsProperty *> values);
+  virtual void onParseError(const std::string &msg);
+  virtual void onPropertiesFound(
+      const CcsContext &ccsContext,
+      const std::vector<std::string> &propertyNames,
+      const CcsProperty *const *props);
+  virtual void onInternedPropertyFound(
+      const CcsContext &ccsContext,
+      const std::string &propertyName,
+      uint64_t domain, unsigned id,
+      const CcsProperty &prop);
+  virtual void onInternedPropertyNotFound(
+      const CcsContext &ccsContext,
+      const std::string &propertyName,
+      uint64_t domain, unsigned id);
+  virtual void onInternedPropertiesFound(
+      const CcsContext &ccsContext,
+      const std::vector<std::string> &propertyNames,
+      uint64_t domain, const unsigned *ids,
+      const CcsProperty *const *props);
+};
+
+}
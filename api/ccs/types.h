@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <ostream>
 #include <string>
 
@@ -27,6 +28,44 @@ struct CcsProperty {
   virtual int intValue() const = 0;
   virtual double doubleValue() const = 0;
   virtual bool boolValue() const = 0;
+  // non-throwing versions of the above: false if the value can't be coerced
+  // (or doesn't exist), leaving dest alone. by default these coerce
+  // strValue(), as CcsContext::coerceString() does.
+  virtual bool coerce(int &dest) const;
+  virtual bool coerce(double &dest) const;
+  virtual bool coerce(bool &dest) const;
+};
+
+/*
+ * a property name, interned up front by a particular CcsDomain (see
+ * CcsDomain::propertyKey()), so that lookups needn't hash or compare the
+ * name itself. a key used with a context from some other domain still works,
+ * but falls back to looking up the name.
+ */
+class PropertyKeyBase {
+  friend class CcsDomain;
+  unsigned id_;
+  std::string name_;
+  uint64_t domain_;
+
+protected:
+  PropertyKeyBase(unsigned id, const std::string &name, uint64_t domain) :
+    id_(id), name_(name), domain_(domain) {}
+
+public:
+  unsigned id() const { return id_; }
+  const std::string &name() const { return name_; }
+  // identifies the domain which interned the key. never reused, even once
+  // that domain is gone.
+  uint64_t domain() const { return domain_; }
+};
+
+// additionally fixes the type the property will be read as.
+template <typename T>
+class PropertyKey : public PropertyKeyBase {
+  friend class CcsDomain;
+  PropertyKey(unsigned id, const std::string &name, uint64_t domain) :
+    PropertyKeyBase(id, name, domain) {}
 };
 
 }
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <sstream>
+#include <string>
+
+namespace bench {
+
+// a ruleset shaped like a typical service config: global defaults, with
+// overrides per service, per environment and per region.
+inline std::string ruleset(int services, int propsPerService) {
+  std::ostringstream str;
+  for (int p = 0; p < propsPerService; p++)
+    str << "p" << p << " = " << p << "\n";
+  str << "env.prod { p1 = 101; p3 = 103 }\n";
+  for (int s = 0; s < services; s++) {
+    str << "svc.s" << s << " {\n";
+    for (int p = 0; p < propsPerService; p += 2)
+      str << "  p" << p << " = " << s * 1000 + p << "\n";
+    str << "  env.prod { p1 = " << s << " }\n";
+    str << "  region.r" << s % 4 << " > host { p2 = " << s << " }\n";
+    str << "}\n";
+  }
+  return str.str();
+}
+
+template <typename F>
+double seconds(F &&f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+}
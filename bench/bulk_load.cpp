@@ -0,0 +1,97 @@
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ccs/ccs.h"
+
+#include "bench.h"
+
+using namespace ccs;
+
+/*
+ * compares the cost of loading generated rules as ccs text, one at a time
+ * through a RuleBuilder, and through a CcsBulkLoader. the rules are what a
+ * feature flag service might hold: a setting per flag for each of a few
+ * hundred customers, some of them further restricted to a region.
+ *
+ * usage: bulk_load [number of rules]
+ */
+
+namespace {
+
+struct Rule {
+  std::string customer;
+  std::string region; // empty if the rule applies in every region
+  std::string flag;
+  std::string value;
+};
+
+std::vector<Rule> rules(long n) {
+  std::vector<Rule> result;
+  for (long i = 0; i < n; i++) {
+    Rule rule;
+    rule.customer = "c" + std::to_string(i % 500);
+    if (i % 3 == 0) rule.region = "r" + std::to_string(i % 7);
+    rule.flag = "flag" + std::to_string(i / 500 % 100);
+    rule.value = std::to_string(i);
+    result.push_back(rule);
+  }
+  return result;
+}
+
+void report(const char *what, long n, double elapsed) {
+  std::cout << std::setw(12) << what << ": " << std::fixed
+      << std::setprecision(2) << std::setw(9) << elapsed * 1e3 << " ms, "
+      << std::setw(6) << elapsed * 1e6 / n << " us/rule\n";
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 1000000;
+  std::vector<Rule> generated = rules(n);
+  std::cout << n << " rules\n";
+
+  report("text", n, bench::seconds([&] {
+    std::ostringstream str;
+    for (auto it = generated.cbegin(); it != generated.cend(); ++it) {
+      str << "customer." << it->customer;
+      if (!it->region.empty()) str << " region." << it->region;
+      str << " { " << it->flag << " = '" << it->value << "' }\n";
+    }
+    CcsDomain ccs;
+    std::istringstream input(str.str());
+    ccs.loadCcsStream(input, "<bench>", ImportResolver::None);
+  }));
+
+  report("RuleBuilder", n, bench::seconds([&] {
+    CcsDomain ccs;
+    RuleBuilder root = ccs.ruleBuilder();
+    for (auto it = generated.cbegin(); it != generated.cend(); ++it) {
+      RuleBuilder b = root.select("customer", {it->customer});
+      if (!it->region.empty()) b = b.select("region", {it->region});
+      b.set(it->flag, it->value);
+    }
+  }));
+
+  double commit = 0;
+  report("bulk", n, bench::seconds([&] {
+    CcsDomain ccs;
+    CcsBulkLoader loader = ccs.bulkLoader();
+    CcsBulkLoader::Batch batch;
+    for (auto it = generated.cbegin(); it != generated.cend(); ++it) {
+      std::vector<CcsBulkLoader::Step> steps{{"customer", {it->customer}}};
+      if (!it->region.empty()) steps.push_back({"region", {it->region}});
+      batch.selectors.push_back(loader.selector(steps));
+      batch.properties.push_back(loader.property(it->flag));
+      batch.values.push_back(it->value);
+    }
+    loader.add(std::move(batch));
+    commit = bench::seconds([&] { loader.commit(); });
+  }));
+  report("(commit)", n, commit);
+  return 0;
+}
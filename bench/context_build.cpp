@@ -0,0 +1,90 @@
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ccs/ccs.h"
+
+#include "bench.h"
+
+using namespace ccs;
+
+/*
+ * measures the cost of building a per-request context of four steps
+ * (env > svc > region > host), then reading some number of properties from
+ * it, for eager and lazy contexts, for a compiled context template, and for
+ * eager contexts built in an arena which is reset for each request.
+ *
+ * usage: context_build [contexts per case]
+ */
+
+namespace {
+
+struct Case {
+  const char *name;
+  std::function<CcsContext(long i)> build;
+};
+
+void measure(const Case &c, long n, int reads) {
+  long sum = 0;
+  double elapsed = bench::seconds([&] {
+    for (long i = 0; i < n; i++) {
+      CcsContext ctx = c.build(i);
+      for (int r = 0; r < reads; r++) sum += ctx.getInt("p2");
+    }
+  });
+  if (sum == 42) std::cout << "";
+  std::cout << "  " << std::left << std::setw(10) << c.name << std::right
+      << std::setw(10) << std::fixed << std::setprecision(2)
+      << elapsed * 1e6 / n << " us/context\n";
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 20000;
+
+  CcsDomain ccs;
+  std::istringstream input(bench::ruleset(100, 30));
+  ccs.loadCcsStream(input, "<bench>", ImportResolver::None);
+  CcsContext root = ccs.build();
+  CcsContext lazyRoot = root.lazy();
+  CcsContextTemplate tmpl = ccs.contextTemplate(
+      {"env", "svc", "region", "host"});
+
+  CcsStackArena<16384> arena;
+
+  auto steps = [](const CcsContext &root, long i) {
+    return root.constrain("env", {"prod"})
+        .constrain("svc", {"s" + std::to_string(i % 100)})
+        .constrain("region", {"r" + std::to_string(i % 4)})
+        .constrain("host", {"h" + std::to_string(i % 50)});
+  };
+  std::vector<Case> cases = {
+    {"eager", [&](long i) { return steps(root, i); }},
+    {"lazy", [&](long i) { return steps(lazyRoot, i); }},
+    {"template", [&](long i) {
+      return tmpl.build({"prod", "s" + std::to_string(i % 100),
+          "r" + std::to_string(i % 4), "h" + std::to_string(i % 50)});
+    }},
+    {"arena", [&](long i) {
+      // the previous request's context is gone by now.
+      arena.reset();
+      return root.constrain(arena, "env", {"prod"})
+          .constrain("svc", {"s" + std::to_string(i % 100)})
+          .constrain("region", {"r" + std::to_string(i % 4)})
+          .constrain("host", {"h" + std::to_string(i % 50)});
+    }},
+  };
+
+  int reads[] = {0, 1, 10};
+  for (int r = 0; r < 3; r++) {
+    std::cout << reads[r] << " reads per context:\n";
+    for (auto it = cases.cbegin(); it != cases.cend(); ++it)
+      measure(*it, n, reads[r]);
+  }
+  return 0;
+}
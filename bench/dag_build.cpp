@@ -0,0 +1,59 @@
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "ccs/ccs.h"
+
+#include "bench.h"
+
+using namespace ccs;
+
+/*
+ * measures the cost of loading rulesets in which a couple of popular nodes
+ * (env.prod and env.dev) are a leg of a conjunction or disjunction in every
+ * rule, so that each ends up in thousands of tallies. finding the tally for
+ * each new rule should cost the same however many there are already, so the
+ * time per rule should stay flat as the ruleset grows.
+ *
+ * usage: dag_build [largest number of rules]
+ */
+
+namespace {
+
+// every service gets a rule for each of env.prod and env.dev, under both a
+// conjunction (written both ways) and a disjunction. so the env nodes each
+// join thousands of tallies, and each service node a handful.
+std::string ruleset(long rules) {
+  std::ostringstream str;
+  for (long i = 0; i < rules; i++) {
+    long s = i / 4;
+    switch (i % 4) {
+    case 0: str << "env.prod svc.s" << s << " { p = " << i << " }\n"; break;
+    case 1: str << "env.dev { svc.s" << s << " { p = " << i << " } }\n"; break;
+    case 2: str << "env.prod, svc.s" << s << " { q = " << i << " }\n"; break;
+    case 3: str << "svc.s" << s << " { env.dev { q = " << i << " } }\n"; break;
+    }
+  }
+  return str.str();
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  long largest = argc > 1 ? atol(argv[1]) : 64000;
+
+  for (long n = largest / 16; n <= largest; n *= 2) {
+    std::string rules = ruleset(n);
+    double elapsed = bench::seconds([&] {
+      CcsDomain ccs;
+      std::istringstream input(rules);
+      ccs.loadCcsStream(input, "<bench>", ImportResolver::None);
+    });
+    std::cout << std::setw(8) << n << " rules: " << std::fixed
+        << std::setprecision(2) << std::setw(8) << elapsed * 1e3 << " ms, "
+        << std::setw(6) << elapsed * 1e6 / n << " us/rule\n";
+  }
+  return 0;
+}
@@ -0,0 +1,90 @@
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "ccs/ccs.h"
+
+#include "bench.h"
+
+using namespace ccs;
+
+/*
+ * measures how long a reload takes when one file of many has changed. each
+ * reload goes through a parse cache, so only the changed file is parsed
+ * again either way. a fresh reload still lowers every file into a new dag,
+ * while an incremental one replaces just the changed file's rules in the
+ * dag from two versions back, so its cost should stay flat however many
+ * files there are.
+ *
+ * usage: incremental_reload [number of files]
+ */
+
+namespace {
+
+struct MapImportResolver : ImportResolver {
+  std::map<std::string, std::string> files;
+
+  virtual bool resolve(const std::string &location,
+      std::function<bool(std::istream &)> load) {
+    auto it = files.find(location);
+    if (it == files.end()) return false;
+    std::istringstream stream(it->second);
+    return load(stream);
+  }
+};
+
+std::string file(int n, int revision) {
+  std::ostringstream str;
+  str << "svc.s" << n << " {\n";
+  for (int p = 0; p < 40; p++)
+    str << "  p" << p << " = " << n * 1000 + p + revision << "\n";
+  str << "  env.prod { p1 = " << revision << " }\n";
+  str << "  region.r" << n % 4 << " > host { p2 = " << n << " }\n";
+  str << "}\n";
+  return str.str();
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  int files = argc > 1 ? atoi(argv[1]) : 400;
+  const int reloads = 20;
+
+  MapImportResolver ir;
+  for (int n = 0; n < files; n++)
+    ir.files["f" + std::to_string(n)] = file(n, 0);
+
+  for (int pass = 0; pass < 2; pass++) {
+    bool incremental = pass == 1;
+    CcsParseCache cache;
+    CcsReloadableDomain ccs([&](CcsDomain &domain) {
+      for (int n = 0; n < files; n++) {
+        std::string name = "f" + std::to_string(n);
+        std::istringstream input(ir.files[name]);
+        // loading one stream without the cache stops the domain from
+        // being updated in place.
+        if (incremental || n) domain.loadCcsStream(input, name, ir, cache);
+        else domain.loadCcsStream(input, name, ir);
+      }
+    });
+    // warm up, so that the spare domain exists
+    ccs.reload();
+    size_t updated = 0;
+    double elapsed = bench::seconds([&] {
+      for (int r = 1; r <= reloads; r++) {
+        ir.files["f" + std::to_string(r * 7 % files)] = file(r * 7 % files, r);
+        ccs.reload();
+        updated += ccs.current()->incremental;
+      }
+    });
+    std::cout << std::setw(11) << (incremental ? "incremental" : "fresh")
+        << ": " << files << " files, " << std::fixed << std::setprecision(2)
+        << std::setw(8) << elapsed * 1e3 / reloads << " ms/reload ("
+        << updated << " of " << reloads << " in place)\n";
+  }
+  return 0;
+}
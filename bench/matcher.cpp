@@ -0,0 +1,86 @@
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ccs/ccs.h"
+
+#include "bench.h"
+
+using namespace ccs;
+
+/*
+ * measures the cost of resolving a full context of four constraints
+ * (env > svc > region > host) and reading some properties from it: through
+ * ordinary search states, through a context template, and through a matcher
+ * compiled for the same names. hosts are drawn from a large pool, none of
+ * which the rules mention by value, as is typical.
+ *
+ * usage: matcher [contexts per case]
+ */
+
+namespace {
+
+std::vector<std::string> values(long i) {
+  return {i % 10 ? "prod" : "dev", "s" + std::to_string(i % 100),
+      "r" + std::to_string(i % 4), "h" + std::to_string(i % 5000)};
+}
+
+template <typename F>
+void measure(const char *name, long n, int reads, F &&resolve) {
+  long sum = 0;
+  double elapsed = bench::seconds([&] {
+    for (long i = 0; i < n; i++) sum += resolve(values(i), reads);
+  });
+  if (sum == 42) std::cout << "";
+  std::cout << "  " << std::left << std::setw(10) << name << std::right
+      << std::setw(10) << std::fixed << std::setprecision(2)
+      << elapsed * 1e6 / n << " us/context\n";
+}
+
+template <typename C>
+long read(const C &ctx, int reads) {
+  long sum = 0;
+  for (int r = 0; r < reads; r++)
+    sum += ctx.getInt("p" + std::to_string(r % 30));
+  return sum;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 20000;
+
+  CcsDomain ccs;
+  std::istringstream input(bench::ruleset(100, 30));
+  ccs.loadCcsStream(input, "<bench>", ImportResolver::None);
+  std::vector<std::string> names = {"env", "svc", "region", "host"};
+  CcsContext root = ccs.build();
+  CcsContextTemplate tmpl = ccs.contextTemplate(names);
+  CcsMatcher matcher = ccs.matcher(names);
+
+  int reads[] = {1, 10};
+  for (int r = 0; r < 2; r++) {
+    std::cout << reads[r] << " reads per context:\n";
+    measure("search", n, reads[r],
+        [&](const std::vector<std::string> &v, int reads) {
+      CcsContext ctx = root;
+      for (size_t i = 0; i < names.size(); i++)
+        ctx = ctx.constrain(names[i], {v[i]});
+      return read(ctx, reads);
+    });
+    measure("template", n, reads[r],
+        [&](const std::vector<std::string> &v, int reads) {
+      return read(tmpl.build(v), reads);
+    });
+    measure("matcher", n, reads[r],
+        [&](const std::vector<std::string> &v, int reads) {
+      return read(matcher.match(v), reads);
+    });
+  }
+  std::cout << matcher.size() << " branches in the matcher\n";
+  return 0;
+}
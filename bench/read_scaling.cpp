@@ -0,0 +1,107 @@
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "ccs/ccs.h"
+
+#include "bench.h"
+
+using namespace ccs;
+
+/*
+ * measures throughput of concurrent reads from contexts shared by all
+ * threads, for 1..N threads. with no shared mutable state on the read path,
+ * per-thread throughput should stay roughly flat as threads are added, up
+ * to the number of physical cores.
+ *
+ * usage: read_scaling [max threads] [operations per thread]
+ */
+
+namespace {
+
+struct Workload {
+  const char *name;
+  std::function<void(int thread, long ops)> run;
+};
+
+void measure(const Workload &workload, int maxThreads, long ops) {
+  std::cout << workload.name << ":\n";
+  double base = 0;
+  for (int threads = 1; threads <= maxThreads; threads *= 2) {
+    double elapsed = bench::seconds([&] {
+      std::vector<std::thread> pool;
+      for (int t = 0; t < threads; t++)
+        pool.emplace_back(workload.run, t, ops);
+      for (auto it = pool.begin(); it != pool.end(); ++it) it->join();
+    });
+    double rate = threads * ops / elapsed;
+    if (threads == 1) base = rate;
+    std::cout << "  " << std::setw(3) << threads << " threads: "
+        << std::setw(12) << std::fixed << std::setprecision(0) << rate
+        << " ops/s  (scaling " << std::setprecision(2) << rate / base
+        << "x)\n";
+    if (threads < maxThreads && threads * 2 > maxThreads)
+      threads = maxThreads / 2;
+  }
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  int maxThreads = argc > 1 ? atoi(argv[1])
+      : std::max(1u, std::thread::hardware_concurrency());
+  long ops = argc > 2 ? atol(argv[2]) : 1000000;
+
+  CcsDomain ccs;
+  std::istringstream input(bench::ruleset(100, 30));
+  ccs.loadCcsStream(input, "<bench>", ImportResolver::None);
+  auto key = ccs.propertyKey<int>("p2");
+  CcsContext shared = ccs.build().constrain("env", {"prod"})
+      .constrain("svc", {"s7"}).constrain("region", {"r3"})
+      .constrain("host");
+  CcsSnapshot snapshot = shared.snapshot();
+
+  // the same again, but counting every lookup.
+  CcsDomain counted(std::make_shared<CcsStatsTracer>());
+  std::istringstream countedInput(bench::ruleset(100, 30));
+  counted.loadCcsStream(countedInput, "<bench>", ImportResolver::None);
+  auto countedKey = counted.propertyKey<int>("p2");
+  CcsContext countedShared = counted.build().constrain("env", {"prod"})
+      .constrain("svc", {"s7"}).constrain("region", {"r3"})
+      .constrain("host");
+
+  std::vector<Workload> workloads = {
+    {"getInt by name", [&](int, long n) {
+      long sum = 0;
+      for (long i = 0; i < n; i++) sum += shared.getInt("p2");
+      if (sum == 42) std::cout << "";
+    }},
+    {"get by PropertyKey", [&](int, long n) {
+      long sum = 0;
+      for (long i = 0; i < n; i++) sum += shared.get(key);
+      if (sum == 42) std::cout << "";
+    }},
+    {"get by PropertyKey, with CcsStatsTracer", [&](int, long n) {
+      long sum = 0;
+      for (long i = 0; i < n; i++) sum += countedShared.get(countedKey);
+      if (sum == 42) std::cout << "";
+    }},
+    {"snapshot get by PropertyKey", [&](int, long n) {
+      long sum = 0;
+      for (long i = 0; i < n; i++) sum += snapshot.get(key);
+      if (sum == 42) std::cout << "";
+    }},
+    {"constrain from shared parent", [&](int t, long n) {
+      std::string host = "h" + std::to_string(t);
+      for (long i = 0; i < n; i++)
+        shared.constrain("host", {host}).getInt("p0");
+    }},
+  };
+
+  for (auto it = workloads.begin(); it != workloads.end(); ++it)
+    measure(*it, maxThreads, ops);
+  return 0;
+}
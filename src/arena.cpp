@@ -0,0 +1,65 @@
+#include "ccs/arena.h"
+
+#include <algorithm>
+#include <new>
+
+namespace ccs {
+
+CcsArena::CcsArena(size_t blockSize) :
+  next_(nullptr), end_(nullptr), buffer_(nullptr), bufferSize_(0),
+  blocks_(nullptr), current_(nullptr), blockSize_(blockSize) {}
+
+CcsArena::CcsArena(void *buffer, size_t size, size_t blockSize) :
+  next_(static_cast<char *>(buffer)), end_(next_ + size),
+  buffer_(next_), bufferSize_(size), blocks_(nullptr), current_(nullptr),
+  blockSize_(blockSize) {}
+
+CcsArena::~CcsArena() {
+  while (blocks_) {
+    Block *next = blocks_->next;
+    ::operator delete(blocks_);
+    blocks_ = next;
+  }
+}
+
+void *CcsArena::allocateSlow(size_t size, size_t align) {
+  // move on to the next block big enough, allocating one if need be. blocks
+  // too small for this request are skipped, but stay for the next reset.
+  Block *prev = current_;
+  Block *block = current_ ? current_->next : blocks_;
+  size_t needed = sizeof(Block) + size + align;
+  while (block && block->size < needed) {
+    prev = block;
+    block = block->next;
+  }
+  if (!block) {
+    size_t blockSize = std::max(blockSize_, needed);
+    block = static_cast<Block *>(::operator new(blockSize));
+    block->size = blockSize;
+    block->next = nullptr;
+    if (prev)
+      prev->next = block;
+    else
+      blocks_ = block;
+  }
+  current_ = block;
+  char *start = reinterpret_cast<char *>(block + 1);
+  end_ = reinterpret_cast<char *>(block) + block->size;
+  char *p = alignUp(start, align);
+  next_ = p + size;
+  return p;
+}
+
+void CcsArena::reset() {
+  current_ = nullptr;
+  next_ = buffer_;
+  end_ = buffer_ ? buffer_ + bufferSize_ : nullptr;
+}
+
+size_t CcsArena::heapBytes() const {
+  size_t total = 0;
+  for (const Block *b = blocks_; b; b = b->next) total += b->size;
+  return total;
+}
+
+}
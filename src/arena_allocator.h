@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+#include "ccs/arena.h"
+
+namespace ccs {
+
+/*
+ * an allocator drawing from an arena, or from the heap if the arena is null,
+ * so that the same container types serve for both. deallocating from an
+ * arena does nothing; the memory is reclaimed when the arena is reset.
+ */
+template <typename T>
+class ArenaAllocator {
+  template <typename U> friend class ArenaAllocator;
+  CcsArena *arena_;
+
+public:
+  typedef T value_type;
+
+  ArenaAllocator() : arena_(nullptr) {}
+  explicit ArenaAllocator(CcsArena *arena) : arena_(arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &that) : arena_(that.arena_) {}
+
+  CcsArena *arena() const { return arena_; }
+
+  T *allocate(size_t n) {
+    if (arena_)
+      return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T *p, size_t) {
+    if (!arena_) ::operator delete(p);
+  }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U> &that) const
+    { return arena_ == that.arena_; }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U> &that) const
+    { return arena_ != that.arena_; }
+};
+
+}
@@ -0,0 +1,143 @@
+#include "ccs/bulk_loader.h"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+#include "ccs/domain.h"
+#include "dag/dag_builder.h"
+#include "dag/key.h"
+#include "dag/node.h"
+#include "parser/build_context.h"
+
+namespace ccs {
+
+class CcsBulkLoader::Impl {
+  DagBuilder &dag_;
+  std::string source_;
+  std::vector<std::vector<Key>> selectors_; // sorted, without duplicates
+  std::map<std::vector<Key>, Selector> selectorIds_;
+  // the same, by the steps as given, to skip making keys for repeats
+  std::map<std::vector<Step>, Selector> stepIds_;
+  std::vector<Batch> batches_;
+  size_t staged_;
+
+  // the node for a selector, built just as for the same selector parsed
+  // from ccs text, so that the two share nodes.
+  Node &resolve(BuildContext &context, const std::vector<Key> &keys) {
+    if (keys.empty()) return context.node();
+    Node *node = &context.node().addChild(keys[0]);
+    for (auto it = keys.cbegin() + 1; it != keys.cend(); ++it)
+      node = &context.conjoin(*node, context.node().addChild(*it));
+    return *node;
+  }
+
+public:
+  Impl(DagBuilder &dag, const std::string &source) :
+    dag_(dag), source_(source), staged_(0) {}
+
+  Selector selector(const std::vector<Step> &steps) {
+    auto known = stepIds_.find(steps);
+    if (known != stepIds_.end()) return known->second;
+    std::vector<Key> keys;
+    keys.reserve(steps.size());
+    for (auto it = steps.cbegin(); it != steps.cend(); ++it)
+      keys.emplace_back(it->first, it->second);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    auto pr = selectorIds_.emplace(keys, (Selector)selectors_.size());
+    if (pr.second) selectors_.push_back(std::move(keys));
+    stepIds_.emplace(steps, pr.first->second);
+    return pr.first->second;
+  }
+
+  Property property(const std::string &name) {
+    return dag_.internProperty(name);
+  }
+
+  void add(Batch batch) {
+    size_t n = batch.selectors.size();
+    if (batch.properties.size() != n || batch.values.size() != n
+        || (!batch.overrides.empty() && batch.overrides.size() != n))
+      throw std::invalid_argument("bulk load columns differ in length");
+    size_t properties = dag_.root()->propertyNames().size();
+    for (size_t i = 0; i < n; i++) {
+      if (batch.selectors[i] >= selectors_.size())
+        throw std::invalid_argument("unknown selector id "
+            + std::to_string(batch.selectors[i]));
+      if (batch.properties[i] >= properties)
+        throw std::invalid_argument("unknown property id "
+            + std::to_string(batch.properties[i]));
+    }
+    staged_ += n;
+    batches_.push_back(std::move(batch));
+  }
+
+  size_t staged() const { return staged_; }
+
+  size_t commit() {
+    BuildContext::P context = dag_.buildContext();
+    auto &names = context->node().propertyNames();
+    std::vector<size_t> counts(names.size());
+    for (auto batch = batches_.cbegin(); batch != batches_.cend(); ++batch)
+      for (auto it = batch->properties.cbegin();
+          it != batch->properties.cend(); ++it)
+        counts[*it]++;
+    dag_.reserveDefinitions(counts);
+
+    std::vector<Node *> nodes(selectors_.size());
+    unsigned line = 0;
+    for (auto batch = batches_.cbegin(); batch != batches_.cend(); ++batch) {
+      for (size_t i = 0; i < batch->selectors.size(); i++) {
+        Node *&node = nodes[batch->selectors[i]];
+        if (!node) node = &resolve(*context, selectors_[batch->selectors[i]]);
+        unsigned id = batch->properties[i];
+        const std::string &name = names.name(id);
+        Value value;
+        value.setString(StringVal(batch->values[i]));
+        value.setName(name);
+        bool override = !batch->overrides.empty() && batch->overrides[i];
+        ccs::Property property(value, Origin(source_, ++line),
+            dag_.nextProperty(), id, override);
+        dag_.addDefinition(*node, node->addProperty(name, property));
+      }
+    }
+    batches_.clear();
+    staged_ = 0;
+    return line;
+  }
+};
+
+CcsBulkLoader::CcsBulkLoader(DagBuilder &dag, const std::string &source) :
+  impl(new Impl(dag, source)) {}
+
+CcsBulkLoader::~CcsBulkLoader() {}
+CcsBulkLoader::CcsBulkLoader(CcsBulkLoader &&) = default;
+CcsBulkLoader &CcsBulkLoader::operator=(CcsBulkLoader &&) = default;
+
+CcsBulkLoader::Selector CcsBulkLoader::selector(
+    const std::vector<Step> &steps) {
+  return impl->selector(steps);
+}
+
+CcsBulkLoader::Property CcsBulkLoader::property(const std::string &name) {
+  return impl->property(name);
+}
+
+void CcsBulkLoader::add(Batch batch) {
+  impl->add(std::move(batch));
+}
+
+size_t CcsBulkLoader::staged() const {
+  return impl->staged();
+}
+
+size_t CcsBulkLoader::commit() {
+  return impl->commit();
+}
+
+CcsBulkLoader CcsDomain::bulkLoader(const std::string &source) {
+  return CcsBulkLoader(*dag, source);
+}
+
+}
@@ -10,34 +10,53 @@
 
 namespace ccs {
 
-struct MissingProp : public CcsProperty {
-  virtual bool exists() const { return false; }
-  virtual Origin origin() const
-    { throw std::runtime_error("called origin() on MissingProp"); }
-  virtual const std::string &strValue() const
-    { throw std::runtime_error("called strValue() on MissingProp"); }
-  virtual int intValue() const
-    { throw std::runtime_error("called intValue() on MissingProp"); }
-  virtual double doubleValue() const
-    { throw std::runtime_error("called doubleValue() on MissingProp"); }
-  virtual bool boolValue() const
-    { throw std::runtime_error("called boolValue() on MissingProp"); }
-};
-
-namespace { MissingProp Missing; }
-
-CcsContext::CcsContext(std::shared_ptr<const Node> root)
-  : searchState(new SearchState(root)) {}
-
-CcsContext::CcsContext(const CcsContext &parent, const Key &key)
-  : searchState(SearchState::newChild(parent.searchState, key)) {}
+CcsContext::CcsContext(const CcsContext &parent, Key key)
+  : searchState(SearchState::newChild(parent.searchState, std::move(key))
+      .detach()) {}
 
+// keys are built in the parent's arena, if it has one, so that the child
+// needn't copy them there.
 CcsContext::CcsContext(const CcsContext &parent, const std::string &name)
-  : searchState(SearchState::newChild(parent.searchState, Key(name, {}))) {}
+  : CcsContext(parent, Key(name, {}, parent.searchState->getArena())) {}
 
 CcsContext::CcsContext(const CcsContext &parent, const std::string &name,
     const std::vector<std::string> &values)
-  : searchState(SearchState::newChild(parent.searchState, Key(name, values))) {}
+  : CcsContext(parent, Key(name, values, parent.searchState->getArena())) {}
+
+CcsContext::CcsContext(const CcsContext &that)
+  : searchState(that.searchState) {
+  if (searchState) searchState->retain();
+}
+
+CcsContext::~CcsContext() {
+  SearchState::release(searchState);
+}
+
+CcsContext CcsContext::rebase(const CcsContext &root) const {
+  std::vector<const Key *> path;
+  searchState->requestedPath(path);
+  CcsContext result = root;
+  for (auto it = path.cbegin(); it != path.cend(); ++it)
+    if (!(*it)->empty()) result = CcsContext(result, **it);
+  return result;
+}
+
+CcsContext CcsContext::compact() const {
+  if (!searchState->getParent()) return *this;
+  return CcsContext(SearchState::compact(*searchState).detach());
+}
+
+CcsContext CcsContext::constrain(CcsArena &arena, const std::string &name,
+    const std::vector<std::string> &values) const {
+  return CcsContext(SearchState::newChild(searchState,
+      Key(name, values, &arena), searchState->isLazy(), &arena).detach());
+}
+
+CcsContext CcsContext::lazy() const {
+  if (searchState->isLazy()) return *this;
+  return CcsContext(SearchState::newChild(searchState, Key(), true)
+      .detach());
+}
 
 void CcsContext::logRuleDag(std::ostream &os) const {
   searchState->logRuleDag(os);
@@ -49,7 +68,27 @@ const CcsProperty &CcsContext::getProperty(const std::string &propertyName)
     const {
   const CcsProperty *prop = searchState->findProperty(*this, propertyName);
   if (prop) return *prop;
-  return Missing;
+  return missingProperty();
+}
+
+const CcsProperty &CcsContext::getProperty(const PropertyKeyBase &key) const {
+  const CcsProperty *prop = searchState->findProperty(*this,
+      searchState->nameId(key), key.name());
+  if (prop) return *prop;
+  return missingProperty();
+}
+
+size_t CcsContext::getProperties(const std::vector<std::string> &propertyNames,
+    const CcsProperty **dest) const {
+  return searchState->findProperties(*this, propertyNames, nullptr, dest);
+}
+
+size_t CcsContext::getProperties(const PropertySet &properties,
+    const CcsProperty **dest) const {
+  const unsigned *ids =
+      properties.domain() == searchState->propertyNames().id()
+      ? properties.ids().data() : nullptr;
+  return searchState->findProperties(*this, properties.names(), ids, dest);
 }
 
 const std::string &CcsContext::getString(const std::string &propertyName)
@@ -136,7 +175,7 @@ bool CcsContext::getInto(bool &dest, const std::string &propertyName)
   return true;
 }
 
-std::ostream &operator<<(std::ostream &str, const CcsContext ctx) {
+std::ostream &operator<<(std::ostream &str, const CcsContext &ctx) {
   return str << *ctx.searchState;
 }
 
@@ -150,7 +189,8 @@ bool CcsContext::checkEmpty(std::istream &stream) {
 struct CcsContext::Builder::Impl {
   CcsContext context;
   Key key;
-  Impl(const CcsContext &context) : context(context) {}
+  Impl(const CcsContext &context) :
+    context(context), key(context.searchState->getArena()) {}
 };
 
 CcsContext::Builder::Builder(const CcsContext &context) :
@@ -0,0 +1,161 @@
+#include "ccs/context_cache.h"
+
+#include <functional>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "dag/key.h"
+#include "search_state.h"
+
+namespace ccs {
+
+namespace {
+
+struct Entry {
+  const SearchState *parent; // kept alive by context
+  Key key;
+  size_t hash;
+  CcsContext context;
+  size_t bytes;
+
+  Entry(const SearchState *parent, Key &&key, size_t hash,
+      CcsContext &&context, size_t bytes) :
+    parent(parent), key(std::move(key)), hash(hash),
+    context(std::move(context)), bytes(bytes) {}
+};
+
+// refers to the parent and key of an entry, or of a lookup.
+struct EntryRef {
+  const SearchState *parent;
+  const Key *key;
+  size_t hash;
+
+  bool operator==(const EntryRef &that) const
+    { return parent == that.parent && *key == *that.key; }
+};
+
+struct EntryHash {
+  size_t operator()(const EntryRef &ref) const { return ref.hash; }
+};
+
+}
+
+class CcsContextCache::Impl {
+  static const size_t Shards = 16;
+  // map nodes and list links, besides the entry itself.
+  static const size_t EntryOverhead = sizeof(Entry) + 8 * sizeof(void *);
+
+  struct Shard {
+    std::mutex mutex;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<EntryRef, std::list<Entry>::iterator, EntryHash> index;
+    size_t bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+
+    Shard() : bytes(0), hits(0), misses(0), evictions(0) {}
+
+    // the cached context for ref, if any, now most recently used.
+    const CcsContext *find(const EntryRef &ref) {
+      auto it = index.find(ref);
+      if (it == index.end()) return nullptr;
+      lru.splice(lru.begin(), lru, it->second);
+      return &it->second->context;
+    }
+  };
+
+  size_t shardBudget;
+  Shard shards[Shards];
+
+public:
+  explicit Impl(size_t maxBytes) : shardBudget(maxBytes / Shards) {}
+
+  CcsContext constrain(const CcsContext &parent, Key &&key) {
+    const SearchState *state = parent.searchState;
+    if (state->getArena()) return CcsContext(parent, std::move(key));
+
+    size_t hash = key.hash() ^ std::hash<const void *>()(state);
+    EntryRef ref{state, &key, hash};
+    Shard &shard = shards[hash % Shards];
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      if (const CcsContext *cached = shard.find(ref)) {
+        shard.hits++;
+        return *cached;
+      }
+      shard.misses++;
+    }
+
+    // build it without holding the lock, as that's the slow part.
+    CcsContext context(parent, Key(key));
+    size_t bytes = EntryOverhead + key.memoryUsage()
+        + context.searchState->memoryUsage();
+    std::list<Entry> evicted;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // another thread may have built the same one meanwhile.
+    if (const CcsContext *cached = shard.find(ref)) return *cached;
+    shard.lru.emplace_front(state, std::move(key), hash, CcsContext(context),
+        bytes);
+    Entry &entry = shard.lru.front();
+    shard.index.emplace(EntryRef{entry.parent, &entry.key, hash},
+        shard.lru.begin());
+    shard.bytes += bytes;
+    while (shard.bytes > shardBudget && !shard.lru.empty()) {
+      auto victim = std::prev(shard.lru.end());
+      shard.index.erase(EntryRef{victim->parent, &victim->key, victim->hash});
+      shard.bytes -= victim->bytes;
+      shard.evictions++;
+      // releasing a context can free a whole chain, so do that after
+      // unlocking.
+      evicted.splice(evicted.begin(), shard.lru, victim);
+    }
+    return context;
+  }
+
+  Stats stats() {
+    Stats stats{0, 0, 0, 0, 0};
+    for (size_t i = 0; i < Shards; i++) {
+      std::lock_guard<std::mutex> lock(shards[i].mutex);
+      stats.hits += shards[i].hits;
+      stats.misses += shards[i].misses;
+      stats.evictions += shards[i].evictions;
+      stats.entries += shards[i].lru.size();
+      stats.bytes += shards[i].bytes;
+    }
+    return stats;
+  }
+
+  void clear() {
+    for (size_t i = 0; i < Shards; i++) {
+      std::list<Entry> dropped;
+      std::lock_guard<std::mutex> lock(shards[i].mutex);
+      shards[i].index.clear();
+      dropped.swap(shards[i].lru);
+      shards[i].bytes = 0;
+    }
+  }
+};
+
+CcsContextCache::CcsContextCache(size_t maxBytes) :
+  impl(new Impl(maxBytes)) {}
+
+CcsContextCache::~CcsContextCache() {}
+
+CcsContext CcsContextCache::constrain(const CcsContext &parent,
+    const std::string &name, const std::vector<std::string> &values) {
+  return impl->constrain(parent, Key(name, values));
+}
+
+CcsContextCache::Stats CcsContextCache::stats() const {
+  return impl->stats();
+}
+
+void CcsContextCache::clear() {
+  impl->clear();
+}
+
+}
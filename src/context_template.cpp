@@ -0,0 +1,76 @@
+#include "ccs/context_template.h"
+
+#include <stdexcept>
+
+#include "ccs/domain.h"
+#include "dag/child_index.h"
+#include "dag/dag_builder.h"
+#include "dag/key.h"
+#include "search_state.h"
+
+namespace ccs {
+
+class CcsContextTemplate::Impl {
+  std::vector<std::string> names_;
+  CcsContext root_;
+  ChildIndex index_;
+  unsigned generation_; // the dag's, when the index was built
+
+public:
+  Impl(const std::vector<std::string> &names, const CcsContext &root,
+      const Node &dagRoot) :
+    names_(names), root_(root), index_(dagRoot, names),
+    generation_(dagRoot.generation()) {}
+
+  const std::vector<std::string> &names() const { return names_; }
+  const CcsContext &root() const { return root_; }
+
+  IntrusivePtr<SearchState> build(IntrusivePtr<SearchState> state,
+      const std::vector<std::string> &values) const {
+    if (values.size() != names_.size())
+      throw std::invalid_argument("context template expects "
+          + std::to_string(names_.size()) + " values, got "
+          + std::to_string(values.size()));
+    // the index is only good for the dag it was built from, as it was
+    // then. optimize() and further loading change nodes in place.
+    const Node &dagRoot = state->dagRoot();
+    bool sameDag = &dagRoot == &root_.searchState->dagRoot()
+        && dagRoot.generation() == generation_;
+    for (size_t i = 0; i < names_.size(); i++) {
+      Key key(state->getArena());
+      key.addValue(names_[i], values[i]);
+      if (sameDag)
+        state = SearchState::newChild(state.get(), std::move(key), index_, i,
+            values[i]);
+      else
+        state = SearchState::newChild(state.get(), std::move(key));
+    }
+    return state;
+  }
+};
+
+CcsContextTemplate::CcsContextTemplate(std::shared_ptr<const Impl> impl) :
+  impl(std::move(impl)) {}
+
+const std::vector<std::string> &CcsContextTemplate::names() const {
+  return impl->names();
+}
+
+CcsContext CcsContextTemplate::build(const std::vector<std::string> &values)
+    const {
+  return build(impl->root(), values);
+}
+
+CcsContext CcsContextTemplate::build(const CcsContext &parent,
+    const std::vector<std::string> &values) const {
+  return CcsContext(impl->build(IntrusivePtr<SearchState>(parent.searchState),
+      values).detach());
+}
+
+CcsContextTemplate CcsDomain::contextTemplate(
+    const std::vector<std::string> &names) {
+  return CcsContextTemplate(std::make_shared<CcsContextTemplate::Impl>(
+      names, build(), *dag->root()));
+}
+
+}
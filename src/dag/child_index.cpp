@@ -0,0 +1,75 @@
+#include "dag/child_index.h"
+
+#include <deque>
+#include <unordered_set>
+
+#include "dag/key.h"
+#include "dag/node.h"
+#include "dag/tally.h"
+#include "search_state.h"
+
+namespace ccs {
+
+namespace {
+
+template <typename T>
+void enqueueTallies(const Node &node, std::deque<const Node *> &queue) {
+  auto &tallies = node.tallies<T>();
+  for (auto it = tallies.cbegin(); it != tallies.cend(); ++it)
+    queue.push_back(&(*it)->node());
+}
+
+}
+
+ChildIndex::ChildIndex(const Node &root,
+    const std::vector<std::string> &names) : steps_(names.size()) {
+  std::unordered_map<std::string, std::vector<size_t>> stepsByName;
+  for (size_t i = 0; i < names.size(); i++)
+    stepsByName[names[i]].push_back(i);
+
+  std::unordered_set<const Node *> visited;
+  std::deque<const Node *> queue{&root};
+  while (!queue.empty()) {
+    const Node &node = *queue.front();
+    queue.pop_front();
+    if (!visited.insert(&node).second) continue;
+    auto &children = node.allChildren();
+    for (auto it = children.cbegin(); it != children.cend(); ++it) {
+      queue.push_back(it->second.get());
+      const Key::String *name, *value;
+      if (!it->first.single(name, value)) continue;
+      auto steps = stepsByName.find(std::string(name->data(), name->size()));
+      if (steps == stepsByName.end()) continue;
+      for (auto step = steps->second.cbegin(); step != steps->second.cend();
+          ++step) {
+        Children &entry = steps_[*step][&node];
+        if (value)
+          entry.byValue[std::string(value->data(), value->size())] =
+              it->second.get();
+        else
+          entry.any = it->second.get();
+      }
+    }
+    enqueueTallies<AndTally>(node, queue);
+    enqueueTallies<OrTally>(node, queue);
+  }
+}
+
+void ChildIndex::activate(size_t step, const Node &node,
+    const std::string &value, const Specificity &spec,
+    SearchState &searchState) const {
+  auto entry = steps_[step].find(&node);
+  if (entry == steps_[step].end()) return;
+  // a name alone sorts before the same name with a value, so this is the
+  // order in which getChildren() would activate them.
+  const Children &children = entry->second;
+  if (children.any)
+    children.any->activate(spec + children.any->key()->specificity(),
+        searchState);
+  auto child = children.byValue.find(value);
+  if (child != children.byValue.end())
+    child->second->activate(spec + child->second->key()->specificity(),
+        searchState);
+}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dag/specificity.h"
+
+namespace ccs {
+
+class Node;
+class SearchState;
+
+/*
+ * for a fixed sequence of constraint names, the only children in a dag which
+ * can match a key of just one of those names with a single value: those
+ * keyed by the name alone, or by the name and one value. they're grouped by
+ * parent, so finding the matching children of a node is a hash lookup or two,
+ * rather than a test of every child against the key.
+ *
+ * this refers directly to nodes in the dag, so it's only valid for as long as
+ * the dag is alive and unchanged.
+ */
+class ChildIndex {
+  struct Children {
+    const Node *any;
+    std::unordered_map<std::string, const Node *> byValue;
+
+    Children() : any(nullptr) {}
+  };
+
+  typedef std::unordered_map<const Node *, Children> Step;
+  std::vector<Step> steps_;
+
+public:
+  ChildIndex(const Node &root, const std::vector<std::string> &names);
+
+  size_t size() const { return steps_.size(); }
+
+  // activate the children of node matching the given step's name with the
+  // given value, just as node.getChildren() would, in the same order.
+  void activate(size_t step, const Node &node, const std::string &value,
+      const Specificity &spec, SearchState &searchState) const;
+};
+
+}
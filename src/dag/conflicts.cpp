@@ -0,0 +1,200 @@
+#include "dag/conflicts.h"
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+#include "dag/node.h"
+#include "dag/tally.h"
+
+namespace ccs {
+
+namespace {
+
+// bound on the number of distinct specificities tracked per node. in
+// practice a node is reachable at only a handful of specificities, but
+// heavily nested disjunctions could otherwise blow up. past this limit, the
+// analysis is no longer exhaustive for the nodes involved.
+const size_t MaxSpecificities = 32;
+
+struct NodeInfo {
+  std::set<Specificity> specs;
+  // true once some path reaches the node without passing through a tally.
+  // a node is reported as reached via a tally only if no such path exists.
+  bool direct;
+  bool queued;
+
+  NodeInfo() : direct(false), queued(false) {}
+};
+
+struct Definition {
+  const Node *node;
+  const Property *prop;
+};
+
+class ConflictFinder {
+  std::unordered_map<const Node *, NodeInfo> info_;
+  std::map<std::pair<const Node *, const Node *>, const Node *> conjunctions_;
+  std::deque<const Node *> queue_;
+
+  bool addSpec(NodeInfo &info, const Specificity &spec) {
+    if (info.specs.size() >= MaxSpecificities) return false;
+    return info.specs.insert(spec).second;
+  }
+
+  void update(const Node &node, const std::set<Specificity> &specs,
+      bool direct) {
+    NodeInfo &info = info_[&node];
+    bool changed = false;
+    if (direct && !info.direct) {
+      info.direct = true;
+      changed = true;
+    }
+    for (auto it = specs.cbegin(); it != specs.cend(); ++it)
+      changed |= addSpec(info, *it);
+    if (changed && !info.queued) {
+      info.queued = true;
+      queue_.push_back(&node);
+    }
+  }
+
+  void visit(const Node &node) {
+    // references into info_ survive rehashing, so this is safe even as
+    // children are added below...
+    const NodeInfo &info = info_[&node];
+
+    const auto &children = node.allChildren();
+    for (auto it = children.cbegin(); it != children.cend(); ++it) {
+      std::set<Specificity> specs;
+      for (auto s = info.specs.cbegin(); s != info.specs.cend(); ++s)
+        specs.insert(*s + it->first.specificity());
+      update(*it->second, specs, info.direct);
+    }
+
+    const auto &ands = node.tallies<AndTally>();
+    for (auto it = ands.cbegin(); it != ands.cend(); ++it) {
+      const Tally &tally = **it;
+      conjunctions_[std::make_pair(&tally.firstLeg(), &tally.secondLeg())] =
+          &tally.node();
+      conjunctions_[std::make_pair(&tally.secondLeg(), &tally.firstLeg())] =
+          &tally.node();
+      const auto &first = info_[&tally.firstLeg()].specs;
+      const auto &second = info_[&tally.secondLeg()].specs;
+      std::set<Specificity> specs;
+      for (auto f = first.cbegin(); f != first.cend(); ++f)
+        for (auto s = second.cbegin(); s != second.cend(); ++s)
+          specs.insert(*f + *s);
+      update(tally.node(), specs, false);
+    }
+
+    const auto &ors = node.tallies<OrTally>();
+    for (auto it = ors.cbegin(); it != ors.cend(); ++it) {
+      const Tally &tally = **it;
+      std::set<Specificity> specs(info_[&tally.firstLeg()].specs);
+      const auto &second = info_[&tally.secondLeg()].specs;
+      specs.insert(second.cbegin(), second.cend());
+      update(tally.node(), specs, false);
+    }
+  }
+
+  // true if some definition on the conjunction of the two nodes always
+  // beats both of the given definitions whenever they're both active.
+  bool resolved(const std::string &name, bool override, const Definition &d1,
+      const Definition &d2) const {
+    if (d1.node == d2.node) return false;
+    auto it = conjunctions_.find(std::make_pair(d1.node, d2.node));
+    if (it == conjunctions_.end()) return false;
+    auto range = it->second->properties().equal_range(name);
+    for (auto p = range.first; p != range.second; ++p)
+      if (p->second.override() || !override) return true;
+    return false;
+  }
+
+  void findIn(const std::string &name, bool override,
+      const std::vector<Definition> &defs, std::vector<CcsConflict> &result) {
+    std::map<Specificity, std::vector<const Definition *>> buckets;
+    for (auto it = defs.cbegin(); it != defs.cend(); ++it) {
+      const auto &specs = info_[it->node].specs;
+      for (auto s = specs.cbegin(); s != specs.cend(); ++s)
+        buckets[*s].push_back(&*it);
+    }
+
+    // the same set of definitions may tie at several specificities, but
+    // should be reported only once.
+    std::set<std::vector<unsigned>> reported;
+    for (auto it = buckets.cbegin(); it != buckets.cend(); ++it) {
+      const auto &bucket = it->second;
+      if (bucket.size() < 2) continue;
+
+      std::vector<const Definition *> involved;
+      for (size_t i = 0; i < bucket.size(); i++) {
+        for (size_t j = 0; j < bucket.size(); j++) {
+          if (i != j && !resolved(name, override, *bucket[i], *bucket[j])) {
+            involved.push_back(bucket[i]);
+            break;
+          }
+        }
+      }
+      if (involved.size() < 2) continue;
+
+      std::sort(involved.begin(), involved.end(),
+          [](const Definition *l, const Definition *r) {
+        return l->prop->propertyNumber() < r->prop->propertyNumber();
+      });
+      std::vector<unsigned> numbers;
+      for (auto d = involved.cbegin(); d != involved.cend(); ++d)
+        numbers.push_back((*d)->prop->propertyNumber());
+      if (!reported.insert(numbers).second) continue;
+
+      CcsConflict conflict;
+      conflict.propertyName = name;
+      conflict.override = override;
+      for (auto d = involved.cbegin(); d != involved.cend(); ++d)
+        conflict.definitions.push_back(CcsConflict::Definition{
+            (*d)->prop->origin(), (*d)->prop->strValue(),
+            !info_[(*d)->node].direct});
+      result.push_back(conflict);
+    }
+  }
+
+public:
+  std::vector<CcsConflict> find(const Node &root) {
+    update(root, std::set<Specificity>{Specificity()}, true);
+    while (!queue_.empty()) {
+      const Node *node = queue_.front();
+      queue_.pop_front();
+      info_[node].queued = false;
+      visit(*node);
+    }
+
+    std::map<std::string, std::vector<Definition>> defs[2];
+    for (auto it = info_.cbegin(); it != info_.cend(); ++it) {
+      const auto &props = it->first->properties();
+      for (auto p = props.cbegin(); p != props.cend(); ++p)
+        defs[p->second.override()][p->first].push_back(
+            Definition{it->first, &p->second});
+    }
+
+    std::vector<CcsConflict> result;
+    for (int override = 0; override < 2; override++)
+      for (auto it = defs[override].cbegin(); it != defs[override].cend(); ++it)
+        if (it->second.size() > 1)
+          findIn(it->first, override, it->second, result);
+
+    std::stable_sort(result.begin(), result.end(),
+        [](const CcsConflict &l, const CcsConflict &r) {
+      return l.propertyName < r.propertyName;
+    });
+    return result;
+  }
+};
+
+}
+
+std::vector<CcsConflict> findConflicts(const Node &root) {
+  return ConflictFinder().find(root);
+}
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+
+#include "ccs/domain.h"
+
+namespace ccs {
+
+class Node;
+
+/*
+ * statically find groups of property definitions which may tie on both
+ * specificity and override status in some context. every combination of
+ * constraints is satisfiable in ccs, so any two definitions whose nodes can
+ * be activated at the same specificity are reported, unless the tie is
+ * broken by a definition on the conjunction of the two nodes.
+ */
+std::vector<CcsConflict> findConflicts(const Node &root);
+
+}
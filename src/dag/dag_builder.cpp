@@ -0,0 +1,142 @@
+#include "dag/dag_builder.h"
+
+#include <unordered_set>
+#include <vector>
+
+#include "dag/optimize.h"
+#include "intrusive_ptr.h"
+#include "parser/ast.h"
+#include "parser/load_record.h"
+#include "search_state.h"
+
+namespace ccs {
+
+DagBuilder::DagBuilder(std::shared_ptr<CcsTracer> tracer) :
+  nextProperty_(0),
+  propertyStride_(1),
+  loadFailed_(false),
+  root_(new Node(std::move(tracer))),
+  buildContext_(BuildContext::descendant(*this, *root_)),
+  rootState_(nullptr),
+  untracked_(false),
+  recording_(nullptr) {}
+
+DagBuilder::~DagBuilder() {
+  invalidateRoot();
+}
+
+void DagBuilder::invalidateRoot() {
+  root_->changed();
+  SearchState::release(rootState_.exchange(nullptr, std::memory_order_acq_rel));
+}
+
+void DagBuilder::untracked() {
+  untracked_ = true;
+  record_.reset();
+}
+
+void DagBuilder::loadTracked(const std::string &fileName,
+    const std::shared_ptr<ast::Nested> &ast) {
+  invalidateRoot();
+  if (untracked_) {
+    if (ast) ast->addTo(buildContext_, buildContext_);
+    return;
+  }
+  if (!record_) record_.reset(new LoadRecord(*this));
+  record_->load(fileName, ast);
+}
+
+void DagBuilder::beginReload() {
+  invalidateRoot();
+  loadFailed_ = false;
+  if (untracked_) return;
+  if (!record_) record_.reset(new LoadRecord(*this));
+  record_->beginReload();
+}
+
+bool DagBuilder::endReload() {
+  return !untracked_ && record_->endReload();
+}
+
+bool DagBuilder::reloadDiff(DagDiff &diff) const {
+  return !untracked_ && record_->changes(diff);
+}
+
+bool DagBuilder::referenced() const {
+  SearchState *state = rootState_.load(std::memory_order_acquire);
+  // the root state of a specialized dag isn't the one holding the root.
+  if (state && (!fixed_.empty() || state->shared())) return true;
+  // otherwise only the root state, if any, may hold the root. the count is
+  // read with acquire ordering, pairing with the release of whichever
+  // state dropped its hold last, so that it's really done with the dag.
+  return root_->holders() != (state ? 1u : 0u);
+}
+
+SearchState *DagBuilder::rootState() {
+  SearchState *state = rootState_.load(std::memory_order_acquire);
+  if (!state) {
+    std::shared_ptr<const Node> root = root_;
+    IntrusivePtr<SearchState> base(new SearchState(root));
+    for (auto it = fixed_.cbegin(); it != fixed_.cend(); ++it)
+      base = SearchState::newChild(base.get(), *it);
+    SearchState *fresh = base.detach();
+    // if another thread got there first, use its state instead.
+    if (rootState_.compare_exchange_strong(state, fresh,
+        std::memory_order_acq_rel, std::memory_order_acquire))
+      state = fresh;
+    else
+      SearchState::release(fresh);
+  }
+  state->retain();
+  return state;
+}
+
+namespace {
+
+template <typename T, typename F>
+void visitTallies(const Node &node, std::vector<const Node *> &queue, F f) {
+  auto &tallies = node.tallies<T>();
+  for (auto it = tallies.cbegin(); it != tallies.cend(); ++it) {
+    f(**it);
+    queue.push_back(&(*it)->node());
+  }
+}
+
+}
+
+void DagBuilder::indexTallies() {
+  tallies_.clear();
+  std::vector<const Node *> queue{root_.get()};
+  std::unordered_set<const Node *> visited;
+  while (!queue.empty()) {
+    const Node *node = queue.back();
+    queue.pop_back();
+    if (!visited.insert(node).second) continue;
+    auto &children = node->allChildren();
+    for (auto it = children.cbegin(); it != children.cend(); ++it)
+      queue.push_back(it->second.get());
+    visitTallies<AndTally>(*node, queue, [&](const AndTally &tally) {
+      tallies_[TallyKey(tally.firstLeg(), tally.secondLeg(), true)] =
+          const_cast<Node *>(&tally.node());
+    });
+    visitTallies<OrTally>(*node, queue, [&](const OrTally &tally) {
+      tallies_[TallyKey(tally.firstLeg(), tally.secondLeg(), false)] =
+          const_cast<Node *>(&tally.node());
+    });
+  }
+}
+
+CcsOptimizeStats DagBuilder::optimize() {
+  invalidateRoot();
+  untracked();
+  DagOptimizer optimizer(*root_);
+  CcsOptimizeStats stats = optimizer.run();
+  for (auto byName = definitions_.begin(); byName != definitions_.end();
+      ++byName)
+    for (auto it = byName->begin(); it != byName->end(); ++it)
+      optimizer.find(it->first, it->second);
+  indexTallies();
+  return stats;
+}
+
+}
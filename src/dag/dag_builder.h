@@ -1,26 +1,182 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "dag/node.h"
 #include "parser/build_context.h"
 
 namespace ccs {
 
+struct DagDiff;
+class LoadRecord;
+class SearchState;
+struct CcsOptimizeStats;
+namespace ast { struct Nested; }
+
 class DagBuilder {
-  int nextProperty_;
+  friend class LoadRecord;
+
+  // the legs of a tally, in either order, and whether it's a conjunction
+  struct TallyKey {
+    const Node *first;
+    const Node *second;
+    bool conjunction;
+
+    TallyKey(const Node &a, const Node &b, bool conjunction) :
+      first(std::min(&a, &b, std::less<const Node *>())),
+      second(std::max(&a, &b, std::less<const Node *>())),
+      conjunction(conjunction) {}
+
+    bool operator==(const TallyKey &that) const {
+      return first == that.first && second == that.second
+          && conjunction == that.conjunction;
+    }
+  };
+
+  struct TallyKeyHash {
+    size_t operator()(const TallyKey &key) const {
+      std::hash<const Node *> hash;
+      return (hash(key.first) * 31 + hash(key.second)) * 2 + key.conjunction;
+    }
+  };
+
+  unsigned nextProperty_;
+  // how far apart property numbers are spaced, which is only ever more than
+  // one while lowering a file tracked by record_.
+  unsigned propertyStride_;
+  bool loadFailed_;
   std::shared_ptr<Node> root_;
   std::shared_ptr<BuildContext> buildContext_;
+  // every definition of each property, by name id, in load order. nodes and
+  // properties are never moved once added, and only freed by a reload in
+  // place, which fixes these up as it goes.
+  std::vector<std::vector<std::pair<const Node *, const Property *>>>
+    definitions_;
+  // the root search state, shared by every context built from the dag until
+  // it next changes, with a reference of its own. null until first needed.
+  std::atomic<SearchState *> rootState_;
+  // the node of every tally in the dag, by its legs
+  std::unordered_map<TallyKey, Node *, TallyKeyHash> tallies_;
+  // for a specialized dag, the constraints every context starts from (see
+  // specialize()).
+  std::vector<Key> fixed_;
+  // what each file loaded through a parse cache contributed, so that a later
+  // reload can update the dag in place (see LoadRecord). null until such a
+  // file is loaded, and dropped for good once anything else is added.
+  std::unique_ptr<LoadRecord> record_;
+  bool untracked_;
+  // the record being added to, while it's lowering a file
+  LoadRecord *recording_;
+
+  void invalidateRoot();
+  void untracked();
+  // rebuild tallies_ from the dag, after tallies were added or changed
+  // other than through tally().
+  void indexTallies();
 
 public:
-  DagBuilder(std::shared_ptr<CcsTracer> tracer) :
-    nextProperty_(0),
-    root_(new Node(std::move(tracer))),
-    buildContext_(BuildContext::descendant(*this, *root_)) {}
+  DagBuilder(std::shared_ptr<CcsTracer> tracer);
+  ~DagBuilder();
+  DagBuilder(const DagBuilder &) = delete;
+  DagBuilder &operator=(const DagBuilder &) = delete;
 
   std::shared_ptr<const Node> root() { return root_; }
-  BuildContext::P buildContext() { return buildContext_; }
-  int nextProperty() { return nextProperty_++; }
+  // everything that adds to the dag starts here, so this also drops the
+  // shared root state, which would no longer be complete, and bumps the
+  // root's generation. other than for a
+  // tracked load, it also ends tracking (see loadTracked()).
+  BuildContext::P buildContext() {
+    invalidateRoot();
+    if (!recording_) untracked();
+    return buildContext_;
+  }
+  // the shared root state, with a reference counted for the caller. it's
+  // built on first use, after which this is just an atomic load and
+  // increment. safe to call from any number of threads, but not while the
+  // dag is changing.
+  SearchState *rootState();
+
+  // fill this empty dag with a copy of source, specialized for contexts
+  // constrained by each of the fixed keys in turn, and never again by any
+  // of their names. any selector which could then never match is left out,
+  // and the shared root state becomes the one for the fixed keys.
+  void specialize(const DagBuilder &source, const std::vector<Key> &fixed);
+  // simplify the dag in place (see DagOptimizer), keeping the definitions
+  // up to date.
+  CcsOptimizeStats optimize();
+
+  // the node of the tally of type T joining two nodes, in either order,
+  // created if need be. first and second may be the same node.
+  template <typename T>
+  Node &tally(Node &first, Node &second) {
+    Node *&node = tallies_[TallyKey(first, second,
+        std::is_same<T, AndTally>::value)];
+    if (!node) {
+      std::shared_ptr<T> tally = std::make_shared<T>(first, second);
+      first.addTally(tally);
+      second.addTally(tally);
+      node = &tally->node();
+    }
+    return *node;
+  }
+
+  unsigned nextProperty() {
+    unsigned number = nextProperty_;
+    nextProperty_ += propertyStride_;
+    return number;
+  }
+  void loadFailed() { loadFailed_ = true; }
+  bool hasLoadFailed() const { return loadFailed_; }
+  unsigned internProperty(const std::string &name)
+    { return root_->propertyNames().intern(name); }
+
+  // make room for the given number of further definitions of each property,
+  // by name id.
+  void reserveDefinitions(const std::vector<size_t> &counts) {
+    if (counts.size() > definitions_.size()) definitions_.resize(counts.size());
+    for (size_t id = 0; id < counts.size(); id++)
+      definitions_[id].reserve(definitions_[id].size() + counts[id]);
+  }
+  void addDefinition(const Node &node, const Property &property) {
+    if (property.nameId() >= definitions_.size())
+      definitions_.resize(property.nameId() + 1);
+    definitions_[property.nameId()].emplace_back(&node, &property);
+  }
+  const std::vector<std::vector<std::pair<const Node *, const Property *>>> &
+  definitions() const { return definitions_; }
+
+  // lower the parsed rules of a file loaded through a parse cache, recording
+  // what each file contributed as long as everything in the dag so far came
+  // that way. between beginReload() and endReload(), the files are instead
+  // matched up with those loaded last time, in order, and only the rules of
+  // files which changed are replaced. ast is null if the file failed to
+  // load, in which case a reload leaves its rules as they were.
+  void loadTracked(const std::string &fileName,
+      const std::shared_ptr<ast::Nested> &ast);
+  // true if everything in the dag came through loadTracked().
+  bool tracked() const { return !untracked_; }
+  void beginReload();
+  // true if the dag now matches a fresh load of the same files. otherwise,
+  // something else was added or the changes didn't fit, and the dag is no
+  // longer of any use.
+  bool endReload();
+  // the names of the properties whose definitions may have changed since
+  // beginReload(), as diffDags() would find them, but only as costly as the
+  // changes themselves. false if any @constrain changed, in which case
+  // diffDags() is needed after all.
+  bool reloadDiff(DagDiff &diff) const;
+  // true if any context (or anything else) still refers to the dag.
+  bool referenced() const;
+  // the record of the file being lowered by loadTracked(), if any.
+  LoadRecord *recording() const { return recording_; }
 };
 
 }
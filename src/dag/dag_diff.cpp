@@ -0,0 +1,87 @@
+#include "dag/dag_diff.h"
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include "dag/node.h"
+#include "dag/node_paths.h"
+
+namespace ccs {
+
+namespace {
+
+struct Definition {
+  unsigned propertyNumber;
+  const std::string *path;
+  const Property *prop;
+
+  bool operator<(const Definition &that) const
+    { return propertyNumber < that.propertyNumber; }
+
+  bool same(const Definition &that) const {
+    return *path == *that.path && prop->override() == that.prop->override()
+        && prop->strValue() == that.prop->strValue();
+  }
+};
+
+struct Summary {
+  NodePaths paths;
+  std::map<std::string, std::vector<Definition>> definitions;
+  std::set<std::pair<std::string, std::string>> constraints;
+
+  explicit Summary(const Node &root) : paths(root) {
+    paths.forEach([this](const Node &node, const std::string &path) {
+      auto &props = node.properties();
+      for (auto it = props.cbegin(); it != props.cend(); ++it)
+        definitions[it->first].push_back(Definition{
+            it->second.propertyNumber(), &path, &it->second});
+      if (!node.allConstraints().empty()) {
+        std::ostringstream str;
+        str << node.allConstraints();
+        constraints.insert(std::make_pair(path, str.str()));
+      }
+    });
+    for (auto it = definitions.begin(); it != definitions.end(); ++it)
+      std::sort(it->second.begin(), it->second.end());
+  }
+};
+
+bool same(const std::vector<Definition> &l, const std::vector<Definition> &r) {
+  if (l.size() != r.size()) return false;
+  for (size_t i = 0; i < l.size(); i++)
+    if (!l[i].same(r[i])) return false;
+  return true;
+}
+
+}
+
+DagDiff diffDags(const Node &before, const Node &after) {
+  DagDiff diff;
+  Summary l(before);
+  Summary r(after);
+  diff.constraintsChanged = l.constraints != r.constraints;
+
+  // both maps are ordered, so walk them together.
+  auto li = l.definitions.cbegin();
+  auto ri = r.definitions.cbegin();
+  while (li != l.definitions.cend() || ri != r.definitions.cend()) {
+    if (ri == r.definitions.cend()
+        || (li != l.definitions.cend() && li->first < ri->first)) {
+      diff.names.insert(li->first);
+      ++li;
+    } else if (li == l.definitions.cend() || ri->first < li->first) {
+      diff.names.insert(ri->first);
+      ++ri;
+    } else {
+      if (diff.constraintsChanged || !same(li->second, ri->second))
+        diff.names.insert(li->first);
+      ++li;
+      ++ri;
+    }
+  }
+  return diff;
+}
+
+}
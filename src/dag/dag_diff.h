@@ -0,0 +1,31 @@
+#pragma once
+
+#include <set>
+#include <string>
+
+namespace ccs {
+
+class Node;
+
+/*
+ * the property names which may resolve differently, in at least one context,
+ * in one dag than in another. a property's resolution depends only on its own
+ * definitions: the nodes they're attached to, their values and override
+ * status, and their relative order. so a name is unchanged if it has the same
+ * sequence of definitions in both, with nodes matched up by NodePaths. this
+ * is conservative: a name which is reported may still resolve to the same
+ * values everywhere. if any @constrain changed, then any property might
+ * resolve differently, and every name defined in either dag is reported.
+ */
+struct DagDiff {
+  bool constraintsChanged;
+  std::set<std::string> names;
+
+  DagDiff() : constraintsChanged(false) {}
+
+  bool changed(const std::string &name) const { return names.count(name); }
+};
+
+DagDiff diffDags(const Node &before, const Node &after);
+
+}
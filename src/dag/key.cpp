@@ -2,6 +2,51 @@
 
 namespace ccs {
 
+namespace {
+
+// red-black tree nodes carry a color and three links besides the value.
+const size_t TreeNodeOverhead = 4 * sizeof(void *);
+
+size_t stringUsage(const Key::String &str) {
+  // short strings live within the object itself.
+  return str.capacity() > 15 ? str.capacity() + 1 : 0;
+}
+
+void hashString(size_t &hash, const Key::String &str) {
+  for (auto it = str.cbegin(); it != str.cend(); ++it) {
+    hash ^= static_cast<unsigned char>(*it);
+    hash *= 0x100000001b3ull;
+  }
+}
+
+}
+
+size_t Key::hash() const {
+  // fnv-1a, with a separator after each string so that the boundaries
+  // count.
+  size_t hash = 0xcbf29ce484222325ull;
+  for (auto it = values_.cbegin(); it != values_.cend(); ++it) {
+    hashString(hash, it->first);
+    hash = (hash ^ '/') * 0x100000001b3ull;
+    for (auto it2 = it->second.cbegin(); it2 != it->second.cend(); ++it2) {
+      hashString(hash, *it2);
+      hash = (hash ^ '.') * 0x100000001b3ull;
+    }
+  }
+  return hash;
+}
+
+size_t Key::memoryUsage() const {
+  size_t bytes = 0;
+  for (auto it = values_.cbegin(); it != values_.cend(); ++it) {
+    bytes += TreeNodeOverhead + sizeof(Map::value_type)
+        + stringUsage(it->first);
+    for (auto it2 = it->second.cbegin(); it2 != it->second.cend(); ++it2)
+      bytes += TreeNodeOverhead + sizeof(String) + stringUsage(*it2);
+  }
+  return bytes;
+}
+
 std::ostream &operator<<(std::ostream &out, const Key &key) {
   bool first = true;
   for (auto it = key.values_.cbegin(); it != key.values_.cend(); ++it) {
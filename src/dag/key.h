@@ -7,62 +7,143 @@
 #include <string>
 #include <vector>
 
+#include "arena_allocator.h"
 #include "dag/specificity.h"
 
 namespace ccs {
 
+/*
+ * the names and values of a constraint. keys in the dag live on the heap,
+ * but a context's key may be allocated from an arena (see CcsArena), so the
+ * strings and containers here take an ArenaAllocator. copying a key always
+ * puts the copy on the heap, unless an arena is given explicitly, so that a
+ * copy never depends on the lifetime of some other key's arena.
+ */
 class Key {
-  std::map<std::string, std::set<std::string>> values_;
+public:
+  typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>
+      String;
+
+  // orders any two kinds of string, so lookups needn't convert.
+  struct Less {
+    typedef void is_transparent;
+    template <typename A, typename B>
+    bool operator()(const A &a, const B &b) const
+      { return a.compare(0, a.size(), b.data(), b.size()) < 0; }
+  };
+
+  typedef std::set<String, Less, ArenaAllocator<String>> Values;
+
+private:
+  typedef std::map<String, Values, Less,
+      ArenaAllocator<std::pair<const String, Values>>> Map;
+
+  Map values_;
   Specificity specificity_;
 
+  ArenaAllocator<char> allocator() const { return values_.get_allocator(); }
+
+  template <typename S>
+  Values &entry(const S &name, bool &changed) {
+    auto it = values_.find(name);
+    if (it == values_.end()) {
+      it = values_.emplace(String(name.data(), name.size(), allocator()),
+          Values(Less(), allocator())).first;
+      specificity_.names++;
+      changed = true;
+    }
+    return it->second;
+  }
+
+  template <typename S>
+  bool add(const S &name) {
+    bool changed = false;
+    entry(name, changed);
+    return changed;
+  }
+
+  template <typename S, typename T>
+  bool add(const S &name, const T &value) {
+    bool changed = false;
+    Values &values = entry(name, changed);
+    if (values.find(value) == values.end()) {
+      values.emplace_hint(values.end(),
+          String(value.data(), value.size(), allocator()));
+      specificity_.values++;
+      changed = true;
+    }
+    return changed;
+  }
+
 public:
-  Key() {}
+  explicit Key(CcsArena *arena = nullptr) :
+    values_(Less(), ArenaAllocator<char>(arena)) {}
 
-  Key(const std::string &name, const std::vector<std::string> &values) {
+  Key(const std::string &name, const std::vector<std::string> &values,
+      CcsArena *arena = nullptr) : Key(arena) {
     addName(name);
     for (auto it = values.begin(); it != values.end(); ++it)
       addValue(name, *it);
   }
 
-  Key(const Key &) = default;
-  Key &operator=(const Key &) = default;
+  Key(const Key &that, CcsArena *arena) : Key(arena) { addAll(that); }
+  Key(const Key &that) : Key(that, nullptr) {}
+  Key(Key &&) = default;
+  // keeps this key's own allocator.
+  Key &operator=(const Key &that) {
+    if (this != &that) {
+      values_.clear();
+      specificity_ = Specificity();
+      addAll(that);
+    }
+    return *this;
+  }
   ~Key() = default;
 
   const Specificity &specificity() const { return specificity_; }
+  CcsArena *arena() const { return allocator().arena(); }
 
   bool empty() const { return values_.empty(); }
 
+  // true if this key has just the one name, with no more than one value. if
+  // so, name and value are set to point to them (value may be null).
+  bool single(const String *&name, const String *&value) const {
+    if (values_.size() != 1) return false;
+    auto &entry = *values_.cbegin();
+    if (entry.second.size() > 1) return false;
+    name = &entry.first;
+    value = entry.second.empty() ? nullptr : &*entry.second.cbegin();
+    return true;
+  }
+
+  // call f(name, values) for each name, in order.
+  template <typename F>
+  void forEachName(F &&f) const {
+    for (auto it = values_.cbegin(); it != values_.cend(); ++it)
+      f(it->first, it->second);
+  }
+
   bool operator<(const Key &that) const
     { return values_ < that.values_; }
+  bool operator==(const Key &that) const
+    { return values_ == that.values_; }
 
-  bool addName(const std::string &name) {
-    if (values_.find(name) == values_.end()) {
-      values_[name];
-      specificity_.names++;
-      return true;
-    }
-    return false;
-  }
+  // equal keys hash alike, whatever they were allocated from.
+  size_t hash() const;
+  // roughly, the bytes allocated for this key's names and values.
+  size_t memoryUsage() const;
 
-  bool addValue(const std::string &name, const std::string &value) {
-    bool changed = false;
-    if (values_.find(name) == values_.end()) {
-      changed = true;
-      specificity_.names++;
-    }
-    if (values_[name].insert(value).second) {
-      changed = true;
-      specificity_.values++;
-    }
-    return changed;
-  }
+  bool addName(const std::string &name) { return add(name); }
+
+  bool addValue(const std::string &name, const std::string &value)
+    { return add(name, value); }
 
   bool addAll(const Key &key) {
     bool changed = false;
     for (auto it = key.values_.cbegin(); it != key.values_.cend(); ++it) {
-      changed |= addName(it->first);
+      changed |= add(it->first);
       for (auto it2 = it->second.cbegin(); it2 != it->second.cend(); ++it2)
-        changed |= addValue(it->first, *it2);
+        changed |= add(it->first, *it2);
     }
     return changed;
   }
@@ -74,7 +155,7 @@ public:
    * also match on the current object, but not on the given key.
    * returns true if this object, as a pattern, matches the given key.
    */
-  bool matches(Key k) const {
+  bool matches(const Key &k) const {
     for (auto it = values_.cbegin(); it != values_.cend(); ++it) {
       auto valSet = k.values_.find(it->first);
       if (valSet == k.values_.cend()) return false;
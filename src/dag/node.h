@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <string>
@@ -9,31 +10,69 @@
 #include "ccs/types.h"
 #include "dag/key.h"
 #include "dag/property.h"
+#include "dag/property_names.h"
 #include "dag/tally.h"
 
 namespace ccs {
 
+class DagOptimizer;
 class Dumper;
+class LoadRecord;
 
 template<typename T>
 struct identity { typedef T type; };
 
 class Node {
+  friend class DagOptimizer;
   friend class Dumper;
+  friend class LoadRecord;
   std::shared_ptr<CcsTracer> tracer_; // to pin tracer, only non-null in root
+  std::shared_ptr<PropertyNames> names_; // likewise
+  // parts no longer in the dag, but which it or existing contexts may still
+  // refer to. likewise only non-empty in root.
+  std::vector<std::shared_ptr<const void>> pinned_;
+  // bumped whenever the dag changes, so that anything compiled from it can
+  // tell that it's out of date. likewise only meaningful in root.
+  unsigned generation_;
+  // the search states holding the dag (see DagBuilder::referenced()).
+  // likewise only counted in root.
+  mutable std::atomic<unsigned> holders_;
   std::map<Key, std::shared_ptr<Node>> children;
   std::multimap<std::string, Property> props;
   std::set<std::shared_ptr<AndTally>> andTallies_;
   std::set<std::shared_ptr<OrTally>> orTallies_;
   Key constraints;
+  // how this node came to be, for describing it (see NodePaths). a child
+  // has a parent and the key leading to it, a tally's node has the tally.
+  // the root has neither.
+  const Node *parent_;
+  const Key *key_;
+  const Tally *tally_;
+
+  std::set<std::shared_ptr<AndTally>> &tallySet(identity<AndTally>)
+    { return andTallies_; }
+  std::set<std::shared_ptr<OrTally>> &tallySet(identity<OrTally>)
+    { return orTallies_; }
 
 public:
-  Node() {}
-  Node(std::shared_ptr<CcsTracer> tracer) : tracer_(std::move(tracer)) {}
+  Node() : generation_(0), holders_(0), parent_(nullptr), key_(nullptr), tally_(nullptr) {}
+  Node(std::shared_ptr<CcsTracer> tracer) :
+    tracer_(std::move(tracer)), names_(std::make_shared<PropertyNames>()),
+    generation_(0), holders_(0), parent_(nullptr), key_(nullptr), tally_(nullptr) {}
   Node(const Node &) = delete;
   Node &operator=(const Node &) = delete;
 
   CcsTracer &tracer() const { return *tracer_; }
+  const std::shared_ptr<CcsTracer> &sharedTracer() const { return tracer_; }
+  PropertyNames &propertyNames() const { return *names_; }
+  void pin(std::shared_ptr<const void> p) { pinned_.push_back(std::move(p)); }
+  unsigned generation() const { return generation_; }
+  void changed() { generation_++; }
+  void hold() const { holders_.fetch_add(1, std::memory_order_relaxed); }
+  // releases, so that whoever sees the count drop knows the holder is done.
+  void unhold() const { holders_.fetch_sub(1, std::memory_order_release); }
+  unsigned holders() const
+    { return holders_.load(std::memory_order_acquire); }
 
   const std::map<Key, std::shared_ptr<Node>> &allChildren() const
       { return children; }
@@ -52,12 +91,22 @@ public:
       { return props; }
   const Key &allConstraints() const { return constraints; }
 
+  const Node *parent() const { return parent_; }
+  const Key *key() const { return key_; }
+  const Tally *tally() const { return tally_; }
+  void setTally(const Tally &tally) { tally_ = &tally; }
+
   void addTally(std::shared_ptr<AndTally> tally) { andTallies_.insert(tally); }
   void addTally(std::shared_ptr<OrTally> tally) { orTallies_.insert(tally); }
 
   Node &addChild(const Key &key) {
-    return *(*children.insert(std::make_pair(key, std::make_shared<Node>()))
-        .first).second;
+    auto pr = children.insert(std::make_pair(key, nullptr));
+    if (pr.second) {
+      pr.first->second = std::make_shared<Node>();
+      pr.first->second->parent_ = this;
+      pr.first->second->key_ = &pr.first->first;
+    }
+    return *pr.first->second;
   }
 
   void getChildren(const Key &key, const Specificity &spec,
@@ -82,7 +131,7 @@ public:
     searchState.constrain(constraints);
     if (searchState.add(spec, this)) {
       for (auto it = props.begin(); it != props.end(); ++it)
-        searchState.cacheProperty(it->first, spec, &it->second);
+        searchState.cacheProperty(it->second.nameId(), spec, &it->second);
       for (auto it = andTallies_.begin(); it != andTallies_.end(); ++it)
         (*it)->activate(*this, spec, searchState);
       for (auto it = orTallies_.begin(); it != orTallies_.end(); ++it)
@@ -94,8 +143,8 @@ public:
     constraints.addAll(key);
   }
 
-  void addProperty(const std::string &name, const Property &value) {
-    props.insert(std::pair<std::string, Property>(name, value));
+  const Property &addProperty(const std::string &name, const Property &value) {
+    return props.insert(std::pair<std::string, Property>(name, value))->second;
   }
 };
 
@@ -0,0 +1,78 @@
+#include "dag/node_paths.h"
+
+#include <deque>
+#include <sstream>
+#include <unordered_set>
+
+#include "dag/node.h"
+#include "dag/tally.h"
+
+namespace ccs {
+
+namespace {
+
+// computes the selector of each node from those of the node(s) it was
+// created from, remembering every result along the way.
+class Describer {
+  std::unordered_map<const Node *, std::string> &paths_;
+
+public:
+  explicit Describer(std::unordered_map<const Node *, std::string> &paths) :
+    paths_(paths) {}
+
+  const std::string &describe(const Node &node) {
+    auto it = paths_.find(&node);
+    if (it != paths_.end()) return it->second;
+
+    std::ostringstream str;
+    if (const Tally *tally = node.tally()) {
+      str << '(' << describe(tally->firstLeg()) << tally->separator()
+          << describe(tally->secondLeg()) << ')';
+    } else if (node.parent()) {
+      const std::string &parent = describe(*node.parent());
+      if (!parent.empty()) str << parent << " > ";
+      str << *node.key();
+    }
+    return paths_[&node] = str.str();
+  }
+};
+
+template <typename T>
+void enqueueTallies(const Node &node, std::deque<const Node *> &queue) {
+  auto &tallies = node.tallies<T>();
+  for (auto it = tallies.cbegin(); it != tallies.cend(); ++it)
+    queue.push_back(&(*it)->node());
+}
+
+}
+
+NodePaths::NodePaths(const Node &root) {
+  Describer describer(paths_);
+  std::unordered_set<const Node *> visited;
+  std::deque<const Node *> queue{&root};
+  while (!queue.empty()) {
+    const Node &node = *queue.front();
+    queue.pop_front();
+    // a tally's node is reached from both legs, so skip repeats.
+    if (!visited.insert(&node).second) continue;
+    describer.describe(node);
+    auto &children = node.allChildren();
+    for (auto it = children.cbegin(); it != children.cend(); ++it)
+      queue.push_back(it->second.get());
+    enqueueTallies<AndTally>(node, queue);
+    enqueueTallies<OrTally>(node, queue);
+  }
+}
+
+std::string NodePaths::selector(const Node &node) {
+  std::unordered_map<const Node *, std::string> paths;
+  return Describer(paths).describe(node);
+}
+
+const std::string &NodePaths::path(const Node &node) const {
+  static const std::string none;
+  auto it = paths_.find(&node);
+  return it == paths_.end() ? none : it->second;
+}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+namespace ccs {
+
+class Node;
+
+/*
+ * names every node in a dag by the selector that created it, in ccs syntax:
+ * "a.b > c" for a descendant step, "(a.b c)" or "(a.b, c)" for the node of a
+ * conjunction or disjunction, and "" for the root. these depend only on the
+ * rules, not on the order in which nodes were allocated, so they can be used
+ * to match up the nodes of two separately built dags.
+ */
+class NodePaths {
+  std::unordered_map<const Node *, std::string> paths_;
+
+public:
+  explicit NodePaths(const Node &root);
+
+  // the path of a single node, found by following its back-pointers.
+  static std::string selector(const Node &node);
+
+  // the empty string for the root, or for a node not in the dag.
+  const std::string &path(const Node &node) const;
+
+  template <typename F>
+  void forEach(F &&f) const {
+    for (auto it = paths_.cbegin(); it != paths_.cend(); ++it)
+      f(*it->first, it->second);
+  }
+};
+
+}
@@ -0,0 +1,227 @@
+#include "dag/optimize.h"
+
+#include <algorithm>
+#include <map>
+
+#include "dag/node.h"
+#include "dag/tally.h"
+
+namespace ccs {
+
+void DagOptimizer::collect(Node &node, std::vector<Node *> &nodes,
+    std::unordered_set<const Node *> &visited) {
+  if (!visited.insert(&node).second) return;
+  nodes.push_back(&node);
+  for (auto it = node.children.begin(); it != node.children.end(); ++it)
+    collect(*it->second, nodes, visited);
+  for (auto it = node.andTallies_.begin(); it != node.andTallies_.end();
+      ++it) {
+    owners_[&(*it)->node()] = *it;
+    collect((*it)->node(), nodes, visited);
+  }
+  for (auto it = node.orTallies_.begin(); it != node.orTallies_.end(); ++it) {
+    owners_[&(*it)->node()] = *it;
+    collect((*it)->node(), nodes, visited);
+  }
+}
+
+void DagOptimizer::count(size_t &nodes, size_t &tallies) {
+  std::vector<Node *> all;
+  std::unordered_set<const Node *> visited;
+  owners_.clear();
+  collect(root_, all, visited);
+  nodes = all.size();
+  tallies = owners_.size();
+}
+
+bool DagOptimizer::useful(const Node &node,
+    std::unordered_map<const Node *, bool> &memo) const {
+  auto it = memo.find(&node);
+  if (it != memo.end()) return it->second;
+  bool result = !node.props.empty() || !node.constraints.empty();
+  for (auto child = node.children.cbegin();
+      !result && child != node.children.cend(); ++child)
+    result = useful(*child->second, memo);
+  for (auto t = node.andTallies_.cbegin();
+      !result && t != node.andTallies_.cend(); ++t)
+    result = useful((*t)->node(), memo);
+  for (auto t = node.orTallies_.cbegin();
+      !result && t != node.orTallies_.cend(); ++t)
+    result = useful((*t)->node(), memo);
+  return memo[&node] = result;
+}
+
+template <typename T>
+void DagOptimizer::detach(Node &leg, const std::shared_ptr<Tally> &tally) {
+  leg.tallySet(identity<T>()).erase(std::static_pointer_cast<T>(tally));
+}
+
+template <typename T>
+bool DagOptimizer::pruneTallies(Node &node,
+    std::unordered_map<const Node *, bool> &memo,
+    std::unordered_set<const Node *> &visited) {
+  bool changed = false;
+  auto &tallies = node.tallySet(identity<T>());
+  // pruning a tally removes it from this set, so iterate over a copy.
+  std::vector<std::shared_ptr<T>> current(tallies.begin(), tallies.end());
+  for (auto it = current.begin(); it != current.end(); ++it) {
+    std::shared_ptr<T> tally = *it;
+    if (useful(tally->node(), memo)) {
+      changed |= pruneFrom(tally->node(), memo, visited);
+    } else {
+      detach<T>(tally->firstLeg(), tally);
+      detach<T>(tally->secondLeg(), tally);
+      root_.pin(tally);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool DagOptimizer::pruneFrom(Node &node,
+    std::unordered_map<const Node *, bool> &memo,
+    std::unordered_set<const Node *> &visited) {
+  if (!visited.insert(&node).second) return false;
+  bool changed = false;
+  for (auto it = node.children.begin(); it != node.children.end();) {
+    if (useful(*it->second, memo)) {
+      changed |= pruneFrom(*it->second, memo, visited);
+      ++it;
+    } else {
+      root_.pin(it->second);
+      it = node.children.erase(it);
+      changed = true;
+    }
+  }
+  changed |= pruneTallies<AndTally>(node, memo, visited);
+  changed |= pruneTallies<OrTally>(node, memo, visited);
+  return changed;
+}
+
+template <typename T>
+void DagOptimizer::leaves(const Node &node,
+    std::vector<const Node *> &result) const {
+  auto it = owners_.find(&node);
+  const T *tally = it == owners_.end()
+      ? nullptr : dynamic_cast<const T *>(it->second.get());
+  if (!tally) {
+    result.push_back(&node);
+    return;
+  }
+  leaves<T>(tally->firstLeg(), result);
+  leaves<T>(tally->secondLeg(), result);
+}
+
+bool DagOptimizer::within(const Node &node, const Node &tallyNode) const {
+  auto it = owners_.find(&tallyNode);
+  if (it == owners_.end()) return false;
+  const Tally &tally = *it->second;
+  return &tally.firstLeg() == &node || &tally.secondLeg() == &node
+      || within(node, tally.firstLeg()) || within(node, tally.secondLeg());
+}
+
+bool DagOptimizer::mergeEquivalent() {
+  std::vector<Node *> nodes;
+  std::unordered_set<const Node *> visited;
+  owners_.clear();
+  collect(root_, nodes, visited);
+
+  // tally nodes by kind and by flattened legs: every leg for a conjunction,
+  // since a leg matched twice counts twice towards its specificity, but
+  // only the distinct ones for a disjunction.
+  std::map<std::pair<bool, std::vector<const Node *>>, Node *> seen;
+  bool changed = false;
+  for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+    Node &node = **it;
+    auto owner = owners_.find(&node);
+    if (owner == owners_.end() || merged_.count(&node)) continue;
+    bool conjunction = dynamic_cast<AndTally *>(owner->second.get());
+    std::vector<const Node *> legs;
+    if (conjunction) {
+      leaves<AndTally>(node, legs);
+      std::sort(legs.begin(), legs.end());
+    } else {
+      leaves<OrTally>(node, legs);
+      std::sort(legs.begin(), legs.end());
+      legs.erase(std::unique(legs.begin(), legs.end()), legs.end());
+    }
+    auto pr = seen.emplace(std::make_pair(conjunction, legs), &node);
+    if (pr.second) continue;
+    Node &into = *pr.first->second;
+    // a disjunction may be equivalent to one of its own legs, but merging
+    // the two would make a cycle.
+    if (merged_.count(&into) || within(node, into) || within(into, node))
+      continue;
+    merge(into, node);
+    changed = true;
+  }
+  return changed;
+}
+
+template <typename T>
+void DagOptimizer::adoptTallies(Node &into, Node &from) {
+  auto &tallies = from.tallySet(identity<T>());
+  for (auto it = tallies.begin(); it != tallies.end(); ++it) {
+    (*it)->replaceLeg(from, into);
+    into.tallySet(identity<T>()).insert(*it);
+  }
+}
+
+void DagOptimizer::merge(Node &into, Node &from) {
+  merged_.insert(&from);
+  auto owner = owners_.find(&from);
+  if (owner != owners_.end()) {
+    std::shared_ptr<Tally> tally = owner->second;
+    if (dynamic_cast<AndTally *>(tally.get())) {
+      detach<AndTally>(tally->firstLeg(), tally);
+      detach<AndTally>(tally->secondLeg(), tally);
+    } else {
+      detach<OrTally>(tally->firstLeg(), tally);
+      detach<OrTally>(tally->secondLeg(), tally);
+    }
+    root_.pin(tally);
+  }
+
+  into.constraints.addAll(from.constraints);
+  for (auto it = from.props.cbegin(); it != from.props.cend(); ++it)
+    moved_[&it->second] =
+        std::make_pair(&into, &into.addProperty(it->first, it->second));
+  // children with the same key match under the same conditions too.
+  for (auto it = from.children.begin(); it != from.children.end(); ++it) {
+    auto pr = into.children.insert(*it);
+    Node &child = *it->second;
+    if (pr.second) {
+      child.parent_ = &into;
+      child.key_ = &pr.first->first;
+    } else if (pr.first->second != it->second) {
+      merge(*pr.first->second, child);
+    }
+  }
+  adoptTallies<AndTally>(into, from);
+  adoptTallies<OrTally>(into, from);
+}
+
+CcsOptimizeStats DagOptimizer::run() {
+  CcsOptimizeStats stats;
+  count(stats.nodesBefore, stats.talliesBefore);
+  bool changed = true;
+  while (changed) {
+    std::unordered_map<const Node *, bool> memo;
+    std::unordered_set<const Node *> visited;
+    changed = pruneFrom(root_, memo, visited);
+    changed |= mergeEquivalent();
+  }
+  count(stats.nodesAfter, stats.talliesAfter);
+  stats.merged = merged_.size();
+  return stats;
+}
+
+void DagOptimizer::find(const Node *&node, const Property *&prop) const {
+  for (auto it = moved_.find(prop); it != moved_.end();
+      it = moved_.find(prop)) {
+    node = it->second.first;
+    prop = it->second.second;
+  }
+}
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "ccs/domain.h"
+
+namespace ccs {
+
+class Node;
+class Property;
+class Tally;
+
+/*
+ * simplifies a dag in place, without changing what any context built from it
+ * afterwards sees. two things are done, repeatedly, until neither changes
+ * anything:
+ *
+ * - nodes which can never contribute a property or a constraint are pruned:
+ *   empty blocks, children leading only to such nodes, and tallies whose
+ *   node is one of them.
+ * - the nodes of equivalent tallies are merged. conjunctions are flattened,
+ *   so "a b c { }" and "a { b c { } }" are both the conjunction of a, b and
+ *   c, and match exactly when the other does, at the same specificity.
+ *   likewise for disjunctions. the merged node takes the properties,
+ *   constraints, children and tallies of both.
+ *
+ * whatever is dropped is pinned in the root, since existing contexts may
+ * still refer to it.
+ */
+class DagOptimizer {
+  Node &root_;
+  // the tally owning each tally node, as last found by collect()
+  std::unordered_map<const Node *, std::shared_ptr<Tally>> owners_;
+  // where each property of a merged node went, and on which node
+  std::unordered_map<const Property *, std::pair<const Node *,
+      const Property *>> moved_;
+  std::unordered_set<const Node *> merged_;
+
+  void collect(Node &node, std::vector<Node *> &nodes,
+      std::unordered_set<const Node *> &visited);
+  bool useful(const Node &node,
+      std::unordered_map<const Node *, bool> &memo) const;
+  bool pruneFrom(Node &node, std::unordered_map<const Node *, bool> &memo,
+      std::unordered_set<const Node *> &visited);
+  template <typename T>
+  bool pruneTallies(Node &node, std::unordered_map<const Node *, bool> &memo,
+      std::unordered_set<const Node *> &visited);
+  bool mergeEquivalent();
+  template <typename T>
+  void leaves(const Node &node, std::vector<const Node *> &result) const;
+  bool within(const Node &node, const Node &tallyNode) const;
+  void merge(Node &into, Node &from);
+  template <typename T>
+  void detach(Node &leg, const std::shared_ptr<Tally> &tally);
+  template <typename T>
+  void adoptTallies(Node &into, Node &from);
+  void count(size_t &nodes, size_t &tallies);
+
+public:
+  explicit DagOptimizer(Node &root) : root_(root) {}
+
+  CcsOptimizeStats run();
+
+  // where a property ended up, and on which node, if it was moved by a
+  // merge. otherwise, leaves both alone.
+  void find(const Node *&node, const Property *&prop) const;
+};
+
+}
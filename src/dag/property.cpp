@@ -37,6 +37,40 @@ struct Caster {
   S operator()(const S &v) const { return v; }
 };
 
+template <typename S>
+struct TryCaster {
+  const Value &val;
+  S &dest;
+  TryCaster(const Value &val, S &dest) : val(val), dest(dest) {}
+  template <typename T>
+  bool operator()(const T &v) const {
+    (void)v;
+    return CcsContext::coerceString(val.asString(), dest);
+  }
+  bool operator()(const S &v) const { dest = v; return true; }
+};
+
+template <typename T>
+bool coerceStrValue(const CcsProperty &prop, T &dest) {
+  return prop.exists() && CcsContext::coerceString(prop.strValue(), dest);
+}
+
+struct MissingProp : public CcsProperty {
+  virtual bool exists() const { return false; }
+  virtual Origin origin() const
+    { throw std::runtime_error("called origin() on MissingProp"); }
+  virtual const std::string &strValue() const
+    { throw std::runtime_error("called strValue() on MissingProp"); }
+  virtual int intValue() const
+    { throw std::runtime_error("called intValue() on MissingProp"); }
+  virtual double doubleValue() const
+    { throw std::runtime_error("called doubleValue() on MissingProp"); }
+  virtual bool boolValue() const
+    { throw std::runtime_error("called boolValue() on MissingProp"); }
+};
+
+MissingProp Missing;
+
 struct ToString {
   std::string operator()(bool v) const { return v ? "true" : "false"; }
   std::string operator()(const StringVal &v) const { return v.str(); }
@@ -73,7 +107,22 @@ double Value::asDouble() const
   { return accept<double>(Caster<double>(*this)); }
 bool Value::asBool() const
   { return accept<bool>(Caster<bool>(*this)); }
+bool Value::coerce(int &dest) const
+  { return accept<bool>(TryCaster<int>(*this, dest)); }
+bool Value::coerce(double &dest) const
+  { return accept<bool>(TryCaster<double>(*this, dest)); }
+bool Value::coerce(bool &dest) const
+  { return accept<bool>(TryCaster<bool>(*this, dest)); }
 void Value::str()
   { strVal_ = accept<std::string>(ToString()); }
 
+bool CcsProperty::coerce(int &dest) const
+  { return coerceStrValue(*this, dest); }
+bool CcsProperty::coerce(double &dest) const
+  { return coerceStrValue(*this, dest); }
+bool CcsProperty::coerce(bool &dest) const
+  { return coerceStrValue(*this, dest); }
+
+const CcsProperty &missingProperty() { return Missing; }
+
 }
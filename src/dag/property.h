@@ -1,9 +1,12 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <iosfwd>
+#include <mutex>
 #include <vector>
 
+#include "ccs/context.h"
 #include "ccs/types.h"
 
 namespace ccs {
@@ -63,6 +66,10 @@ public:
   int asInt() const;
   double asDouble() const;
   bool asBool() const;
+  // non-throwing versions of the above
+  bool coerce(int &dest) const;
+  bool coerce(double &dest) const;
+  bool coerce(bool &dest) const;
 
 private:
   void str();
@@ -74,22 +81,75 @@ class Property : public CcsProperty {
   const Value value_;
   Origin origin_;
   unsigned propertyNumber_;
+  unsigned nameId_;
   bool override_;
+  // values are coerced on first typed access, once for all three types,
+  // and then kept. most are only ever read as strings, if at all. once
+  // coerced_ is set, a typed read is just a load.
+  mutable std::atomic<bool> coerced_;
+  mutable std::once_flag coercing_;
+  mutable bool hasInt_;
+  mutable bool hasDouble_;
+  mutable bool hasBool_;
+  mutable bool boolVal_;
+  mutable int intVal_;
+  mutable double doubleVal_;
+
+  void coerceAll() const {
+    if (coerced_.load(std::memory_order_acquire)) return;
+    std::call_once(coercing_, [this] {
+      hasInt_ = value_.coerce(intVal_);
+      hasDouble_ = value_.coerce(doubleVal_);
+      hasBool_ = value_.coerce(boolVal_);
+      coerced_.store(true, std::memory_order_release);
+    });
+  }
+
+  template <typename T>
+  T checked(const bool &has, const T &val) const {
+    coerceAll();
+    if (!has) throw bad_coercion(value_.name(), value_.asString());
+    return val;
+  }
+
+  template <typename T>
+  bool coerced(const bool &has, const T &val, T &dest) const {
+    coerceAll();
+    if (has) dest = val;
+    return has;
+  }
 
 public:
   Property(const Value &value, const Origin &origin,
-      unsigned propertyNumber, bool override) :
+      unsigned propertyNumber, unsigned nameId, bool override) :
         value_(value), origin_(origin), propertyNumber_(propertyNumber),
-        override_(override) {}
+        nameId_(nameId), override_(override), coerced_(false),
+        hasInt_(false), hasDouble_(false), hasBool_(false), boolVal_(false),
+        intVal_(0), doubleVal_(0) {}
+  // a copy coerces afresh, if need be.
+  Property(const Property &that) :
+    Property(that.value_, that.origin_, that.propertyNumber_, that.nameId_,
+        that.override_) {}
 
   virtual bool exists() const { return true; }
   virtual Origin origin() const { return origin_; }
   virtual const std::string &strValue() const { return value_.asString(); }
-  virtual int intValue() const { return value_.asInt(); }
-  virtual double doubleValue() const { return value_.asDouble(); }
-  virtual bool boolValue() const { return value_.asBool(); }
+  virtual int intValue() const { return checked(hasInt_, intVal_); }
+  virtual double doubleValue() const
+    { return checked(hasDouble_, doubleVal_); }
+  virtual bool boolValue() const { return checked(hasBool_, boolVal_); }
+  virtual bool coerce(int &dest) const
+    { return coerced(hasInt_, intVal_, dest); }
+  virtual bool coerce(double &dest) const
+    { return coerced(hasDouble_, doubleVal_, dest); }
+  virtual bool coerce(bool &dest) const
+    { return coerced(hasBool_, boolVal_, dest); }
   bool override() const { return override_; }
   unsigned propertyNumber() const { return propertyNumber_; }
+  unsigned nameId() const { return nameId_; }
 };
 
+// the property returned for lookups which find nothing
+const CcsProperty &missingProperty();
+
 }
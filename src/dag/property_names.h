@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ccs {
+
+/*
+ * interns property names into dense integer ids. there's one of these per
+ * domain, owned by the root of the dag. names are only ever added while the
+ * dag is being built (or when a PropertyKey is created), never during a
+ * lookup.
+ */
+class PropertyNames {
+  std::unordered_map<std::string, unsigned> ids_;
+  std::vector<const std::string *> names_; // keys of ids_, which are stable
+  uint64_t id_;
+
+  static uint64_t nextId() {
+    static std::atomic<uint64_t> next(1);
+    return next.fetch_add(1, std::memory_order_relaxed);
+  }
+
+public:
+  static const unsigned None = ~0u;
+
+  PropertyNames() : id_(nextId()) {}
+  PropertyNames(const PropertyNames &) = delete;
+  PropertyNames &operator=(const PropertyNames &) = delete;
+
+  unsigned intern(const std::string &name) {
+    auto pr = ids_.insert(std::make_pair(name, (unsigned)names_.size()));
+    if (pr.second) names_.push_back(&pr.first->first);
+    return pr.first->second;
+  }
+
+  unsigned find(const std::string &name) const {
+    auto it = ids_.find(name);
+    if (it == ids_.end()) return None;
+    return it->second;
+  }
+
+  const std::string &name(unsigned id) const { return *names_[id]; }
+  size_t size() const { return names_.size(); }
+  // identifies this table in keys interned by it. unlike its address, never
+  // reused by another table, even once this one is gone. never 0.
+  uint64_t id() const { return id_; }
+};
+
+}
@@ -0,0 +1,219 @@
+#include "dag/dag_builder.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "dag/key.h"
+#include "dag/node.h"
+#include "dag/tally.h"
+
+namespace ccs {
+
+namespace {
+
+typedef std::map<std::string, std::set<std::string>> ValuesByName;
+
+void addValues(const Key &key, ValuesByName &values, bool addNames) {
+  key.forEachName([&](const Key::String &name, const Key::Values &vals) {
+    std::string n(name.data(), name.size());
+    auto it = values.find(n);
+    if (it == values.end()) {
+      if (!addNames) return;
+      it = values.emplace(n, std::set<std::string>()).first;
+    }
+    for (auto v = vals.cbegin(); v != vals.cend(); ++v)
+      it->second.insert(std::string(v->data(), v->size()));
+  });
+}
+
+/*
+ * copies a dag, leaving out every edge which can't match once contexts are
+ * constrained by some fixed keys, and never again by those keys' names. the
+ * only keys with such a name are then the fixed keys themselves, plus any
+ * to which an @constrain adds it, so an edge needing any other value of it
+ * can never match. whatever is then unreachable goes too: nodes only found
+ * through such edges, and conjunctions missing a leg.
+ */
+class Specializer {
+  // for each fixed name, the values which could ever be seen
+  ValuesByName possible_;
+  std::vector<const Node *> all_;
+  std::unordered_set<const Node *> live_;
+  std::unordered_map<const Node *, Node *> nodes_;
+  std::unordered_map<const Property *, const Property *> props_;
+  // stand-ins for legs of disjunctions which were left out
+  std::vector<std::unique_ptr<Node>> standIns_;
+
+  bool possible(const Key &key) const {
+    bool result = true;
+    key.forEachName([&](const Key::String &name, const Key::Values &vals) {
+      auto it = possible_.find(std::string(name.data(), name.size()));
+      if (it == possible_.end()) return;
+      for (auto v = vals.cbegin(); v != vals.cend(); ++v)
+        if (!it->second.count(std::string(v->data(), v->size())))
+          result = false;
+    });
+    return result;
+  }
+
+  bool live(const Node &node) const { return live_.count(&node) != 0; }
+
+  template <typename T>
+  void visitTallies(const Node &node, std::vector<const Node *> &queue) {
+    auto &tallies = node.tallies<T>();
+    for (auto it = tallies.cbegin(); it != tallies.cend(); ++it)
+      queue.push_back(&(*it)->node());
+  }
+
+  // every node in the dag, and every value an @constrain might add.
+  void collect(const Node &root) {
+    std::vector<const Node *> queue{&root};
+    std::unordered_set<const Node *> visited;
+    while (!queue.empty()) {
+      const Node *node = queue.back();
+      queue.pop_back();
+      if (!visited.insert(node).second) continue;
+      all_.push_back(node);
+      addValues(node->allConstraints(), possible_, false);
+      auto &children = node->allChildren();
+      for (auto it = children.cbegin(); it != children.cend(); ++it)
+        queue.push_back(it->second.get());
+      visitTallies<AndTally>(*node, queue);
+      visitTallies<OrTally>(*node, queue);
+    }
+  }
+
+  // find every node which can still be activated, repeating until nothing
+  // more turns up, since a tally may come to life after its node was seen.
+  void findLive(const Node &root) {
+    live_.insert(&root);
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto it = all_.cbegin(); it != all_.cend(); ++it) {
+        const Node &node = **it;
+        if (!live(node)) continue;
+        auto &children = node.allChildren();
+        for (auto child = children.cbegin(); child != children.cend();
+            ++child)
+          if (possible(child->first))
+            changed |= live_.insert(child->second.get()).second;
+        auto &ands = node.tallies<AndTally>();
+        for (auto t = ands.cbegin(); t != ands.cend(); ++t)
+          if (live((*t)->firstLeg()) && live((*t)->secondLeg()))
+            changed |= live_.insert(&(*t)->node()).second;
+        auto &ors = node.tallies<OrTally>();
+        for (auto t = ors.cbegin(); t != ors.cend(); ++t)
+          changed |= live_.insert(&(*t)->node()).second;
+      }
+    }
+  }
+
+  void copy(const Node &from, Node &to) {
+    nodes_[&from] = &to;
+    to.addConstraint(from.allConstraints());
+    auto &props = from.properties();
+    for (auto it = props.cbegin(); it != props.cend(); ++it)
+      props_[&it->second] = &to.addProperty(it->first, it->second);
+    auto &children = from.allChildren();
+    for (auto it = children.cbegin(); it != children.cend(); ++it)
+      if (live(*it->second) && possible(it->first))
+        copy(*it->second, to.addChild(it->first));
+  }
+
+  // the copy of a tally's leg, or a stand-in which nothing ever activates
+  // if the leg was left out (which only happens for a disjunction). null if
+  // the leg is live, but not yet copied.
+  Node *leg(const Node &node) {
+    if (!live(node)) {
+      standIns_.emplace_back(new Node());
+      return standIns_.back().get();
+    }
+    return find(node);
+  }
+
+  // copy every live tally whose legs are ready, which may in turn copy
+  // more nodes. returns true if anything was copied.
+  template <typename T>
+  bool copyTallies() {
+    bool progress = false;
+    for (auto it = all_.cbegin(); it != all_.cend(); ++it) {
+      auto &tallies = (*it)->tallies<T>();
+      for (auto t = tallies.cbegin(); t != tallies.cend(); ++t) {
+        const T &tally = **t;
+        if (!live(tally.node()) || find(tally.node())) continue;
+        if (!find(tally.firstLeg()) && !find(tally.secondLeg())) continue;
+        if (live(tally.firstLeg()) && !find(tally.firstLeg())) continue;
+        if (live(tally.secondLeg()) && !find(tally.secondLeg())) continue;
+        Node &first = *leg(tally.firstLeg());
+        Node &second = *leg(tally.secondLeg());
+        auto copied = std::make_shared<T>(first, second);
+        first.addTally(copied);
+        second.addTally(copied);
+        copy(tally.node(), copied->node());
+        progress = true;
+      }
+    }
+    return progress;
+  }
+
+public:
+  explicit Specializer(const std::vector<Key> &fixed) {
+    for (auto it = fixed.cbegin(); it != fixed.cend(); ++it)
+      addValues(*it, possible_, true);
+  }
+
+  void run(const Node &root, Node &dest) {
+    collect(root);
+    findLive(root);
+    copy(root, dest);
+    while (copyTallies<AndTally>() | copyTallies<OrTally>()) {}
+  }
+
+  Node *find(const Node &node) const {
+    auto it = nodes_.find(&node);
+    return it == nodes_.end() ? nullptr : it->second;
+  }
+
+  const Property *find(const Property &prop) const {
+    auto it = props_.find(&prop);
+    return it == props_.end() ? nullptr : it->second;
+  }
+
+  std::vector<std::unique_ptr<Node>> &standIns() { return standIns_; }
+};
+
+}
+
+void DagBuilder::specialize(const DagBuilder &source,
+    const std::vector<Key> &fixed) {
+  invalidateRoot();
+  untracked();
+  nextProperty_ = source.nextProperty_;
+  loadFailed_ = source.loadFailed_;
+  // the same ids for the same names, so copied properties needn't change.
+  auto &names = source.root_->propertyNames();
+  for (size_t id = 0; id < names.size(); id++)
+    internProperty(names.name(id));
+
+  Specializer specializer(fixed);
+  specializer.run(*source.root_, *root_);
+  auto &standIns = specializer.standIns();
+  for (auto it = standIns.begin(); it != standIns.end(); ++it)
+    root_->pin(std::shared_ptr<const Node>(std::move(*it)));
+  for (auto byName = source.definitions_.cbegin();
+      byName != source.definitions_.cend(); ++byName) {
+    for (auto it = byName->cbegin(); it != byName->cend(); ++it) {
+      const Property *property = specializer.find(*it->second);
+      if (property) addDefinition(*specializer.find(*it->first), *property);
+    }
+  }
+  fixed_ = fixed;
+  indexTallies();
+}
+
+}
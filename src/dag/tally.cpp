@@ -4,44 +4,37 @@
 
 namespace ccs {
 
-TallyState *TallyState::clone() const {
-  TallyState *next = new TallyState(tally);
-  next->firstMatched = firstMatched;
-  next->firstMatch = firstMatch;
-  next->secondMatched = secondMatched;
-  next->secondMatch = secondMatch;
-  return next;
-}
-
-TallyState *TallyState::activate(const Node &leg,
+TallyState TallyState::activate(const Node &leg,
     const Specificity &spec) const {
   // NB reference equality in the below...
-  TallyState *next = clone();
-  if (&tally.firstLeg_ == &leg) {
-    next->firstMatched = true;
-    if (next->firstMatch < spec) next->firstMatch = spec;
+  TallyState next = *this;
+  if (tally->firstLeg_ == &leg) {
+    next.firstMatched = true;
+    if (next.firstMatch < spec) next.firstMatch = spec;
   }
-  if (&tally.secondLeg_ == &leg) {
-    next->secondMatched = true;
-    if (next->secondMatch < spec) next->secondMatch = spec;
+  if (tally->secondLeg_ == &leg) {
+    next.secondMatched = true;
+    if (next.secondMatch < spec) next.secondMatch = spec;
   }
   return next;
 }
 
 Tally::Tally(Node &firstLeg, Node &secondLeg) :
     node_(new Node()),
-    firstLeg_(firstLeg),
-    secondLeg_(secondLeg) {}
+    firstLeg_(&firstLeg),
+    secondLeg_(&secondLeg) {
+  node_->setTally(*this);
+}
 
 Tally::~Tally() {}
 
 void AndTally::activate(const Node &leg, const Specificity &spec,
     SearchState &searchState) const {
-  const TallyState *state = searchState.getTallyState(this)->activate(leg, spec);
+  TallyState state = searchState.getTallyState(this)->activate(leg, spec);
   searchState.setTallyState(this, state);
   // seems like this could lead to spurious warnings, but see comment below...
-  if (state->fullyMatched())
-    node_->activate(state->specificity(), searchState);
+  if (state.fullyMatched())
+    node_->activate(state.specificity(), searchState);
 }
 
 void OrTally::activate(const Node &, const Specificity &spec,
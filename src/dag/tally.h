@@ -12,30 +12,28 @@ class SearchState;
 
 class TallyState {
   friend class AndTally;
-  const AndTally &tally;
+  friend class SearchState;
+  const AndTally *tally;
   bool firstMatched;
   bool secondMatched;
   Specificity firstMatch;
   Specificity secondMatch;
 
-  TallyState *activate(const Node &leg, const Specificity &spec) const;
-  TallyState *clone() const;
+  TallyState activate(const Node &leg, const Specificity &spec) const;
 
   bool fullyMatched() const { return firstMatched && secondMatched; }
   Specificity specificity() const { return firstMatch + secondMatch; }
 
 public:
   explicit TallyState(const AndTally &tally) :
-    tally(tally), firstMatched(false), secondMatched(false) {}
-  TallyState(const TallyState &) = delete;
-  TallyState &operator=(const TallyState &) = delete;
+    tally(&tally), firstMatched(false), secondMatched(false) {}
 };
 
 class Tally {
 protected:
   std::unique_ptr<Node> node_;
-  Node &firstLeg_;
-  Node &secondLeg_;
+  Node *firstLeg_;
+  Node *secondLeg_;
 
 public:
   Tally(Node &firstLeg, Node &secondLeg);
@@ -46,9 +44,21 @@ public:
 
   const Node &node() const { return *node_; }
   Node &node() { return *node_; }
+  const Node &firstLeg() const { return *firstLeg_; }
+  const Node &secondLeg() const { return *secondLeg_; }
+  Node &firstLeg() { return *firstLeg_; }
+  Node &secondLeg() { return *secondLeg_; }
+  // make to a leg in place of from, wherever from is one. the caller must
+  // add this to to's tallies.
+  void replaceLeg(const Node &from, Node &to) {
+    if (firstLeg_ == &from) firstLeg_ = &to;
+    if (secondLeg_ == &from) secondLeg_ = &to;
+  }
 
   virtual void activate(const Node &leg, const Specificity &spec,
       SearchState &searchState) const = 0;
+  // how the legs are joined in a selector: " " or ", "
+  virtual const char *separator() const = 0;
 };
 
 class OrTally : public Tally {
@@ -56,6 +66,7 @@ public:
   OrTally(Node &firstLeg, Node &secondLeg) : Tally(firstLeg, secondLeg) {}
   virtual void activate(const Node &leg, const Specificity &spec,
       SearchState &searchState) const;
+  virtual const char *separator() const { return ", "; }
 };
 
 class AndTally : public Tally {
@@ -67,6 +78,7 @@ public:
     Tally(firstLeg, secondLeg), emptyState_(*this) {}
   virtual void activate(const Node &leg, const Specificity &spec,
       SearchState &searchState) const;
+  virtual const char *separator() const { return " "; }
   const TallyState *emptyState() const { return &emptyState_; }
 };
 
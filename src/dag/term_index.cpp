@@ -0,0 +1,49 @@
+#include "dag/term_index.h"
+
+#include "dag/node.h"
+#include "search_state.h"
+
+namespace ccs {
+
+void TermIndex::add(const Node &node, const Specificity &spec) {
+  auto &children = node.allChildren();
+  for (auto it = children.cbegin(); it != children.cend(); ++it) {
+    Edge edge{&it->first, it->second.get(),
+        spec + it->first.specificity()};
+    const Key::String *name = nullptr;
+    const Key::String *value = nullptr;
+    it->first.forEachName([&](const Key::String &n, const Key::Values &v) {
+      if (name) return;
+      name = &n;
+      if (!v.empty()) value = &*v.cbegin();
+    });
+    if (!name)
+      always_.push_back(edge);
+    else if (!value)
+      byName_[*name].any.push_back(edge);
+    else
+      byName_[*name].byValue[*value].push_back(edge);
+  }
+}
+
+void TermIndex::activate(const std::vector<Edge> &edges, const Key &key,
+    SearchState &searchState) {
+  for (auto it = edges.cbegin(); it != edges.cend(); ++it)
+    if (it->key->matches(key)) it->child->activate(it->spec, searchState);
+}
+
+void TermIndex::activate(const Key &key, SearchState &searchState) const {
+  activate(always_, key, searchState);
+  key.forEachName([&](const Key::String &name, const Key::Values &values) {
+    auto terms = byName_.find(name);
+    if (terms == byName_.end()) return;
+    activate(terms->second.any, key, searchState);
+    for (auto it = values.cbegin(); it != values.cend(); ++it) {
+      auto edges = terms->second.byValue.find(*it);
+      if (edges != terms->second.byValue.end())
+        activate(edges->second, key, searchState);
+    }
+  });
+}
+
+}
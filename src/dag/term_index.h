@@ -0,0 +1,51 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include "dag/key.h"
+#include "dag/specificity.h"
+
+namespace ccs {
+
+class Node;
+class SearchState;
+
+/*
+ * the children of a fixed set of active nodes (those of the root context),
+ * grouped by the first name and value of each child's key. a child can only
+ * match a key containing that name and value, so finding the children which
+ * match some key is a lookup per name and value in the key, rather than a
+ * test of every child of every node.
+ *
+ * this refers directly to nodes in the dag, so it's only valid for as long as
+ * the dag is alive and unchanged.
+ */
+class TermIndex {
+  struct Edge {
+    const Key *key;
+    const Node *child;
+    Specificity spec; // the child's, once activated through this edge
+  };
+
+  struct Terms {
+    std::vector<Edge> any; // keyed by the name alone
+    std::map<Key::String, std::vector<Edge>, Key::Less> byValue;
+  };
+
+  std::vector<Edge> always_; // empty keys, which match anything
+  std::map<Key::String, Terms, Key::Less> byName_;
+
+  static void activate(const std::vector<Edge> &edges, const Key &key,
+      SearchState &searchState);
+
+public:
+  // index the children of node, active with the given specificity.
+  void add(const Node &node, const Specificity &spec);
+
+  // activate every indexed child matching key, just as getChildren() on
+  // each of the indexed nodes would.
+  void activate(const Key &key, SearchState &searchState) const;
+};
+
+}
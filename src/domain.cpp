@@ -1,11 +1,18 @@
 #include "ccs/domain.h"
 
+#include <algorithm>
 #include <iostream>
+#include <mutex>
+#include <stdexcept>
 
 #include "graphviz.h"
 #include "ccs/context.h"
+#include "dag/conflicts.h"
 #include "dag/dag_builder.h"
+#include "dag/node_paths.h"
 #include "parser/loader.h"
+#include "parser/parse_cache.h"
+#include "search_state.h"
 
 namespace ccs {
 
@@ -90,6 +97,34 @@ NoImportResolver NoImportResolver;
 
 }
 
+void CcsTracer::onPropertiesFound(const CcsContext &ccsContext,
+    const std::vector<std::string> &propertyNames,
+    const CcsProperty *const *props) {
+  for (size_t i = 0; i < propertyNames.size(); i++) {
+    if (props[i])
+      onPropertyFound(ccsContext, propertyNames[i], *props[i]);
+    else
+      onPropertyNotFound(ccsContext, propertyNames[i]);
+  }
+}
+
+void CcsTracer::onInternedPropertyFound(const CcsContext &ccsContext,
+    const std::string &propertyName, uint64_t, unsigned,
+    const CcsProperty &prop) {
+  onPropertyFound(ccsContext, propertyName, prop);
+}
+
+void CcsTracer::onInternedPropertyNotFound(const CcsContext &ccsContext,
+    const std::string &propertyName, uint64_t, unsigned) {
+  onPropertyNotFound(ccsContext, propertyName);
+}
+
+void CcsTracer::onInternedPropertiesFound(const CcsContext &ccsContext,
+    const std::vector<std::string> &propertyNames, uint64_t,
+    const unsigned *, const CcsProperty *const *props) {
+  onPropertiesFound(ccsContext, propertyNames, props);
+}
+
 std::shared_ptr<CcsLogger> CcsLogger::makeStdErrLogger() {
   return std::make_shared<StdErrLogger>();
 }
@@ -101,6 +136,29 @@ std::shared_ptr<CcsTracer> CcsTracer::makeLoggingTracer(
 
 ImportResolver &ImportResolver::None = NoImportResolver;
 
+CcsParseCache::CcsParseCache() : cache(new ParseCache()) {}
+CcsParseCache::~CcsParseCache() {}
+
+size_t CcsParseCache::size() const {
+  std::lock_guard<std::mutex> lock(cache->mutex);
+  return cache->size();
+}
+
+size_t CcsParseCache::parses() const {
+  std::lock_guard<std::mutex> lock(cache->mutex);
+  return cache->parses;
+}
+
+size_t CcsParseCache::reuses() const {
+  std::lock_guard<std::mutex> lock(cache->mutex);
+  return cache->reuses;
+}
+
+void CcsParseCache::clear() {
+  std::lock_guard<std::mutex> lock(cache->mutex);
+  cache->clear();
+}
+
 CcsDomain::CcsDomain(std::shared_ptr<CcsTracer> tracer) :
   dag(new DagBuilder(std::move(tracer))) {}
 
@@ -117,20 +175,119 @@ CcsDomain::~CcsDomain() {}
 CcsDomain &CcsDomain::loadCcsStream(std::istream &stream,
     const std::string &fileName, ImportResolver &importResolver) {
   Loader loader(dag->root()->tracer());
-  loader.loadCcsStream(stream, fileName, *dag, importResolver);
+  if (!loader.loadCcsStream(stream, fileName, *dag, importResolver))
+    dag->loadFailed();
+  return *this;
+}
+
+CcsDomain &CcsDomain::loadCcsStream(std::istream &stream,
+    const std::string &fileName, ImportResolver &importResolver,
+    CcsParseCache &cache) {
+  std::lock_guard<std::mutex> lock(cache.cache->mutex);
+  Loader loader(dag->root()->tracer(), cache.cache.get());
+  if (!loader.loadCcsStream(stream, fileName, *dag, importResolver))
+    dag->loadFailed();
   return *this;
 }
 
+bool CcsDomain::loadFailed() const {
+  return dag->hasLoadFailed();
+}
+
 RuleBuilder CcsDomain::ruleBuilder() {
   return RuleBuilder(*dag);
 }
 
+PropertyKeyBase CcsDomain::internProperty(const std::string &name) {
+  return PropertyKeyBase(dag->internProperty(name), name,
+      dag->root()->propertyNames().id());
+}
+
+CcsContext::PropertySet CcsDomain::propertySet(
+    std::vector<std::string> names) {
+  std::vector<unsigned> ids;
+  ids.reserve(names.size());
+  for (auto it = names.cbegin(); it != names.cend(); ++it)
+    ids.push_back(dag->internProperty(*it));
+  return CcsContext::PropertySet(std::move(names), std::move(ids),
+      dag->root()->propertyNames().id());
+}
+
 CcsContext CcsDomain::build() {
-  return CcsContext(dag->root());
+  return CcsContext(dag->rootState());
+}
+
+std::unique_ptr<CcsDomain> CcsDomain::specialize(
+    const CcsContext &context) const {
+  if (&context.searchState->dagRoot() != dag->root().get())
+    throw std::invalid_argument(
+        "can't specialize a domain for another domain's context");
+  std::vector<const Key *> path;
+  context.searchState->requestedPath(path);
+  std::vector<Key> fixed;
+  for (auto it = path.cbegin(); it != path.cend(); ++it)
+    fixed.push_back(**it);
+  std::unique_ptr<CcsDomain> result(
+      new CcsDomain(dag->root()->sharedTracer()));
+  result->dag->specialize(*dag, fixed);
+  return result;
 }
 
 void CcsDomain::logRuleDag(std::ostream &os) const {
   os << Dumper(*dag->root());
 }
 
+CcsOptimizeStats CcsDomain::optimize() {
+  return dag->optimize();
+}
+
+std::vector<CcsConflict> CcsDomain::findConflicts() const {
+  return ccs::findConflicts(*dag->root());
+}
+
+std::vector<CcsDefinition> CcsDomain::definitionsOf(
+    const std::string &propertyName) const {
+  std::vector<CcsDefinition> result;
+  unsigned id = dag->root()->propertyNames().find(propertyName);
+  auto &definitions = dag->definitions();
+  if (id >= definitions.size()) return result;
+  for (auto it = definitions[id].cbegin(); it != definitions[id].cend(); ++it)
+    result.push_back(CcsDefinition{NodePaths::selector(*it->first),
+        it->second->origin(), it->second->strValue(), it->second->override()});
+  return result;
+}
+
+std::vector<std::string> CcsDomain::definedProperties() const {
+  std::vector<std::string> result;
+  auto &names = dag->root()->propertyNames();
+  auto &definitions = dag->definitions();
+  for (unsigned id = 0; id < definitions.size(); ++id)
+    if (!definitions[id].empty()) result.push_back(names.name(id));
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+std::ostream &operator<<(std::ostream &os, const CcsConflict &conflict) {
+  os << "Potential conflict for ";
+  if (conflict.override) os << "@override ";
+  os << "property '" << conflict.propertyName << "': ";
+  bool first = true;
+  for (auto it = conflict.definitions.cbegin();
+      it != conflict.definitions.cend(); ++it) {
+    if (!first) os << ", ";
+    os << it->origin << " (" << it->value;
+    if (it->viaTally) os << ", via tally";
+    os << ')';
+    first = false;
+  }
+  return os;
+}
+
+std::ostream &operator<<(std::ostream &os, const CcsOptimizeStats &stats) {
+  os << "Optimized rule dag: " << stats.nodesBefore << " -> "
+      << stats.nodesAfter << " nodes (" << stats.merged << " merged), "
+      << stats.talliesBefore << " -> " << stats.talliesAfter << " tallies";
+  return os;
+}
+
 }
@@ -0,0 +1,360 @@
+#include "ccs/file_watcher.h"
+
+#include <atomic>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#endif
+
+#include "parser/parse_cache.h"
+
+namespace ccs {
+
+namespace {
+
+std::string dirName(const std::string &path) {
+  auto slash = path.rfind('/');
+  if (slash == std::string::npos) return ".";
+  if (slash == 0) return "/";
+  return path.substr(0, slash);
+}
+
+std::string baseName(const std::string &path) {
+  auto slash = path.rfind('/');
+  if (slash == std::string::npos) return path;
+  return path.substr(slash + 1);
+}
+
+// the canonical form of the directory, plus the file name itself, which
+// may not exist. this matches the names reported by inotify for the
+// directory.
+std::string canonical(const std::string &path) {
+  std::string dir = dirName(path);
+  char buf[PATH_MAX];
+  if (realpath(dir.c_str(), buf)) dir = buf;
+  return dir == "/" ? "/" + baseName(path) : dir + "/" + baseName(path);
+}
+
+struct FileState {
+  bool exists;
+  uint64_t fingerprint;
+
+  bool operator!=(const FileState &that) const
+    { return exists != that.exists || fingerprint != that.fingerprint; }
+};
+
+// read a whole file, if it exists.
+FileState readFile(const std::string &path, std::string *contents) {
+  std::ifstream stream(path.c_str(), std::ios::binary);
+  if (!stream) return FileState{false, 0};
+  std::string str((std::istreambuf_iterator<char>(stream)),
+      std::istreambuf_iterator<char>());
+  FileState state{true, ParseCache::fingerprint(str)};
+  if (contents) contents->swap(str);
+  return state;
+}
+
+// everything that has to outlive the watcher, as long as the domain and
+// its loader are still around.
+struct State {
+  std::string fileName;
+  CcsParseCache cache;
+  std::mutex mutex;
+  std::map<std::string, FileState> files; // by canonical path
+
+  explicit State(const std::string &fileName) : fileName(fileName) {}
+};
+
+class RecordingResolver : public CcsFileImportResolver {
+  std::map<std::string, FileState> &files_;
+
+public:
+  RecordingResolver(const std::string &baseDir,
+      std::map<std::string, FileState> &files) :
+    CcsFileImportResolver(baseDir), files_(files) {}
+
+  bool read(const std::string &path, std::string &contents) {
+    FileState state = readFile(path, &contents);
+    files_[canonical(path)] = state;
+    return state.exists;
+  }
+
+  virtual bool resolve(const std::string &location,
+      std::function<bool(std::istream &)> load) {
+    std::string contents;
+    if (!read(path(location), contents)) return false;
+    std::istringstream stream(contents);
+    return load(stream);
+  }
+};
+
+}
+
+std::string CcsFileImportResolver::path(const std::string &location) const {
+  if (!location.empty() && location[0] == '/') return location;
+  return baseDir + "/" + location;
+}
+
+bool CcsFileImportResolver::resolve(const std::string &location,
+    std::function<bool(std::istream &)> load) {
+  std::ifstream stream(path(location).c_str());
+  if (!stream) return false;
+  return load(stream);
+}
+
+class CcsFileWatcher::Impl {
+  std::shared_ptr<State> state;
+  std::chrono::milliseconds debounce;
+  std::atomic<uint64_t> skipped;
+#ifdef __linux__
+  int inotifyFd;
+  int wakeFd;
+  std::map<int, std::string> dirs; // by watch descriptor
+#else
+  std::mutex stopMutex;
+  std::condition_variable stopCond;
+  bool stopping;
+#endif
+  std::thread thread;
+
+  static CcsReloadableDomain::Loader loader(std::shared_ptr<State> state) {
+    return [state](CcsDomain &domain) {
+      std::map<std::string, FileState> files;
+      RecordingResolver resolver(dirName(state->fileName), files);
+      std::string contents;
+      bool found = resolver.read(state->fileName, contents);
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->files = files;
+      }
+      if (!found)
+        throw std::runtime_error("Couldn't read " + state->fileName);
+      std::istringstream stream(contents);
+      domain.loadCcsStream(stream, state->fileName, resolver, state->cache);
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->files = files;
+    };
+  }
+
+  std::map<std::string, FileState> files() const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->files;
+  }
+
+  bool changed() const {
+    auto files = this->files();
+    for (auto it = files.cbegin(); it != files.cend(); ++it)
+      if (readFile(it->first, nullptr) != it->second) return true;
+    return false;
+  }
+
+  void check(bool touched) {
+    if (!changed()) {
+      if (touched) skipped++;
+      return;
+    }
+    try {
+      domain.reload();
+    } catch (...) {
+      // the loader has already reported whatever went wrong, and the last
+      // good version stays published.
+    }
+  }
+
+#ifdef __linux__
+  // returns true if any new directories are being watched.
+  bool updateWatches() {
+    bool added = false;
+    std::set<std::string> wanted;
+    auto files = this->files();
+    for (auto it = files.cbegin(); it != files.cend(); ++it)
+      wanted.insert(dirName(it->first));
+    for (auto it = dirs.begin(); it != dirs.end();) {
+      if (wanted.erase(it->second)) {
+        ++it;
+      } else {
+        inotify_rm_watch(inotifyFd, it->first);
+        it = dirs.erase(it);
+      }
+    }
+    for (auto it = wanted.cbegin(); it != wanted.cend(); ++it) {
+      int wd = inotify_add_watch(inotifyFd, it->c_str(), IN_MODIFY
+          | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM
+          | IN_MOVED_TO);
+      if (wd >= 0) {
+        dirs[wd] = *it;
+        added = true;
+      }
+    }
+    return added;
+  }
+
+  // drain pending events, returning true if any of them concern a file
+  // that was loaded.
+  bool readEvents() {
+    auto files = this->files();
+    bool relevant = false;
+    alignas(inotify_event) char buf[4096];
+    while (true) {
+      ssize_t n = read(inotifyFd, buf, sizeof(buf));
+      if (n <= 0) break;
+      for (char *p = buf; p < buf + n;) {
+        auto *event = reinterpret_cast<inotify_event *>(p);
+        p += sizeof(inotify_event) + event->len;
+        if (event->mask & IN_Q_OVERFLOW) relevant = true;
+        if (event->mask & IN_IGNORED) dirs.erase(event->wd);
+        auto dir = dirs.find(event->wd);
+        if (!event->len || dir == dirs.end()) continue;
+        std::string path = dir->second == "/" ? "/" + std::string(event->name)
+            : dir->second + "/" + event->name;
+        if (files.count(path)) relevant = true;
+      }
+    }
+    return relevant;
+  }
+
+  void run() {
+    bool armed = false;
+    std::chrono::steady_clock::time_point deadline;
+    while (true) {
+      // anything could have changed between the load and the watch being
+      // added, so check once more in that case.
+      if (updateWatches()) check(false);
+      int timeout = -1;
+      if (armed) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        timeout = remaining < 0 ? 0 : static_cast<int>(remaining);
+      }
+      pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+      int n = poll(fds, 2, timeout);
+      if (n < 0 && errno != EINTR) return;
+      if (fds[1].revents) return;
+      if (n > 0 && (fds[0].revents & POLLIN)) {
+        if (readEvents()) {
+          // wait for things to settle down before checking...
+          armed = true;
+          deadline = std::chrono::steady_clock::now() + debounce;
+        }
+        continue;
+      }
+      if (armed && std::chrono::steady_clock::now() >= deadline) {
+        armed = false;
+        check(true);
+      }
+    }
+  }
+
+  void start() {
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotifyFd < 0 || wakeFd < 0) {
+      stop();
+      throw std::runtime_error("Couldn't initialize inotify");
+    }
+    // watch the initial files before returning, so that no change made
+    // after construction can be missed. a failed reload here is no
+    // different from one later on, but the fds mustn't leak if anything
+    // else goes wrong, since the destructor won't run.
+    try {
+      updateWatches();
+      check(false);
+      thread = std::thread([this] { run(); });
+    } catch (...) {
+      stop();
+      throw;
+    }
+  }
+
+  void stop() {
+    if (thread.joinable()) {
+      uint64_t one = 1;
+      if (write(wakeFd, &one, sizeof(one)) != sizeof(one)) {}
+      thread.join();
+    }
+    if (inotifyFd >= 0) close(inotifyFd);
+    if (wakeFd >= 0) close(wakeFd);
+  }
+#else
+  void run() {
+    std::unique_lock<std::mutex> lock(stopMutex);
+    while (!stopCond.wait_for(lock, debounce, [this] { return stopping; })) {
+      lock.unlock();
+      check(false);
+      lock.lock();
+    }
+  }
+
+  void start() {
+    stopping = false;
+    thread = std::thread([this] { run(); });
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(stopMutex);
+      stopping = true;
+      stopCond.notify_all();
+    }
+    if (thread.joinable()) thread.join();
+  }
+#endif
+
+public:
+  CcsReloadableDomain domain;
+
+  Impl(const std::string &fileName, std::shared_ptr<CcsTracer> tracer,
+      std::chrono::milliseconds debounce) :
+    state(std::make_shared<State>(fileName)), debounce(debounce), skipped(0),
+    domain(loader(state), std::move(tracer)) {
+    start();
+  }
+
+  ~Impl() { stop(); }
+
+  std::vector<std::string> fileNames() const {
+    std::vector<std::string> result;
+    auto files = this->files();
+    for (auto it = files.cbegin(); it != files.cend(); ++it)
+      result.push_back(it->first);
+    return result;
+  }
+
+  uint64_t skippedReloads() const { return skipped.load(); }
+};
+
+CcsFileWatcher::CcsFileWatcher(const std::string &fileName,
+    std::shared_ptr<CcsTracer> tracer, std::chrono::milliseconds debounce) :
+  impl(new Impl(fileName, std::move(tracer), debounce)) {}
+
+CcsFileWatcher::~CcsFileWatcher() {}
+
+CcsReloadableDomain &CcsFileWatcher::domain() {
+  return impl->domain;
+}
+
+std::vector<std::string> CcsFileWatcher::files() const {
+  return impl->fileNames();
+}
+
+uint64_t CcsFileWatcher::skippedReloads() const {
+  return impl->skippedReloads();
+}
+
+}
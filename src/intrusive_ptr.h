@@ -0,0 +1,48 @@
+#pragma once
+
+#include <utility>
+
+namespace ccs {
+
+/*
+ * a pointer to an object which counts its own references: T must provide
+ * retain() and a static release(T *), both const. unlike a shared_ptr, this
+ * needs no separately allocated control block, and is just one pointer wide.
+ */
+template <typename T>
+class IntrusivePtr {
+  template <typename U> friend class IntrusivePtr;
+  T *ptr_;
+
+public:
+  IntrusivePtr() : ptr_(nullptr) {}
+  explicit IntrusivePtr(T *ptr) : ptr_(ptr) { if (ptr_) ptr_->retain(); }
+  IntrusivePtr(const IntrusivePtr &that) : IntrusivePtr(that.ptr_) {}
+  template <typename U>
+  IntrusivePtr(const IntrusivePtr<U> &that) : IntrusivePtr(that.ptr_) {}
+  IntrusivePtr(IntrusivePtr &&that) noexcept : ptr_(that.ptr_)
+    { that.ptr_ = nullptr; }
+  template <typename U>
+  IntrusivePtr(IntrusivePtr<U> &&that) noexcept : ptr_(that.ptr_)
+    { that.ptr_ = nullptr; }
+  ~IntrusivePtr() { if (ptr_) T::release(ptr_); }
+
+  IntrusivePtr &operator=(IntrusivePtr that) noexcept {
+    std::swap(ptr_, that.ptr_);
+    return *this;
+  }
+
+  T *get() const { return ptr_; }
+  T &operator*() const { return *ptr_; }
+  T *operator->() const { return ptr_; }
+  explicit operator bool() const { return ptr_ != nullptr; }
+
+  // give up this pointer's reference without releasing it.
+  T *detach() {
+    T *ptr = ptr_;
+    ptr_ = nullptr;
+    return ptr;
+  }
+};
+
+}
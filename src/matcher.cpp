@@ -0,0 +1,178 @@
+#include "ccs/matcher.h"
+
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "ccs/context_template.h"
+#include "ccs/domain.h"
+#include "dag/dag_builder.h"
+#include "dag/key.h"
+#include "dag/node.h"
+#include "dag/tally.h"
+
+namespace ccs {
+
+namespace {
+
+template <typename T>
+void enqueueTallies(const Node &node, std::deque<const Node *> &queue) {
+  auto &tallies = node.tallies<T>();
+  for (auto it = tallies.cbegin(); it != tallies.cend(); ++it)
+    queue.push_back(&(*it)->node());
+}
+
+typedef std::unordered_map<std::string, std::unordered_set<std::string>>
+    ValuesByName;
+
+void addValues(const Key &key, ValuesByName &values) {
+  key.forEachName([&](const Key::String &name, const Key::Values &vals) {
+    auto it = values.find(std::string(name.data(), name.size()));
+    if (it == values.end()) return;
+    for (auto v = vals.cbegin(); v != vals.cend(); ++v)
+      it->second.insert(std::string(v->data(), v->size()));
+  });
+}
+
+// every value of each of the given names mentioned anywhere in the dag.
+ValuesByName mentionedValues(const Node &root,
+    const std::vector<std::string> &names) {
+  ValuesByName values;
+  for (auto it = names.cbegin(); it != names.cend(); ++it) values[*it];
+  std::unordered_set<const Node *> visited;
+  std::deque<const Node *> queue{&root};
+  while (!queue.empty()) {
+    const Node &node = *queue.front();
+    queue.pop_front();
+    if (!visited.insert(&node).second) continue;
+    addValues(node.allConstraints(), values);
+    auto &children = node.allChildren();
+    for (auto it = children.cbegin(); it != children.cend(); ++it) {
+      addValues(it->first, values);
+      queue.push_back(it->second.get());
+    }
+    enqueueTallies<AndTally>(node, queue);
+    enqueueTallies<OrTally>(node, queue);
+  }
+  return values;
+}
+
+}
+
+class CcsMatcher::Impl {
+  struct State {
+    CcsContext context;
+    std::unique_ptr<const CcsSnapshot> snapshot; // leaves only
+    // by value, or by the stand-in for values the rules don't mention
+    std::unordered_map<std::string, std::unique_ptr<State>> next;
+
+    explicit State(const CcsContext &context) : context(context) {}
+  };
+
+  std::vector<std::string> names_;
+  std::vector<const std::unordered_set<std::string> *> mentioned_;
+  std::vector<std::string> standIns_;
+  ValuesByName values_;
+  CcsContextTemplate template_;
+  // guards the tree, which only grows. matching takes a shared lock, and
+  // only takes an exclusive one to build a missing branch.
+  mutable std::shared_timed_mutex mutex_;
+  State root_;
+  size_t size_;
+
+  const std::string &branch(size_t step, const std::string &value) const {
+    return mentioned_[step]->count(value) ? value : standIns_[step];
+  }
+
+  const State *find(const std::vector<std::string> &values) const {
+    const State *state = &root_;
+    for (size_t i = 0; i < names_.size(); i++) {
+      auto it = state->next.find(branch(i, values[i]));
+      if (it == state->next.end()) return nullptr;
+      state = it->second.get();
+    }
+    return state;
+  }
+
+  const State *build(const std::vector<std::string> &values) {
+    State *state = &root_;
+    for (size_t i = 0; i < names_.size(); i++) {
+      const std::string &value = branch(i, values[i]);
+      auto &next = state->next[value];
+      if (!next) {
+        next.reset(new State(state->context.constrain(names_[i], {value})));
+        if (i + 1 == names_.size())
+          next->snapshot.reset(new CcsSnapshot(next->context.snapshot()));
+        size_++;
+      }
+      state = next.get();
+    }
+    return state;
+  }
+
+public:
+  Impl(const std::vector<std::string> &names, const CcsContext &root,
+      const Node &dagRoot, CcsContextTemplate tmpl) :
+    names_(names), values_(mentionedValues(dagRoot, names)),
+    template_(std::move(tmpl)), root_(root), size_(0) {
+    for (auto it = names_.cbegin(); it != names_.cend(); ++it) {
+      auto &mentioned = values_[*it];
+      mentioned_.push_back(&mentioned);
+      std::string standIn = "*";
+      while (mentioned.count(standIn)) standIn += '*';
+      standIns_.push_back(standIn);
+    }
+  }
+
+  const std::vector<std::string> &names() const { return names_; }
+
+  CcsSnapshot match(const std::vector<std::string> &values) {
+    if (values.size() != names_.size())
+      throw std::invalid_argument("matcher expects "
+          + std::to_string(names_.size()) + " values, got "
+          + std::to_string(values.size()));
+    {
+      std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+      if (const State *state = find(values)) return *state->snapshot;
+    }
+    std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+    return *build(values)->snapshot;
+  }
+
+  CcsContext context(const std::vector<std::string> &values) const {
+    return template_.build(values);
+  }
+
+  size_t size() const {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+    return size_;
+  }
+};
+
+CcsMatcher::CcsMatcher(std::shared_ptr<Impl> impl) : impl(std::move(impl)) {}
+
+const std::vector<std::string> &CcsMatcher::names() const {
+  return impl->names();
+}
+
+CcsSnapshot CcsMatcher::match(const std::vector<std::string> &values) const {
+  return impl->match(values);
+}
+
+CcsContext CcsMatcher::context(const std::vector<std::string> &values) const {
+  return impl->context(values);
+}
+
+size_t CcsMatcher::size() const {
+  return impl->size();
+}
+
+CcsMatcher CcsDomain::matcher(const std::vector<std::string> &names) {
+  return CcsMatcher(std::make_shared<CcsMatcher::Impl>(names, build(),
+      *dag->root(), contextTemplate(names)));
+}
+
+}
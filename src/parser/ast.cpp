@@ -1,18 +1,28 @@
 #include "parser/ast.h"
 
+#include <algorithm>
+#include <iterator>
+
 #include "ccs/domain.h"
+#include "dag/dag_builder.h"
 #include "dag/node.h"
 #include "parser/build_context.h"
+#include "parser/load_record.h"
 #include "parser/loader.h"
 
 namespace ccs { namespace ast {
 
-void Import::addTo(BuildContext::P buildContext, BuildContext::P baseContext) const
-  { ast.addTo(buildContext, baseContext); }
+void Import::addTo(BuildContext::P buildContext,
+    BuildContext::P baseContext) const {
+  // a tracked load records where each import went (see LoadRecord).
+  LoadRecord *record = buildContext->dag().recording();
+  if (record) record->import(*this, buildContext, baseContext);
+  else ast->addTo(buildContext, baseContext);
+}
 void PropDef::addTo(BuildContext::P buildContext, BuildContext::P) const
   { buildContext->addProperty(*this); }
 void Constraint::addTo(BuildContext::P buildContext, BuildContext::P) const
-  { buildContext->node().addConstraint(key_); }
+  { buildContext->addConstraint(key_); }
 
 bool PropDef::resolveImports(ImportResolver &, Loader &,
     std::vector<std::string> &)
@@ -33,8 +43,11 @@ bool Import::resolveImports(ImportResolver &importResolver, Loader &loader,
     inProgress.push_back(location);
     result = importResolver.resolve(location,
         [&](std::istream &stream) {
-      return loader.parseCcsStream(stream, location,
-          importResolver, inProgress, ast);
+      auto parsed = loader.parseCcsStream(stream, location,
+          importResolver, inProgress);
+      if (!parsed) return false;
+      ast = std::move(parsed);
+      return true;
     });
     inProgress.pop_back();
     if (!result) {
@@ -65,57 +78,168 @@ bool Nested::resolveImports(ImportResolver &importResolver, Loader &loader,
 }
 
 
-struct Wrap : public SelectorLeaf {
-  std::vector<SelectorBranch::P> branches;
-  SelectorLeaf::P right;
+namespace {
 
-  Wrap(SelectorBranch::P branch, SelectorLeaf::P leaf) : right(leaf)
-    { branches.push_back(branch); }
+enum Kind { STEP, DESCENDANT, CONJUNCTION, DISJUNCTION };
 
-  // left == this, always. guess we could just use enable_shared_from_this,
-  // but that's just as ugly... spirit just doesn't like this way of doing
-  // things... it works fine, though, and i don't want to invest a lot of
-  // time in switching to some kind of value-types-in-a-variant design just
-  // to play nicer with spirit. it's also worth something to stay roughly
-  // in sync with the java version. anyway, maybe reconsider down the road.
-  virtual P descendant(P left, P right)
-    { push(SelectorBranch::descendant(this->right), right); return left; }
-  virtual P conjunction(P left, P right)
-    { push(SelectorBranch::conjunction(this->right), right); return left; }
-  virtual P disjunction(P left, P right)
-    { push(SelectorBranch::disjunction(this->right), right); return left; }
+// the shape of a selector as written, which decides whether the two sides
+// of a join are the same node, as far as the dag builder is concerned: the
+// same step, or the same join of the same nodes, in either order.
+struct Shape {
+  typedef std::shared_ptr<const Shape> P;
+  Kind kind;
+  Key key;
+  P first;
+  P second;
 
-  void push(SelectorBranch::P newBranch, SelectorLeaf::P newRight) {
-    branches.push_back(newBranch);
-    right = newRight;
-  }
+  Shape(Kind kind, const Key &key, P first, P second) :
+    kind(kind), key(key), first(std::move(first)),
+    second(std::move(second)) {}
 
-  virtual Node &traverse(BuildContext::P context) {
-    BuildContext::P tmp = context;
-    for (auto it = branches.begin(); it != branches.end(); ++it)
-      tmp = (*it)->traverse(tmp, context);
-    return tmp->traverse(*right);
+  bool same(const Shape &that) const {
+    if (this == &that) return true;
+    if (kind != that.kind) return false;
+    switch (kind) {
+    case STEP: return key == that.key;
+    case DESCENDANT:
+      return first->same(*that.first) && second->same(*that.second);
+    default:
+      return (first->same(*that.first) && second->same(*that.second))
+          || (first->same(*that.second) && second->same(*that.first));
+    }
   }
 };
 
-struct Step : public SelectorLeaf {
-  Key key_;
+/*
+ * a selector in normal form. conjunctions and disjunctions are flattened
+ * and their legs sorted, so that equivalent selectors, however they're
+ * written, build the same nodes. a disjunction's duplicate legs are dropped,
+ * and legs common to every conjunction in a disjunction are factored out:
+ * "a c, b c" becomes "(a, b) c". a conjunction keeps every leg, though, as
+ * each counts towards its specificity, except that joining a node to itself
+ * yields the node, just as the dag builder has always done.
+ */
+struct Selector : public SelectorLeaf {
+  typedef std::shared_ptr<Selector> S;
+  Kind kind_;
+  Key key_; // steps only
+  std::vector<S> legs_; // in order for a descendant, sorted for a join
+  Shape::P shape_;
 
-  Step(const Key &key) : key_(key) {}
+  Selector(Kind kind, const Key &key, std::vector<S> legs, Shape::P shape) :
+    kind_(kind), key_(key), legs_(std::move(legs)), shape_(std::move(shape)) {}
+
+  static int compare(const Selector &a, const Selector &b) {
+    if (a.kind_ != b.kind_) return a.kind_ < b.kind_ ? -1 : 1;
+    if (a.kind_ == STEP)
+      return a.key_ < b.key_ ? -1 : b.key_ < a.key_ ? 1 : 0;
+    for (size_t i = 0; i < a.legs_.size() && i < b.legs_.size(); i++)
+      if (int result = compare(*a.legs_[i], *b.legs_[i])) return result;
+    return a.legs_.size() < b.legs_.size() ? -1
+        : b.legs_.size() < a.legs_.size() ? 1 : 0;
+  }
+
+  static bool less(const S &a, const S &b) { return compare(*a, *b) < 0; }
+  static bool equal(const S &a, const S &b) { return compare(*a, *b) == 0; }
+
+  // the same selector, but shaped as written elsewhere.
+  static S reshape(const S &selector, Shape::P shape) {
+    return std::make_shared<Selector>(selector->kind_, selector->key_,
+        selector->legs_, std::move(shape));
+  }
+
+  static void flatten(Kind kind, const S &selector, std::vector<S> &legs) {
+    if (selector->kind_ == kind)
+      legs.insert(legs.end(), selector->legs_.begin(), selector->legs_.end());
+    else
+      legs.push_back(selector);
+  }
+
+  static S join(Kind kind, std::vector<S> legs, Shape::P shape) {
+    std::sort(legs.begin(), legs.end(), less);
+    if (kind == DISJUNCTION) {
+      legs.erase(std::unique(legs.begin(), legs.end(), equal), legs.end());
+      if (S factored = factor(legs, shape)) return factored;
+    }
+    if (legs.size() == 1) return reshape(legs[0], std::move(shape));
+    return std::make_shared<Selector>(kind, Key(), std::move(legs),
+        std::move(shape));
+  }
+
+  // the legs common to every conjunction in a disjunction, conjoined with
+  // the disjunction of what's left of each. none, unless every leg is a
+  // conjunction, and none is left empty.
+  static S factor(const std::vector<S> &legs, const Shape::P &shape) {
+    if (legs.size() < 2) return nullptr;
+    for (auto it = legs.cbegin(); it != legs.cend(); ++it)
+      if ((*it)->kind_ != CONJUNCTION) return nullptr;
+    std::vector<S> common = legs[0]->legs_;
+    for (auto it = legs.cbegin() + 1; it != legs.cend(); ++it) {
+      std::vector<S> next;
+      std::set_intersection(common.begin(), common.end(),
+          (*it)->legs_.begin(), (*it)->legs_.end(), std::back_inserter(next),
+          less);
+      common.swap(next);
+    }
+    if (common.empty()) return nullptr;
+    std::vector<S> rests;
+    for (auto it = legs.cbegin(); it != legs.cend(); ++it) {
+      std::vector<S> rest;
+      std::set_difference((*it)->legs_.begin(), (*it)->legs_.end(),
+          common.begin(), common.end(), std::back_inserter(rest), less);
+      if (rest.empty()) return nullptr;
+      rests.push_back(rest.size() == 1 ? rest[0] : std::make_shared<Selector>(
+          CONJUNCTION, Key(), std::move(rest), shape));
+    }
+    flatten(CONJUNCTION, join(DISJUNCTION, std::move(rests), shape), common);
+    return join(CONJUNCTION, std::move(common), shape);
+  }
+
+  static S combine(Kind kind, P left, P right) {
+    S l = std::static_pointer_cast<Selector>(left);
+    S r = std::static_pointer_cast<Selector>(right);
+    if (kind != DESCENDANT && l->shape_->same(*r->shape_)) return l;
+    auto shape = std::make_shared<Shape>(kind, Key(), l->shape_, r->shape_);
+    if (kind == DESCENDANT)
+      return std::make_shared<Selector>(kind, Key(), std::vector<S>{l, r},
+          std::move(shape));
+    std::vector<S> legs;
+    flatten(kind, l, legs);
+    flatten(kind, r, legs);
+    return join(kind, std::move(legs), std::move(shape));
+  }
 
   virtual P descendant(P left, P right)
-    { return std::make_shared<Wrap>(SelectorBranch::descendant(left), right); }
+    { return combine(DESCENDANT, left, right); }
   virtual P conjunction(P left, P right)
-    { return std::make_shared<Wrap>(SelectorBranch::conjunction(left), right); }
+    { return combine(CONJUNCTION, left, right); }
   virtual P disjunction(P left, P right)
-    { return std::make_shared<Wrap>(SelectorBranch::disjunction(left), right); }
+    { return combine(DISJUNCTION, left, right); }
 
-  virtual Node &traverse(BuildContext::P context)
-    { return context->node().addChild(key_); }
+  virtual Node &traverse(BuildContext::P context) {
+    switch (kind_) {
+    case STEP:
+      return context->node().addChild(key_);
+    case DESCENDANT:
+      return context->descendant(legs_[0]->traverse(context))
+          ->traverse(*legs_[1]);
+    default:
+      Node *node = &legs_[0]->traverse(context);
+      for (auto it = legs_.begin() + 1; it != legs_.end(); ++it) {
+        Node &leg = (*it)->traverse(context);
+        node = kind_ == CONJUNCTION ? &context->conjoin(*node, leg)
+            : &context->disjoin(*node, leg);
+      }
+      return *node;
+    }
+  }
 };
 
+}
+
 SelectorLeaf::P SelectorLeaf::step(const Key &key) {
-  return std::make_shared<Step>(key);
+  return std::make_shared<Selector>(STEP, key, std::vector<Selector::S>(),
+      std::make_shared<Shape>(STEP, key, nullptr, nullptr));
 }
 
 class BranchImpl : public SelectorBranch {
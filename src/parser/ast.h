@@ -87,7 +87,9 @@ struct Nested : AstRule {
 
 struct Import : AstRule {
   std::string location;
-  Nested ast;
+  // shared, since a parsed file may be cached and reused across loads. see
+  // ParseCache.
+  std::shared_ptr<Nested> ast;
 
   explicit Import(const std::string &location) : location(location) {}
   void addTo(std::shared_ptr<BuildContext> buildContext,
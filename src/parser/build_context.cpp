@@ -1,12 +1,10 @@
 #include "parser/build_context.h"
 
-#include <algorithm>
-#include <set>
-
 #include "dag/dag_builder.h"
 #include "dag/node.h"
 #include "dag/tally.h"
 #include "parser/ast.h"
+#include "parser/load_record.h"
 
 namespace ccs {
 
@@ -44,25 +42,7 @@ public:
     // we've arrived at the same node by two different paths. no tally is
     // actually needed here...
     if (&firstNode_ == &secondNode) return firstNode_;
-
-    std::set<std::shared_ptr<Tally>> tallies;
-
-    std::set_intersection(
-        firstNode_.tallies<T>().begin(), firstNode_.tallies<T>().end(),
-        secondNode.tallies<T>().begin(), secondNode.tallies<T>().end(),
-        std::inserter(tallies, tallies.end()));
-
-    // result will be either empty or have exactly one entry.
-
-    if (tallies.empty()) {
-      std::shared_ptr<T> tally = std::make_shared<T>(firstNode_,
-          secondNode);
-      firstNode_.addTally(tally);
-      secondNode.addTally(tally);
-      return tally->node();
-    } else {
-      return (*tallies.begin())->node();
-    }
+    return dag_.tally<T>(firstNode_, secondNode);
   }
 };
 
@@ -79,11 +59,26 @@ BuildContext::P BuildContext::disjunction(Node &node,
   { return std::make_shared<TallyBuildContext<OrTally>>(dag_, node,
       baseContext); }
 
+Node &BuildContext::conjoin(Node &first, Node &second)
+  { return dag_.tally<AndTally>(first, second); }
+Node &BuildContext::disjoin(Node &first, Node &second)
+  { return &first == &second ? first : dag_.tally<OrTally>(first, second); }
+
 void BuildContext::addProperty(const ast::PropDef &propDef) {
   Value value(propDef.value_);
   value.setName(propDef.name_);
-  node().addProperty(propDef.name_, Property(value,
-      propDef.origin_, dag_.nextProperty(), propDef.override_));
+  Node &node = this->node();
+  const Property &property = node.addProperty(propDef.name_, Property(value,
+      propDef.origin_, dag_.nextProperty(), dag_.internProperty(propDef.name_),
+      propDef.override_));
+  dag_.addDefinition(node, property);
+  if (LoadRecord *record = dag_.recording()) record->property(node, property);
+}
+
+void BuildContext::addConstraint(const Key &key) {
+  Node &node = this->node();
+  if (LoadRecord *record = dag_.recording()) record->constraint(node, key);
+  node.addConstraint(key);
 }
 
 }
@@ -7,6 +7,7 @@
 namespace ccs {
 
 class DagBuilder;
+class Key;
 class Node;
 namespace ast { class PropDef; }
 namespace ast { class SelectorLeaf; }
@@ -21,6 +22,7 @@ public:
   typedef std::shared_ptr<BuildContext> P;
   virtual ~BuildContext() {}
 
+  DagBuilder &dag() const { return dag_; }
   virtual Node &node() = 0;
   virtual Node &traverse(ast::SelectorLeaf &selector) = 0;
 
@@ -28,7 +30,13 @@ public:
   BuildContext::P descendant(Node &node);
   BuildContext::P conjunction(Node &node, BuildContext::P baseContext);
   BuildContext::P disjunction(Node &node, BuildContext::P baseContext);
+  // the node of the conjunction or disjunction of two nodes. unlike
+  // conjunction(), a node conjoined with itself gets a tally of its own,
+  // counting its specificity twice.
+  Node &conjoin(Node &first, Node &second);
+  Node &disjoin(Node &first, Node &second);
   void addProperty(const ast::PropDef &propDef);
+  void addConstraint(const Key &key);
 };
 
 }
@@ -0,0 +1,352 @@
+#include "parser/load_record.h"
+
+#include <algorithm>
+#include <set>
+
+#include "dag/dag_builder.h"
+#include "dag/dag_diff.h"
+#include "dag/node.h"
+#include "dag/property.h"
+#include "dag/tally.h"
+#include "parser/ast.h"
+
+namespace ccs {
+
+namespace {
+
+// tracked files leave this much room between their property numbers.
+const unsigned Stride = 8;
+
+// the number of properties and imports in some rules, counting everything
+// they import, which is how many property numbers lowering them will take
+// (at one apiece).
+size_t countRules(const ast::Nested &nested) {
+  size_t count = 0;
+  for (auto it = nested.rules_.cbegin(); it != nested.rules_.cend(); ++it) {
+    const ast::AstRule *rule = it->get();
+    if (auto *inner = dynamic_cast<const ast::Nested *>(rule))
+      count += countRules(*inner);
+    else if (auto *import = dynamic_cast<const ast::Import *>(rule))
+      count += 1 + countRules(*import->ast);
+    else if (dynamic_cast<const ast::PropDef *>(rule))
+      count++;
+  }
+  return count;
+}
+
+}
+
+struct LoadRecord::Site {
+  std::string location;
+  std::shared_ptr<const ast::Nested> ast;
+  // the import of this file in its parent's rules, or null for a root
+  const ast::Import *import;
+  BuildContext::P buildContext;
+  BuildContext::P baseContext;
+  // the property numbers set aside for this file and its imports
+  unsigned first;
+  unsigned end;
+  std::vector<std::pair<Node *, const Property *>> properties;
+  std::vector<Node *> constrained;
+  std::vector<std::unique_ptr<Site>> imports;
+
+  Site(const std::string &location, std::shared_ptr<const ast::Nested> ast,
+      const ast::Import *import, BuildContext::P buildContext,
+      BuildContext::P baseContext) :
+    location(location), ast(std::move(ast)), import(import),
+    buildContext(std::move(buildContext)),
+    baseContext(std::move(baseContext)), first(0), end(0) {}
+};
+
+struct LoadRecord::Changes {
+  // nodes which lost something, and may now be empty
+  std::unordered_set<Node *> touched;
+  // the name ids of properties removed or added
+  std::set<unsigned> names;
+};
+
+LoadRecord::LoadRecord(DagBuilder &dag) :
+  dag_(dag), current_(nullptr), cursor_(0), reloading_(false),
+  failed_(false), constraintsChanged_(false) {}
+
+LoadRecord::~LoadRecord() {}
+
+void LoadRecord::anchor(const Site &site) {
+  anchors_[&site.buildContext->node()]++;
+  anchors_[&site.baseContext->node()]++;
+}
+
+void LoadRecord::unanchor(const Site &site, Changes &changes) {
+  Node *nodes[] = {&site.buildContext->node(), &site.baseContext->node()};
+  for (Node *node : nodes) {
+    auto it = anchors_.find(node);
+    if (!--it->second) anchors_.erase(it);
+    changes.touched.insert(node);
+  }
+}
+
+void LoadRecord::lower(Site &site) {
+  Site *outer = current_;
+  current_ = &site;
+  site.first = dag_.nextProperty_;
+  anchor(site);
+  // a file which failed to load still takes its place, with nothing in it.
+  if (site.ast) site.ast->addTo(site.buildContext, site.baseContext);
+  dag_.nextProperty_ += dag_.propertyStride_;
+  site.end = dag_.nextProperty_;
+  current_ = outer;
+}
+
+void LoadRecord::property(Node &node, const Property &property) {
+  current_->properties.emplace_back(&node, &property);
+  if (reloading_) changed_.insert(property.nameId());
+}
+
+void LoadRecord::constraint(Node &node, const Key &key) {
+  if (reloading_) constraintsChanged_ = true;
+  auto &contributions = constraints_[&node];
+  if (contributions.empty() || contributions.back().first != current_)
+    current_->constrained.push_back(&node);
+  contributions.emplace_back(current_, key);
+}
+
+void LoadRecord::import(const ast::Import &import,
+    BuildContext::P buildContext, BuildContext::P baseContext) {
+  current_->imports.emplace_back(new Site(import.location, import.ast,
+      &import, std::move(buildContext), std::move(baseContext)));
+  lower(*current_->imports.back());
+}
+
+void LoadRecord::load(const std::string &fileName,
+    const std::shared_ptr<ast::Nested> &ast) {
+  if (reloading_ && cursor_ < roots_.size()) {
+    // files no longer loaded before this one are dropped. if this file
+    // wasn't loaded last time at all, nor are any of the rest for now: this
+    // one has to go after them, and any loaded again will be added afresh
+    // after it.
+    size_t match = cursor_;
+    while (match < roots_.size() && roots_[match]->location != fileName)
+      match++;
+    drop(cursor_, match);
+  }
+  if (reloading_ && cursor_ < roots_.size()) {
+    Site &root = *roots_[cursor_++];
+    if (!ast) return;
+    dag_.recording_ = this;
+    update(root, ast);
+    dag_.recording_ = nullptr;
+    return;
+  }
+  // a new file goes after everything else, as it would in a fresh load.
+  roots_.emplace_back(new Site(fileName, ast, nullptr, dag_.buildContext_,
+      dag_.buildContext_));
+  if (reloading_) cursor_++;
+  dag_.recording_ = this;
+  dag_.propertyStride_ = Stride;
+  lower(*roots_.back());
+  dag_.propertyStride_ = 1;
+  dag_.recording_ = nullptr;
+}
+
+void LoadRecord::update(Site &site, const std::shared_ptr<ast::Nested> &ast) {
+  if (site.ast != ast) {
+    replace(site, ast);
+    return;
+  }
+  // the same rules, whose imports have been resolved again, each perhaps to
+  // new rules of its own.
+  for (auto it = site.imports.begin(); it != site.imports.end(); ++it)
+    update(**it, (*it)->import->ast);
+}
+
+void LoadRecord::replace(Site &site,
+    const std::shared_ptr<ast::Nested> &ast) {
+  // room for every property and import, and for the file itself.
+  unsigned stride = (site.end - site.first) / (countRules(*ast) + 1);
+  if (!stride) {
+    failed_ = true;
+    return;
+  }
+
+  Changes changes;
+  remove(site, changes);
+  site.ast = ast;
+  unsigned next = dag_.nextProperty_;
+  unsigned end = site.end;
+  dag_.nextProperty_ = site.first;
+  dag_.propertyStride_ = stride;
+  Site *outer = current_;
+  current_ = &site;
+  site.ast->addTo(site.buildContext, site.baseContext);
+  current_ = outer;
+  dag_.propertyStride_ = 1;
+  dag_.nextProperty_ = next;
+  site.end = end;
+
+  added(site, changes);
+  fixDefinitions(changes);
+  prune(changes.touched);
+}
+
+void LoadRecord::remove(Site &site, Changes &changes) {
+  // drop the site's definitions first, while its properties still exist:
+  // once freed, a property's address may be handed straight to a new one.
+  std::unordered_set<const Property *> removed;
+  std::set<unsigned> names;
+  for (auto it = site.properties.cbegin(); it != site.properties.cend();
+      ++it) {
+    removed.insert(it->second);
+    names.insert(it->second->nameId());
+  }
+  for (auto id = names.cbegin(); id != names.cend(); ++id) {
+    auto &defs = dag_.definitions_[*id];
+    defs.erase(std::remove_if(defs.begin(), defs.end(),
+        [&](const std::pair<const Node *, const Property *> &def) {
+      return removed.count(def.second) != 0;
+    }), defs.end());
+  }
+
+  for (auto it = site.properties.cbegin(); it != site.properties.cend();
+      ++it) {
+    Node &node = *it->first;
+    const Property *property = it->second;
+    changes.names.insert(property->nameId());
+    changed_.insert(property->nameId());
+    changes.touched.insert(&node);
+    auto range = node.props.equal_range(
+        dag_.root_->propertyNames().name(property->nameId()));
+    for (auto p = range.first; p != range.second; ++p) {
+      if (&p->second == property) {
+        node.props.erase(p);
+        break;
+      }
+    }
+  }
+  site.properties.clear();
+
+  if (!site.constrained.empty()) constraintsChanged_ = true;
+  for (auto it = site.constrained.cbegin(); it != site.constrained.cend();
+      ++it) {
+    Node &node = **it;
+    auto contributions = constraints_.find(&node);
+    auto &list = contributions->second;
+    list.erase(std::remove_if(list.begin(), list.end(),
+        [&](const std::pair<const Site *, Key> &c) {
+      return c.first == &site;
+    }), list.end());
+    node.constraints = Key();
+    for (auto c = list.cbegin(); c != list.cend(); ++c)
+      node.constraints.addAll(c->second);
+    if (list.empty()) constraints_.erase(contributions);
+    changes.touched.insert(&node);
+  }
+  site.constrained.clear();
+
+  for (auto it = site.imports.begin(); it != site.imports.end(); ++it) {
+    remove(**it, changes);
+    unanchor(**it, changes);
+  }
+  site.imports.clear();
+}
+
+void LoadRecord::added(const Site &site, Changes &changes) const {
+  for (auto it = site.properties.cbegin(); it != site.properties.cend();
+      ++it)
+    changes.names.insert(it->second->nameId());
+  for (auto it = site.imports.cbegin(); it != site.imports.cend(); ++it)
+    added(**it, changes);
+}
+
+void LoadRecord::fixDefinitions(const Changes &changes) {
+  auto &definitions = dag_.definitions_;
+  for (auto id = changes.names.cbegin(); id != changes.names.cend(); ++id) {
+    auto &defs = definitions[*id];
+    // remove() already dropped the old definitions. the new ones were added
+    // at the end, but belong in load order, which is property number order.
+    std::sort(defs.begin(), defs.end(),
+        [](const std::pair<const Node *, const Property *> &l,
+            const std::pair<const Node *, const Property *> &r) {
+      return l.second->propertyNumber() < r.second->propertyNumber();
+    });
+  }
+}
+
+void LoadRecord::prune(std::unordered_set<Node *> &pending) {
+  // only the node being looked at is ever freed, since it has no children
+  // or tallies of its own by then, so the rest of pending stays valid.
+  while (!pending.empty()) {
+    Node *node = *pending.begin();
+    pending.erase(pending.begin());
+    if (node == dag_.root_.get() || anchors_.count(node)
+        || constraints_.count(node))
+      continue;
+    if (!node->props.empty() || !node->constraints.empty()
+        || !node->children.empty() || !node->andTallies_.empty()
+        || !node->orTallies_.empty())
+      continue;
+
+    if (node->parent_) {
+      Node *parent = const_cast<Node *>(node->parent_);
+      parent->children.erase(parent->children.find(*node->key_));
+      pending.insert(parent);
+    } else if (node->tally_) {
+      Tally *tally = const_cast<Tally *>(node->tally_);
+      Node &first = tally->firstLeg();
+      Node &second = tally->secondLeg();
+      pending.insert(&first);
+      pending.insert(&second);
+      if (auto *conjunction = dynamic_cast<AndTally *>(tally)) {
+        dag_.tallies_.erase(DagBuilder::TallyKey(first, second, true));
+        // not owned, just for finding it in the legs' sets.
+        std::shared_ptr<AndTally> key(std::shared_ptr<AndTally>(),
+            conjunction);
+        first.andTallies_.erase(key);
+        second.andTallies_.erase(key);
+      } else {
+        auto *disjunction = static_cast<OrTally *>(tally);
+        dag_.tallies_.erase(DagBuilder::TallyKey(first, second, false));
+        std::shared_ptr<OrTally> key(std::shared_ptr<OrTally>(), disjunction);
+        first.orTallies_.erase(key);
+        second.orTallies_.erase(key);
+      }
+    }
+  }
+}
+
+void LoadRecord::beginReload() {
+  reloading_ = true;
+  failed_ = false;
+  cursor_ = 0;
+  changed_.clear();
+  constraintsChanged_ = false;
+}
+
+void LoadRecord::drop(size_t from, size_t to) {
+  if (from == to) return;
+  Changes changes;
+  for (size_t i = from; i < to; i++) {
+    remove(*roots_[i], changes);
+    unanchor(*roots_[i], changes);
+  }
+  roots_.erase(roots_.begin() + from, roots_.begin() + to);
+  fixDefinitions(changes);
+  prune(changes.touched);
+}
+
+bool LoadRecord::changes(DagDiff &diff) const {
+  if (constraintsChanged_) return false;
+  auto &names = dag_.root_->propertyNames();
+  for (auto it = changed_.cbegin(); it != changed_.cend(); ++it)
+    diff.names.insert(names.name(*it));
+  return true;
+}
+
+bool LoadRecord::endReload() {
+  reloading_ = false;
+  if (failed_) return false;
+  // files no longer loaded at all
+  drop(cursor_, roots_.size());
+  return true;
+}
+
+}
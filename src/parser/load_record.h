@@ -0,0 +1,104 @@
+#pragma once
+
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "dag/key.h"
+#include "parser/build_context.h"
+
+namespace ccs {
+
+class DagBuilder;
+struct DagDiff;
+class Node;
+class Property;
+namespace ast { struct Import; struct Nested; }
+
+/*
+ * what each file loaded through a parse cache contributed to a dag: the
+ * properties and constraints from its own rules, and where each of its
+ * imports was lowered. with this, a dag can be brought up to date with new
+ * versions of the same files by replacing just the rules of the files that
+ * changed, rather than building it again from scratch.
+ *
+ * the files loaded are matched up with those loaded last time by name, in
+ * order. a file is unchanged if the cache handed back the very same parsed
+ * rules for it. if a file changed, its rules and those of everything it
+ * imports are removed and lowered afresh, in the same place. nodes left with
+ * nothing in them are pruned. the rules of unchanged files are left alone,
+ * though their imports are each checked in turn.
+ *
+ * property numbers decide which of two equally specific settings wins, so
+ * new rules must be numbered as a fresh load would. tracked files are
+ * numbered sparsely, with room to spare after each file, and a changed
+ * file's rules are renumbered within the range its old ones had. if they
+ * don't fit, the reload fails, and the dag has to be built from scratch. a
+ * file not loaded last time goes after all the rest, so any that were
+ * loaded after it last time are dropped and added afresh after it.
+ *
+ * updating a dag in place frees whatever was removed, so it's only safe once
+ * nothing refers to the dag any longer (see DagBuilder::referenced()).
+ */
+class LoadRecord {
+  struct Site;
+  struct Changes;
+
+  DagBuilder &dag_;
+  std::vector<std::unique_ptr<Site>> roots_;
+  // the site whose rules are being lowered, if any
+  Site *current_;
+  // while reloading, the next root to be matched up with a loaded file
+  size_t cursor_;
+  bool reloading_;
+  bool failed_;
+  // the name ids of properties added or removed since beginReload(), and
+  // whether any constraints were.
+  std::set<unsigned> changed_;
+  bool constraintsChanged_;
+  // the constraints each site added to each node. a node's constraints are
+  // the union of these, so they're rebuilt from what's left when a site
+  // goes away.
+  std::unordered_map<Node *, std::vector<std::pair<const Site *, Key>>>
+    constraints_;
+  // nodes which some site's build contexts refer to, with how many such
+  // references there are. these are never pruned.
+  std::unordered_map<const Node *, unsigned> anchors_;
+
+  void lower(Site &site);
+  void update(Site &site, const std::shared_ptr<ast::Nested> &ast);
+  void replace(Site &site, const std::shared_ptr<ast::Nested> &ast);
+  void remove(Site &site, Changes &changes);
+  void anchor(const Site &site);
+  void unanchor(const Site &site, Changes &changes);
+  void added(const Site &site, Changes &changes) const;
+  // remove the roots in [from, to), and everything they contributed.
+  void drop(size_t from, size_t to);
+  void fixDefinitions(const Changes &changes);
+  void prune(std::unordered_set<Node *> &pending);
+
+public:
+  explicit LoadRecord(DagBuilder &dag);
+  ~LoadRecord();
+  LoadRecord(const LoadRecord &) = delete;
+  LoadRecord &operator=(const LoadRecord &) = delete;
+
+  // see DagBuilder::loadTracked() and friends.
+  void load(const std::string &fileName,
+      const std::shared_ptr<ast::Nested> &ast);
+  void beginReload();
+  bool endReload();
+  bool changes(DagDiff &diff) const;
+
+  // called as the rules of the current site are lowered.
+  void property(Node &node, const Property &property);
+  void constraint(Node &node, const Key &key);
+  void import(const ast::Import &import, BuildContext::P buildContext,
+      BuildContext::P baseContext);
+};
+
+}
@@ -1,9 +1,13 @@
 #pragma once
 
 #include <istream>
+#include <iterator>
+#include <memory>
+#include <sstream>
 #include <string>
 
 #include "parser/ast.h"
+#include "parser/parse_cache.h"
 #include "parser/parser.h"
 #include "dag/dag_builder.h"
 
@@ -11,30 +15,68 @@ namespace ccs {
 
 class Loader {
   CcsTracer &trace;
+  ParseCache *cache;
 
 public:
-  Loader(CcsTracer &trace) : trace(trace) {}
+  Loader(CcsTracer &trace, ParseCache *cache = nullptr) :
+    trace(trace), cache(cache) {}
 
   CcsTracer &tracer() { return trace; }
 
-  void loadCcsStream(std::istream &stream, const std::string &fileName,
+  bool loadCcsStream(std::istream &stream, const std::string &fileName,
       DagBuilder &dag, ImportResolver &importResolver) {
-    ast::Nested ast;
     std::vector<std::string> inProgress;
-    if (parseCcsStream(stream, fileName, importResolver, inProgress, ast)) {
+    auto ast = parseCcsStream(stream, fileName, importResolver, inProgress);
+    if (cache) {
+      // the dag keeps track of what each cached file contributed, so that
+      // it can be updated in place later. it needs to hear about failures
+      // too, to keep the files in order.
+      dag.loadTracked(fileName, ast);
+      return ast != nullptr;
+    }
+    if (ast) {
       // everything parsed, no errors. now it's safe to modify the dag...
-      ast.addTo(dag.buildContext(), dag.buildContext());
+      ast->addTo(dag.buildContext(), dag.buildContext());
+      return true;
     }
     // otherwise, errors already reported, don't modify the dag...
+    return false;
+  }
+
+  // returns null on failure, having already reported the error.
+  std::shared_ptr<ast::Nested> parseCcsStream(std::istream &stream,
+      const std::string &fileName, ImportResolver &importResolver,
+      std::vector<std::string> &inProgress) {
+    std::shared_ptr<ast::Nested> ast;
+    uint64_t fingerprint = 0;
+    if (cache) {
+      std::string contents((std::istreambuf_iterator<char>(stream)),
+          std::istreambuf_iterator<char>());
+      fingerprint = ParseCache::fingerprint(contents);
+      ast = cache->find(fileName, fingerprint);
+      if (ast) {
+        cache->reuses++;
+      } else {
+        cache->parses++;
+        std::istringstream input(contents);
+        ast = parse(input, fileName);
+      }
+    } else {
+      ast = parse(stream, fileName);
+    }
+    if (!ast) return nullptr;
+    if (!ast->resolveImports(importResolver, *this, inProgress)) return nullptr;
+    if (cache) cache->store(fileName, fingerprint, ast);
+    return ast;
   }
 
-  bool parseCcsStream(std::istream &stream, const std::string &fileName,
-      ImportResolver &importResolver, std::vector<std::string> &inProgress,
-      ast::Nested &ast) {
+private:
+  std::shared_ptr<ast::Nested> parse(std::istream &stream,
+      const std::string &fileName) {
+    auto ast = std::make_shared<ast::Nested>();
     Parser parser(trace);
-    if (!parser.parseCcsStream(fileName, stream, ast)) return false;
-    if (!ast.resolveImports(importResolver, *this, inProgress)) return false;
-    return true;
+    if (!parser.parseCcsStream(fileName, stream, *ast)) return nullptr;
+    return ast;
   }
 };
 
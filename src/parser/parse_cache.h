@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "parser/ast.h"
+
+namespace ccs {
+
+/*
+ * parsed (but not yet lowered) rules, per file, along with a fingerprint of
+ * the contents they were parsed from. an entry is only reused if the file's
+ * contents are unchanged. the imports within a reused entry are still
+ * resolved and checked afresh, each against its own entry, so a change to a
+ * file deep in the import tree only re-parses that one file.
+ *
+ * lowering an ast into the dag doesn't modify it, so entries may be shared by
+ * any number of domains. the cache is locked for the duration of each load.
+ */
+class ParseCache {
+  struct Entry {
+    uint64_t fingerprint;
+    std::shared_ptr<ast::Nested> ast;
+  };
+
+  std::unordered_map<std::string, Entry> entries_;
+
+public:
+  std::mutex mutex;
+  size_t parses;
+  size_t reuses;
+
+  ParseCache() : parses(0), reuses(0) {}
+
+  // 64-bit fnv-1a. this is only ever compared against the previous contents
+  // of the same file, so collisions aren't a practical concern.
+  static uint64_t fingerprint(const std::string &contents) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (auto it = contents.cbegin(); it != contents.cend(); ++it) {
+      hash ^= static_cast<unsigned char>(*it);
+      hash *= 0x100000001b3ull;
+    }
+    return hash;
+  }
+
+  std::shared_ptr<ast::Nested> find(const std::string &fileName,
+      uint64_t fingerprint) const {
+    auto it = entries_.find(fileName);
+    if (it == entries_.end() || it->second.fingerprint != fingerprint)
+      return nullptr;
+    return it->second.ast;
+  }
+
+  void store(const std::string &fileName, uint64_t fingerprint,
+      std::shared_ptr<ast::Nested> ast) {
+    entries_[fileName] = Entry{fingerprint, std::move(ast)};
+  }
+
+  size_t size() const { return entries_.size(); }
+  void clear() { entries_.clear(); }
+};
+
+}
@@ -0,0 +1,399 @@
+#include "ccs/reloadable.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "search_state.h"
+#include "ccs/types.h"
+#include "dag/dag_builder.h"
+#include "dag/dag_diff.h"
+
+namespace ccs {
+
+class CcsSubscriber {
+public:
+  typedef std::shared_ptr<const CcsReloadableDomain::Version> VersionP;
+
+  // the version the subscriber was last brought up to date with, and the
+  // context in that version. only touched by the notification thread, once
+  // the subscriber has been registered.
+  VersionP version;
+  CcsContext context;
+  std::vector<std::string> propertyNames; // sorted; empty for all
+  CcsReloadableDomain::ChangeCallback callback;
+
+  CcsSubscriber(VersionP version, const CcsContext &context,
+      std::vector<std::string> propertyNames,
+      CcsReloadableDomain::ChangeCallback callback) :
+    version(std::move(version)), context(context),
+    propertyNames(std::move(propertyNames)), callback(std::move(callback)) {
+    std::sort(this->propertyNames.begin(), this->propertyNames.end());
+  }
+};
+
+class CcsReloadableDomain::Impl {
+  std::shared_ptr<CcsTracer> tracer;
+  std::mutex reloadMutex; // held for the whole of a reload
+  Loader loader;
+  // only ever accessed through std::atomic_load() and std::atomic_store().
+  std::shared_ptr<const Version> published;
+  std::vector<std::weak_ptr<CcsLiveBinding>> live;
+  // the domain last published, and the one before it, which the next reload
+  // updates in place rather than building afresh, if it can (see load()).
+  std::shared_ptr<CcsDomain> latest;
+  std::shared_ptr<CcsDomain> spare;
+  // true if the spare was updated by a reload that then failed, so that it
+  // no longer knows all that changed since it was last published.
+  bool spareUpdated;
+
+  // what the notification thread works from. it's shared with the thread,
+  // since a callback may drop the last reference to this, in which case the
+  // thread is left to finish on its own (see ~Impl()). everything here is
+  // guarded by mutex.
+  struct Notifications {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::weak_ptr<CcsSubscriber>> subscribers;
+    std::shared_ptr<const Version> pending; // newest not yet delivered
+    bool delivering;
+    bool stopping;
+
+    Notifications() : delivering(false), stopping(false) {}
+    void run();
+  };
+
+  std::shared_ptr<Notifications> notifications;
+  // only started once there's a subscriber. guarded by notifications->mutex.
+  std::thread notifier;
+
+  std::shared_ptr<CcsDomain> newDomain() const {
+    if (tracer) return std::make_shared<CcsDomain>(tracer);
+    return std::make_shared<CcsDomain>();
+  }
+
+  void publish(uint64_t number, std::shared_ptr<CcsDomain> domain,
+      bool incremental) {
+    CcsContext root = domain->build();
+    spare = std::move(latest);
+    latest = domain;
+    std::shared_ptr<const Version> version(new Version{number,
+        std::move(domain), std::move(root), incremental});
+    std::atomic_store(&published, std::move(version));
+  }
+
+  // run the loader against the spare domain, updating it in place, once
+  // nothing refers to it any longer and everything in it was loaded through
+  // a parse cache. otherwise, or if the update turns out not to be
+  // possible, run it again against a fresh domain.
+  std::shared_ptr<CcsDomain> load(bool &incremental) {
+    incremental = false;
+    std::shared_ptr<CcsDomain> domain = std::move(spare);
+    if (domain && domain.use_count() == 1 && domain->dag->tracked()
+        && !domain->dag->referenced()) {
+      domain->dag->beginReload();
+      loader(*domain);
+      if (domain->dag->endReload()) {
+        incremental = true;
+        return domain;
+      }
+    }
+    domain = newDomain();
+    loader(*domain);
+    return domain;
+  }
+
+  bool doReload() {
+    bool incremental;
+    bool updated = spareUpdated;
+    spareUpdated = false;
+    auto domain = load(incremental);
+    if (domain->loadFailed()) {
+      // an update in place leaves the files that failed as they were, so
+      // the domain can still be updated again next time.
+      if (incremental) {
+        spare = std::move(domain);
+        spareUpdated = true;
+      }
+      return false;
+    }
+    // an update in place knows what it changed, which (since the spare is
+    // older than the current version) covers what changed since then too.
+    DagDiff diff;
+    bool diffed = incremental && !updated && domain->dag->reloadDiff(diff);
+    auto previous = current();
+    publish(previous->number + 1, std::move(domain), incremental);
+    auto next = current();
+    // the diff is only needed to refresh live bindings (subscribers are
+    // diffed separately), so skip it if there are none.
+    bool bound = std::any_of(live.cbegin(), live.cend(),
+        [](const std::weak_ptr<CcsLiveBinding> &b) { return !b.expired(); });
+    if (!diffed && bound)
+      diff = diffDags(previous->root.searchState->dagRoot(),
+          next->root.searchState->dagRoot());
+    refreshAll(live, next->root, &diff);
+    {
+      std::lock_guard<std::mutex> lock(notifications->mutex);
+      if (notifier.joinable()) {
+        notifications->pending = current();
+        notifications->cond.notify_all();
+      }
+    }
+    return true;
+  }
+
+  static void deliver(const std::vector<std::shared_ptr<CcsSubscriber>> &active,
+      const std::shared_ptr<const Version> &target) {
+    const Node &root = target->root.searchState->dagRoot();
+    // subscribers are usually all at the same version, so there's usually
+    // just one diff to compute. contexts are likewise shared where possible.
+    std::map<const Version *, DagDiff> diffs;
+    std::map<const SearchState *, CcsContext> rebased;
+    for (auto it = active.cbegin(); it != active.cend(); ++it) {
+      CcsSubscriber &sub = **it;
+      if (sub.version == target) continue;
+      auto diff = diffs.find(sub.version.get());
+      if (diff == diffs.end())
+        diff = diffs.insert(std::make_pair(sub.version.get(), diffDags(
+            sub.version->root.searchState->dagRoot(), root))).first;
+
+      const SearchState *old = sub.context.searchState;
+      auto pr = rebased.insert(std::make_pair(old, sub.context));
+      if (pr.second) pr.first->second = sub.context.rebase(target->root);
+      const CcsContext &context = pr.first->second;
+
+      std::vector<std::string> candidates;
+      if (sub.propertyNames.empty())
+        candidates.assign(diff->second.names.begin(),
+            diff->second.names.end());
+      else
+        std::set_intersection(sub.propertyNames.begin(),
+            sub.propertyNames.end(), diff->second.names.begin(),
+            diff->second.names.end(), std::back_inserter(candidates));
+
+      std::vector<CcsChange> changes;
+      for (auto name = candidates.cbegin(); name != candidates.cend(); ++name) {
+        const CcsProperty &before = sub.context.getProperty(*name);
+        const CcsProperty &after = context.getProperty(*name);
+        if (before.exists() == after.exists() && (!before.exists()
+            || before.strValue() == after.strValue()))
+          continue;
+        changes.push_back(CcsChange{context, *name, before.exists(),
+            before.exists() ? before.strValue() : std::string(),
+            after.exists(), after.exists() ? after.strValue() : std::string()});
+      }
+
+      sub.version = target;
+      sub.context = context;
+      if (changes.empty()) continue;
+      try {
+        sub.callback(changes);
+      } catch (...) {
+        // nowhere to report this, and it mustn't take down the notifier or
+        // deprive other subscribers of their notifications.
+      }
+    }
+  }
+
+public:
+  Impl(Loader loader, std::shared_ptr<CcsTracer> tracer) :
+    tracer(std::move(tracer)), loader(std::move(loader)),
+    spareUpdated(false), notifications(std::make_shared<Notifications>()) {
+    publish(0, newDomain(), false);
+  }
+
+  ~Impl() {
+    {
+      std::lock_guard<std::mutex> lock(notifications->mutex);
+      notifications->stopping = true;
+      notifications->cond.notify_all();
+    }
+    if (!notifier.joinable()) return;
+    // a callback dropped the last reference. the thread can't join itself,
+    // but it holds what it needs, and stops once the callback returns.
+    if (notifier.get_id() == std::this_thread::get_id()) notifier.detach();
+    else notifier.join();
+  }
+
+  std::shared_ptr<const Version> current() const {
+    return std::atomic_load(&published);
+  }
+
+  bool reload() {
+    std::lock_guard<std::mutex> lock(reloadMutex);
+    return doReload();
+  }
+
+  // the initial load has no caller to throw to, so if the loader throws,
+  // version 0 stays published and the tracer hears about it instead.
+  void initialLoad() {
+    std::string what;
+    try {
+      reload();
+      return;
+    } catch (const std::exception &e) {
+      what = e.what();
+    } catch (...) {
+      what = "unknown exception";
+    }
+    current()->domain->dag->root()->tracer().onParseError(
+        "Initial load failed: " + what);
+  }
+
+  bool reload(Loader newLoader) {
+    std::lock_guard<std::mutex> lock(reloadMutex);
+    loader = std::move(newLoader);
+    return doReload();
+  }
+
+  void addLive(std::shared_ptr<CcsLiveBinding> binding) {
+    std::lock_guard<std::mutex> lock(reloadMutex);
+    std::vector<std::weak_ptr<CcsLiveBinding>> added{binding};
+    refreshAll(added, current()->root, nullptr);
+    live.push_back(std::move(binding));
+  }
+
+  std::shared_ptr<CcsSubscriber> subscribe(const CcsContext &context,
+      std::vector<std::string> propertyNames, ChangeCallback callback) {
+    // holding the reload lock, the subscriber is brought up to date with
+    // the current version without racing a publish.
+    std::lock_guard<std::mutex> reloadLock(reloadMutex);
+    auto version = current();
+    auto subscriber = std::make_shared<CcsSubscriber>(version,
+        context.rebase(version->root), std::move(propertyNames),
+        std::move(callback));
+    std::lock_guard<std::mutex> lock(notifications->mutex);
+    notifications->subscribers.push_back(subscriber);
+    if (!notifier.joinable()) {
+      std::shared_ptr<Notifications> shared = notifications;
+      notifier = std::thread([shared] { shared->run(); });
+    }
+    return subscriber;
+  }
+
+  void waitForNotifications() const {
+    Notifications &n = *notifications;
+    std::unique_lock<std::mutex> lock(n.mutex);
+    n.cond.wait(lock, [&n] { return !n.pending && !n.delivering; });
+  }
+};
+
+void CcsReloadableDomain::Impl::Notifications::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    cond.wait(lock, [this] { return stopping || pending; });
+    if (stopping) return;
+    auto target = std::move(pending);
+    pending.reset();
+    std::vector<std::shared_ptr<CcsSubscriber>> active;
+    size_t kept = 0;
+    for (auto it = subscribers.begin(); it != subscribers.end(); ++it) {
+      auto subscriber = it->lock();
+      if (!subscriber) continue;
+      subscribers[kept++] = *it;
+      active.push_back(std::move(subscriber));
+    }
+    subscribers.resize(kept, std::weak_ptr<CcsSubscriber>());
+    delivering = true;
+    lock.unlock();
+    deliver(active, target);
+    lock.lock();
+    delivering = false;
+    cond.notify_all();
+  }
+}
+
+CcsReloadableDomain::CcsReloadableDomain(Loader loader,
+    std::shared_ptr<CcsTracer> tracer) :
+  impl(std::make_shared<Impl>(std::move(loader), std::move(tracer))) {
+  impl->initialLoad();
+}
+
+CcsReloadableDomain::~CcsReloadableDomain() {}
+
+std::shared_ptr<const CcsReloadableDomain::Version>
+CcsReloadableDomain::current() const {
+  return impl->current();
+}
+
+bool CcsReloadableDomain::reload() {
+  return impl->reload();
+}
+
+bool CcsReloadableDomain::reload(Loader loader) {
+  return impl->reload(std::move(loader));
+}
+
+void CcsReloadableDomain::addLive(std::shared_ptr<CcsLiveBinding> binding) {
+  impl->addLive(std::move(binding));
+}
+
+size_t CcsReloadableDomain::refreshAll(
+    std::vector<std::weak_ptr<CcsLiveBinding>> &live, const CcsContext &root,
+    const DagDiff *diff) {
+  // bindings created from the same context share it, and are moved to the
+  // new root together. every binding moves, so none keeps an old version
+  // alive, but lazily: a context is only searched again if one of its
+  // bindings' properties may have changed.
+  CcsContext lazyRoot = root.lazy();
+  std::map<const SearchState *, CcsContext> rebased;
+  size_t kept = 0;
+  size_t changed = 0;
+  for (auto it = live.begin(); it != live.end(); ++it) {
+    auto binding = it->lock();
+    if (!binding) continue;
+    live[kept++] = *it;
+    const SearchState *old = binding->context.searchState;
+    auto pr = rebased.insert(std::make_pair(old, binding->context));
+    if (pr.second) pr.first->second = binding->context.rebase(lazyRoot);
+    binding->context = pr.first->second;
+    if (diff && !diff->changed(binding->propertyName)) continue;
+    if (refresh(*binding)) changed++;
+  }
+  live.resize(kept, std::weak_ptr<CcsLiveBinding>());
+  return changed;
+}
+
+bool CcsReloadableDomain::refresh(CcsLiveBinding &binding) {
+  const CcsProperty &prop = binding.context.getProperty(binding.propertyName);
+  if (!prop.exists()) {
+    if (!binding.exists) return false;
+    binding.exists = false;
+    binding.value.clear();
+    binding.store(nullptr);
+    return true;
+  }
+  if (binding.exists && prop.strValue() == binding.value) return false;
+  binding.exists = true;
+  binding.value = prop.strValue();
+  binding.store(&prop);
+  return true;
+}
+
+CcsSubscription CcsReloadableDomain::subscribe(const CcsContext &context,
+    const std::vector<std::string> &propertyNames, ChangeCallback callback) {
+  return CcsSubscription(impl->subscribe(context, propertyNames,
+      std::move(callback)));
+}
+
+CcsSubscription CcsReloadableDomain::subscribe(const CcsContext &context,
+    ChangeCallback callback) {
+  return CcsSubscription(impl->subscribe(context, {}, std::move(callback)));
+}
+
+void CcsReloadableDomain::waitForNotifications() const {
+  impl->waitForNotifications();
+}
+
+std::future<bool> CcsReloadableDomain::reloadAsync() {
+  std::shared_ptr<Impl> pinned = impl;
+  return std::async(std::launch::async, [pinned]() {
+    return pinned->reload();
+  });
+}
+
+}
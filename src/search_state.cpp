@@ -1,54 +1,222 @@
 #include "search_state.h"
 
 #include <algorithm>
+#include <new>
 #include <ostream>
 #include <sstream>
 
 #include "ccs/domain.h"
+#include "dag/child_index.h"
 #include "dag/key.h"
 #include "dag/node.h"
 #include "dag/specificity.h"
 #include "dag/tally.h"
+#include "dag/term_index.h"
 
 namespace ccs {
 
-SearchState::SearchState(const std::shared_ptr<const SearchState> &parent,
-    const Key &key) :
+SearchState::SearchState(const SearchState *parent,
+    Key &&key, bool lazy, CcsArena *arena) :
       parent(parent),
+      arena(arena),
+      refs(0),
+      nodes(ArenaAllocator<char>(arena)),
+      tallyMap(ArenaAllocator<char>(arena)),
+      properties(ArenaAllocator<char>(arena)),
       tracer(parent->tracer),
-      key(key),
-      constraintsChanged(false) {}
+      names(parent->names),
+      key(key.arena() == arena ? std::move(key) : Key(key, arena)),
+      requested(arena),
+      hasRequested(false),
+      constraintsChanged(false),
+      lazy(lazy) {
+  if (!arena) parent->retain();
+}
+
+RootRef::RootRef(const std::shared_ptr<const Node> &root) : root_(root) {
+  if (root_) root_->hold();
+}
+
+RootRef::~RootRef() {
+  if (root_) root_->unhold();
+}
 
 SearchState::SearchState(std::shared_ptr<const Node> &root) :
-      root(root), tracer(root->tracer()) {
+      root(root), parent(nullptr), arena(nullptr), refs(0),
+      tracer(root->tracer()), names(root->propertyNames()),
+      hasRequested(false), lazy(false) {
   constraintsChanged = false;
   root->activate(Specificity(), *this);
   while (constraintsChanged) {
     constraintsChanged = false;
     root->getChildren(key, Specificity(), *this);
   }
+  std::unique_ptr<TermIndex> index(new TermIndex);
+  for (auto it = nodes.cbegin(); it != nodes.cend(); ++it)
+    index->add(*it->first, it->second);
+  termIndex = std::move(index);
 }
 
-SearchState::~SearchState() {
-  for (auto it = tallyMap.begin(); it != tallyMap.end(); ++it)
-    delete it->second;
+SearchState::SearchState(const std::shared_ptr<const Node> &root,
+    bool lazy) :
+      root(root), parent(nullptr), arena(nullptr), refs(0),
+      tracer(root->tracer()), names(root->propertyNames()),
+      hasRequested(false), constraintsChanged(false), lazy(lazy) {}
+
+SearchState::~SearchState() {}
+
+void SearchState::release(const SearchState *state) {
+  // a heap state's ancestors are all on the heap too, so this stops at the
+  // first arena state, if any.
+  while (state && !state->arena
+      && state->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    const SearchState *parent = state->parent;
+    delete state;
+    state = parent;
+  }
 }
 
-std::shared_ptr<SearchState> SearchState::newChild(
-    const std::shared_ptr<const SearchState> &parent, const Key &key) {
-  std::shared_ptr<SearchState> searchState(new SearchState(parent, key));
+IntrusivePtr<SearchState> SearchState::make(const SearchState *parent,
+    Key &&key, bool lazy, CcsArena *arena) {
+  if (!arena)
+    return IntrusivePtr<SearchState>(new SearchState(parent, std::move(key),
+        lazy, nullptr));
+  void *mem = arena->allocate(sizeof(SearchState), alignof(SearchState));
+  return IntrusivePtr<SearchState>(new (mem) SearchState(parent,
+      std::move(key), lazy, arena));
+}
+
+IntrusivePtr<SearchState> SearchState::newChild(
+    const SearchState *parent, Key key) {
+  return newChild(parent, std::move(key), parent->lazy, parent->arena);
+}
 
-  bool constraintsChanged;
-  do {
+IntrusivePtr<SearchState> SearchState::newChild(
+    const SearchState *parent, Key key,
+    bool lazy) {
+  return newChild(parent, std::move(key), lazy, parent->arena);
+}
+
+IntrusivePtr<SearchState> SearchState::newChild(
+    const SearchState *parent, Key key,
+    bool lazy, CcsArena *arena) {
+  IntrusivePtr<SearchState> searchState = make(parent, std::move(key), lazy,
+      arena);
+  if (!lazy) {
+    parent->activate();
+    searchState->extendToFixpoint(true);
+  }
+  return searchState;
+}
+
+IntrusivePtr<SearchState> SearchState::newChild(
+    const SearchState *parent, Key key,
+    const ChildIndex &index, size_t step, const std::string &value) {
+  parent->activate();
+  IntrusivePtr<SearchState> searchState = make(parent, std::move(key), false,
+      parent->arena);
+  for (const SearchState *p = parent; p; p = p->parent)
+    for (auto it = p->nodes.cbegin(); it != p->nodes.cend(); ++it)
+      index.activate(step, *it->first, value, it->second, *searchState);
+  // if a @constrain added to the key, children outside the index may match
+  // it now, so carry on the usual way.
+  searchState->extendToFixpoint(searchState->constraintsChanged);
+  return searchState;
+}
+
+void SearchState::extendToFixpoint(bool constraintsChanged) {
+  while (constraintsChanged) {
     constraintsChanged = false;
-    const SearchState *p = parent.get();
-    while (p) {
-      constraintsChanged |= searchState->extendWith(*p);
-      p = p->parent.get();
+    for (const SearchState *p = parent; p; p = p->parent)
+      constraintsChanged |= extendWith(*p);
+  }
+}
+
+IntrusivePtr<SearchState> SearchState::compact(
+    const SearchState &state) {
+  state.activate();
+  std::vector<const SearchState *> chain; // nearest first
+  for (const SearchState *s = &state; s; s = s->parent)
+    chain.push_back(s);
+
+  IntrusivePtr<SearchState> result(new SearchState(chain.back()->root.get(),
+      state.lazy));
+  // already complete, but children still inherit laziness.
+  std::call_once(result->activated, [] {});
+  std::unique_ptr<Compacted> compacted(new Compacted);
+
+  for (auto it = chain.crbegin(); it != chain.crend(); ++it) {
+    const SearchState &s = **it;
+    if (s.compacted) {
+      compacted->keys = s.compacted->keys;
+      compacted->requested = s.compacted->requested;
+    } else {
+      compacted->keys.push_back(s.key);
+      if (s.parent) compacted->requested.push_back(s.hasRequested
+          ? s.requested : s.key);
     }
-  } while (constraintsChanged);
+    // a child is activated from every ancestor's nodes, but only the best
+    // specificity of each node can make a difference.
+    for (auto node = s.nodes.cbegin(); node != s.nodes.cend(); ++node)
+      result->add(node->second, node->first);
+  }
 
-  return searchState;
+  // whereas for settings and tallies, the nearest state wins.
+  for (auto it = chain.cbegin(); it != chain.cend(); ++it) {
+    const SearchState &s = **it;
+    result->properties.insert(s.properties.cbegin(), s.properties.cend());
+    for (auto tally = s.tallyMap.cbegin(); tally != s.tallyMap.cend();
+        ++tally)
+      result->tallyMap.insert(*tally);
+  }
+
+  result->key = compacted->keys.back();
+  result->compacted = std::move(compacted);
+  return result;
+}
+
+void SearchState::requestedPath(std::vector<const Key *> &path) const {
+  activate();
+  if (compacted) {
+    for (auto it = compacted->requested.cbegin();
+        it != compacted->requested.cend(); ++it)
+      path.push_back(&*it);
+  } else if (parent) {
+    parent->requestedPath(path);
+    path.push_back(hasRequested ? &requested : &key);
+  }
+}
+
+size_t SearchState::memoryUsage() const {
+  // tree nodes carry a color and three links besides the value, hash nodes
+  // a link and the hash.
+  const size_t treeNode = 4 * sizeof(void *);
+  const size_t hashNode = 2 * sizeof(void *);
+  size_t bytes = sizeof(SearchState) + key.memoryUsage()
+      + requested.memoryUsage();
+  bytes += nodes.size() * (treeNode + sizeof(*nodes.begin()));
+  bytes += tallyMap.size() * (treeNode + sizeof(*tallyMap.begin()));
+  bytes += properties.bucket_count() * sizeof(void *);
+  for (auto it = properties.cbegin(); it != properties.cend(); ++it)
+    bytes += hashNode + sizeof(*it)
+        + it->second.values.size() * (treeNode + sizeof(void *));
+  if (compacted) {
+    for (auto it = compacted->keys.cbegin(); it != compacted->keys.cend();
+        ++it)
+      bytes += sizeof(Key) + it->memoryUsage();
+    for (auto it = compacted->requested.cbegin();
+        it != compacted->requested.cend(); ++it)
+      bytes += sizeof(Key) + it->memoryUsage();
+  }
+  return bytes;
+}
+
+void SearchState::activateNow() const {
+  parent->activate();
+  // a state is logically immutable once it's shared. this is just the
+  // deferred part of its construction, and call_once keeps it private to a
+  // single thread.
+  const_cast<SearchState *>(this)->extendToFixpoint(true);
 }
 
 void SearchState::logRuleDag(std::ostream &os) const {
@@ -60,6 +228,10 @@ void SearchState::logRuleDag(std::ostream &os) const {
 
 bool SearchState::extendWith(const SearchState &priorState) {
   constraintsChanged = false;
+  if (priorState.termIndex) {
+    priorState.termIndex->activate(key, *this);
+    return constraintsChanged;
+  }
   for (auto it = priorState.nodes.cbegin(); it != priorState.nodes.cend(); ++it)
         it->first->getChildren(key, it->second, *this);
   return constraintsChanged;
@@ -67,29 +239,84 @@ bool SearchState::extendWith(const SearchState &priorState) {
 
 const CcsProperty *SearchState::findProperty(const CcsContext &context,
     const std::string &propertyName) const {
-  const CcsProperty *prop = doSearch(context, propertyName);
+  return findProperty(context, names.find(propertyName), propertyName);
+}
+
+const CcsProperty *SearchState::findProperty(const CcsContext &context,
+    unsigned nameId, const std::string &propertyName) const {
+  activate();
+  const CcsProperty *prop = nameId == PropertyNames::None ? nullptr
+      : doSearch(context, nameId, propertyName);
   if (prop) {
-    tracer.onPropertyFound(context, propertyName, *prop);
+    tracer.onInternedPropertyFound(context, propertyName, names.id(), nameId,
+        *prop);
   } else {
-    tracer.onPropertyNotFound(context, propertyName);
+    tracer.onInternedPropertyNotFound(context, propertyName, names.id(),
+        nameId);
   }
   return prop;
 }
 
+size_t SearchState::findProperties(const CcsContext &context,
+    const std::vector<std::string> &propertyNames, const unsigned *ids,
+    const CcsProperty **dest) const {
+  activate();
+  // walk up the chain once, looking for whatever's still missing at each
+  // step, rather than once per property...
+  std::vector<std::pair<size_t, unsigned>> pending;
+  pending.reserve(propertyNames.size());
+  // the tracer wants every id, including those of names the domain hasn't
+  // seen.
+  std::vector<unsigned> interned;
+  if (!ids) interned.reserve(propertyNames.size());
+  for (size_t i = 0; i < propertyNames.size(); i++) {
+    dest[i] = nullptr;
+    unsigned id = ids ? ids[i] : names.find(propertyNames[i]);
+    if (!ids) interned.push_back(id);
+    if (id != PropertyNames::None) pending.push_back(std::make_pair(i, id));
+  }
+  if (!ids) ids = interned.data();
+  size_t unknown = propertyNames.size() - pending.size();
+
+  for (const SearchState *s = this; s && !pending.empty();
+      s = s->parent) {
+    size_t remaining = 0;
+    for (auto it = pending.cbegin(); it != pending.cend(); ++it) {
+      auto prop = s->properties.find(it->second);
+      if (prop == s->properties.end())
+        pending[remaining++] = *it;
+      else
+        dest[it->first] = resolve(context, propertyNames[it->first],
+            prop->second);
+    }
+    pending.resize(remaining);
+  }
+
+  if (!propertyNames.empty())
+    tracer.onInternedPropertiesFound(context, propertyNames, names.id(), ids,
+        dest);
+  return propertyNames.size() - pending.size() - unknown;
+}
+
 const CcsProperty *SearchState::doSearch(const CcsContext &context,
-    const std::string &propertyName) const {
-  auto it = properties.find(propertyName);
+    unsigned nameId, const std::string &propertyName) const {
+  auto it = properties.find(nameId);
   if (it == properties.end()) {
-    if (parent) return parent->doSearch(context, propertyName);
+    if (parent) return parent->doSearch(context, nameId, propertyName);
     return nullptr;
   }
 
-  if (it->second.values.size() == 1)
-    return *it->second.values.begin();
+  return resolve(context, propertyName, it->second);
+}
+
+const Property *SearchState::resolve(const CcsContext &context,
+    const std::string &propertyName, const PropertySetting &setting) const {
+  if (setting.values.size() == 1)
+    return *setting.values.begin();
 
-  // it->second.values.size() > 1
-  std::vector<const Property *> values(it->second.values.begin(),
-      it->second.values.end());
+  // setting.values.size() > 1
+  std::vector<const Property *> values(setting.values.begin(),
+      setting.values.end());
   std::sort(values.begin(), values.end(),
       [](const Property *l, const Property *r) {
     return l->propertyNumber() < r->propertyNumber();
@@ -102,19 +329,35 @@ const CcsProperty *SearchState::doSearch(const CcsContext &context,
 
 const TallyState *SearchState::getTallyState(const AndTally *tally) const {
   auto it = tallyMap.find(tally);
-  if (it != tallyMap.end()) return it->second;
+  if (it != tallyMap.end()) return &it->second;
   if (parent) return parent->getTallyState(tally);
   return tally->emptyState();
 }
 
 void SearchState::setTallyState(const AndTally *tally,
-    const TallyState *state) {
-  const TallyState *&loc = tallyMap[tally];
-  if (loc) delete loc;
-  loc = state;
+    const TallyState &state) {
+  auto it = tallyMap.find(tally);
+  if (it == tallyMap.end())
+    tallyMap.emplace(tally, state);
+  else
+    it->second = state;
 }
 
 void SearchState::append(std::ostream &out, bool isPrefix) const {
+  if (compacted) {
+    bool any = false;
+    for (auto it = compacted->keys.cbegin(); it != compacted->keys.cend();
+        ++it) {
+      if (it->empty()) continue;
+      if (any) out << " > ";
+      out << *it;
+      any = true;
+    }
+    if (!any && !isPrefix) out << "<root>";
+    if (any && isPrefix) out << " > ";
+    return;
+  }
+
   if (parent) {
     parent->append(out, isPrefix || !key.empty());
   } else if (key.empty() && !isPrefix) {
@@ -129,6 +372,7 @@ void SearchState::append(std::ostream &out, bool isPrefix) const {
 }
 
 std::ostream &operator<<(std::ostream &out, const SearchState &state) {
+  state.activate();
   state.append(out, false);
   return out;
 }
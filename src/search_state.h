@@ -1,33 +1,59 @@
 #pragma once
 
+#include <atomic>
 #include <iosfwd>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <unordered_map>
+#include <vector>
 
+#include "arena_allocator.h"
 #include "ccs/domain.h"
 #include "dag/key.h"
 #include "dag/property.h"
+#include "dag/property_names.h"
 #include "dag/specificity.h"
+#include "dag/tally.h"
 #include "graphviz.h"
+#include "intrusive_ptr.h"
 
 namespace ccs {
 
 class AndTally;
 class CcsProperty;
+class ChildIndex;
 class Node;
-class TallyState;
+class TermIndex;
 
 struct PropertySetting {
+    typedef std::set<const Property *, std::less<const Property *>,
+        ArenaAllocator<const Property *>> Values;
+
     Specificity spec;
     bool override;
-    std::set<const Property *> values;
+    Values values;
 
-    PropertySetting(Specificity spec, const Property *value)
+    PropertySetting(Specificity spec, const Property *value,
+        CcsArena *arena = nullptr)
     : spec(spec),
-      override(value->override()) {
+      override(value->override()),
+      values(std::less<const Property *>(),
+          ArenaAllocator<const Property *>(arena)) {
       values.insert(value);
     }
+    // copies go to the heap, unless given an arena.
+    PropertySetting(const PropertySetting &that, CcsArena *arena)
+    : spec(that.spec),
+      override(that.override),
+      values(that.values.cbegin(), that.values.cend(),
+          std::less<const Property *>(),
+          ArenaAllocator<const Property *>(arena)) {}
+    PropertySetting(const PropertySetting &that)
+    : PropertySetting(that, nullptr) {}
+    PropertySetting(PropertySetting &&) = default;
+    PropertySetting &operator=(const PropertySetting &) = default;
 
     bool better(const PropertySetting &that) const {
       if (override && !that.override) return true;
@@ -36,25 +62,81 @@ struct PropertySetting {
     }
 };
 
+// a reference to the root of a dag, which the root also counts, so that the
+// dag can tell when no search state holds it any longer (see
+// DagBuilder::referenced()).
+class RootRef {
+  std::shared_ptr<const Node> root_;
+
+public:
+  RootRef() {}
+  explicit RootRef(const std::shared_ptr<const Node> &root);
+  RootRef(const RootRef &) = delete;
+  RootRef &operator=(const RootRef &) = delete;
+  ~RootRef();
+
+  const std::shared_ptr<const Node> &get() const { return root_; }
+  const Node &operator*() const { return *root_; }
+  const Node *operator->() const { return root_.get(); }
+  explicit operator bool() const { return root_ != nullptr; }
+};
+
 class SearchState {
   // we need to be sure to retain a reference to the root of the dag. the
   // simplest way is to just make everything in 'nodes' shared_ptrs, but that
   // seems awfully heavy-handed. instead we'll just retain a direct reference
   // to the root in the root search state. the parent links are shared, so
-  // this is sufficient.
-  std::shared_ptr<const Node> root;
-  std::shared_ptr<const SearchState> parent;
-  std::map<const Node *, Specificity> nodes;
-  // the TallyStates here should rightly be unique_ptrs, but gcc 4.5 can't
-  // support that in a map. bummer.
-  std::map<const AndTally *, const TallyState *> tallyMap;
-  // cache of properties newly set in this context
-  std::map<std::string, PropertySetting> properties;
+  // this is sufficient. being the first member, it's the last to go.
+  RootRef root;
+  // retained, unless this state lives in an arena, in which case it's
+  // borrowed: the parent has to outlive the arena's contents anyway.
+  const SearchState *parent;
+  // the arena this state and everything it holds was allocated from, or
+  // null for the heap. arena states are never counted or destroyed, their
+  // memory just goes away with the arena's.
+  CcsArena *arena;
+  // references from contexts, children and snapshots (see IntrusivePtr).
+  mutable std::atomic<unsigned> refs;
+  std::map<const Node *, Specificity, std::less<const Node *>,
+      ArenaAllocator<std::pair<const Node *const, Specificity>>> nodes;
+  std::map<const AndTally *, TallyState, std::less<const AndTally *>,
+      ArenaAllocator<std::pair<const AndTally *const, TallyState>>> tallyMap;
+  // cache of properties newly set in this context, by interned name
+  std::unordered_map<unsigned, PropertySetting, std::hash<unsigned>,
+      std::equal_to<unsigned>,
+      ArenaAllocator<std::pair<const unsigned, PropertySetting>>> properties;
   CcsTracer &tracer;
+  const PropertyNames &names;
   Key key;
+  // the key as originally requested, before any @constrain was applied to
+  // it. only kept once an @constrain actually adds to the key (see
+  // constrain()), which is rare.
+  Key requested;
+  bool hasRequested;
   bool constraintsChanged;
+  // a lazy state isn't activated until it's first read (see activate()).
+  // only the fields above are written during activation.
+  bool lazy;
+  mutable std::once_flag activated;
+  // for a state made by compact(), which has no parent, the keys of all the
+  // states it stands in for: effective keys from the root down, for
+  // printing, and requested keys from below the root, for rebasing.
+  struct Compacted {
+    std::vector<Key> keys;
+    std::vector<Key> requested;
+  };
+  std::unique_ptr<const Compacted> compacted;
+  // for a root state, its nodes' children by term, so that extending a
+  // descendant with the root's nodes needn't test every child.
+  std::unique_ptr<const TermIndex> termIndex;
 
-  SearchState(const std::shared_ptr<const SearchState> &parent, const Key &key);
+  SearchState(const SearchState *parent, Key &&key, bool lazy,
+      CcsArena *arena);
+  // a new child, from the heap or the given arena.
+  static IntrusivePtr<SearchState> make(const SearchState *parent,
+      Key &&key, bool lazy, CcsArena *arena);
+  // an empty, parentless state, not yet activated at all.
+  SearchState(const std::shared_ptr<const Node> &root, bool lazy);
 
 public:
   SearchState(std::shared_ptr<const Node> &root);
@@ -62,15 +144,88 @@ public:
   SearchState &operator=(const SearchState &) = delete;
   ~SearchState();
 
-  static std::shared_ptr<SearchState> newChild(
-      const std::shared_ptr<const SearchState> &parent, const Key &key);
+  void retain() const
+    { if (!arena) refs.fetch_add(1, std::memory_order_relaxed); }
+  // true if anything but its first owner holds a reference.
+  bool shared() const { return refs.load(std::memory_order_acquire) > 1; }
+  // frees the state once the last reference is gone, then its parent if
+  // that was the parent's last reference, and so on, iteratively, so that
+  // a long chain doesn't free itself recursively.
+  static void release(const SearchState *state);
+
+  // the child is lazy if the parent is, and allocated from the same arena
+  // (if any) unless another is given.
+  static IntrusivePtr<SearchState> newChild(
+      const SearchState *parent, Key key);
+  static IntrusivePtr<SearchState> newChild(
+      const SearchState *parent, Key key,
+      bool lazy);
+  static IntrusivePtr<SearchState> newChild(
+      const SearchState *parent, Key key,
+      bool lazy, CcsArena *arena);
+  // as above, for a key of just the index's name for the given step, with
+  // the given value. the index stands in for a search of every child of
+  // every active node.
+  static IntrusivePtr<SearchState> newChild(
+      const SearchState *parent, Key key,
+      const ChildIndex &index, size_t step, const std::string &value);
+
+  // a single, parentless state equivalent to the given one and all of its
+  // ancestors: the same active nodes, tally states and property settings,
+  // and the same printed form. it doesn't refer to any of the originals, and
+  // is always on the heap.
+  static IntrusivePtr<SearchState> compact(const SearchState &state);
 
   void logRuleDag(std::ostream &os) const;
 
+  // activate a lazy state and its ancestors, if that hasn't happened yet.
+  // safe to call from any number of threads at once; all but one will wait
+  // for the activation to finish. every method that reads the results of
+  // activation calls this first.
+  void activate() const {
+    if (lazy) std::call_once(activated, [this] { activateNow(); });
+  }
+
   bool extendWith(const SearchState &priorState);
 
   const CcsProperty *findProperty(const CcsContext &context,
       const std::string &propertyName) const;
+  // as above, but with the name already interned. nameId may be None.
+  const CcsProperty *findProperty(const CcsContext &context,
+      unsigned nameId, const std::string &propertyName) const;
+
+  // ids, if not null, holds the names already interned, one per name.
+  size_t findProperties(const CcsContext &context,
+      const std::vector<std::string> &propertyNames, const unsigned *ids,
+      const CcsProperty **dest) const;
+
+  // pick the winning value of a setting, reporting a conflict if necessary.
+  const Property *resolve(const CcsContext &context,
+      const std::string &propertyName, const PropertySetting &setting) const;
+
+  CcsTracer &getTracer() const { return tracer; }
+  const PropertyNames &propertyNames() const { return names; }
+  unsigned nameId(const PropertyKeyBase &key) const {
+    if (key.domain() == names.id()) return key.id();
+    return names.find(key.name());
+  }
+
+  bool hasAncestor(const SearchState *state) const {
+    for (const SearchState *p = parent; p; p = p->parent)
+      if (p == state) return true;
+    return false;
+  }
+
+  // visit every setting visible in this context, nearest first, stopping
+  // at 'stop' (exclusive), which should be null or an ancestor. a property
+  // may be visited more than once, only the first visit is the visible one.
+  template <typename F>
+  void forEachProperty(const SearchState *stop, F &&f) const {
+    activate();
+    for (const SearchState *s = this; s && s != stop; s = s->parent)
+      for (auto it = s->properties.cbegin(); it != s->properties.cend(); ++it)
+        f(it->first, it->second);
+  }
 
   bool add(Specificity spec, const Node *node) {
     auto pr = nodes.insert(std::make_pair(node, spec));
@@ -86,18 +241,41 @@ public:
     return false;
   }
 
-  void constrain(const Key &constraints)
-    { constraintsChanged |= key.addAll(constraints); }
+  void constrain(const Key &constraints) {
+    // every activation lands here, mostly with nothing to add, so only
+    // snapshot the requested key when it's about to change.
+    if (constraints.matches(key)) return;
+    if (!hasRequested) {
+      requested = key;
+      hasRequested = true;
+    }
+    constraintsChanged |= key.addAll(constraints);
+  }
+
+  // the constraints the user applied to get to this state, from the root,
+  // in order. the root's own key is not included.
+  void requestedPath(std::vector<const Key *> &path) const;
+  // roughly, the bytes held by this state alone, not counting its ancestors
+  // or the dag. a lazy state is measured as activated so far.
+  size_t memoryUsage() const;
+  const SearchState *getParent() const { return parent; }
+  bool isLazy() const { return lazy; }
+  CcsArena *getArena() const { return arena; }
+  const Node &dagRoot() const {
+    const SearchState *s = this;
+    while (s->parent) s = s->parent;
+    return *s->root;
+  }
 
-  void cacheProperty(const std::string &propertyName,
-      Specificity spec, const Property *property) {
-    auto it = properties.find(propertyName);
+  void cacheProperty(unsigned nameId, Specificity spec,
+      const Property *property) {
+    auto it = properties.find(nameId);
 
-    PropertySetting newSetting(spec, property);
+    PropertySetting newSetting(spec, property, arena);
 
     if (it == properties.end()) {
       // we don't have a local setting for this yet.
-      auto parentProperty = parent ? parent->checkCache(propertyName) : nullptr;
+      auto parentProperty = parent ? parent->checkCache(nameId) : nullptr;
       if (parentProperty) {
         if (parentProperty->better(newSetting))
           // parent copy found, parent property better, leave local cache empty.
@@ -105,13 +283,13 @@ public:
 
         // copy parent property into local cache. this is done solely to
         // support conflict detection.
-        it = properties.insert(std::make_pair(propertyName, *parentProperty))
-            .first;
+        it = properties.emplace(nameId,
+            PropertySetting(*parentProperty, arena)).first;
       }
     }
 
     if (it == properties.end()) {
-      properties.insert(std::make_pair(propertyName, newSetting));
+      properties.emplace(nameId, std::move(newSetting));
     } else if (newSetting.better(it->second)) {
       // new property better than local cache. replace.
       it->second = newSetting;
@@ -123,18 +301,23 @@ public:
     }
   }
 
-  const PropertySetting *checkCache(const std::string &propertyName) const {
-    auto it = properties.find(propertyName);
+  const PropertySetting *checkCache(unsigned nameId) const {
+    auto it = properties.find(nameId);
     if (it != properties.end()) return &it->second;
     if (!parent) return nullptr;
-    return parent->checkCache(propertyName);
+    return parent->checkCache(nameId);
   }
 
   const TallyState *getTallyState(const AndTally *tally) const;
-  void setTallyState(const AndTally *tally, const TallyState *state);
+  void setTallyState(const AndTally *tally, const TallyState &state);
 
 private:
-  const CcsProperty *doSearch(const CcsContext &context,
+  // extend with each ancestor in turn, repeating for as long as the
+  // constraints keep changing.
+  void extendToFixpoint(bool constraintsChanged);
+  void activateNow() const;
+
+  const CcsProperty *doSearch(const CcsContext &context, unsigned nameId,
       const std::string &propertyName) const;
 
   friend std::ostream &operator<<(std::ostream &, const SearchState &);
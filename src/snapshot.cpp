@@ -0,0 +1,242 @@
+#include "ccs/snapshot.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "search_state.h"
+#include "dag/property.h"
+
+namespace ccs {
+
+namespace {
+
+struct Slot {
+  unsigned nameId;
+  const Property *prop; // null for an empty slot
+
+  Slot() : nameId(PropertyNames::None), prop(nullptr) {}
+  Slot(unsigned nameId, const Property *prop) : nameId(nameId), prop(prop) {}
+};
+
+size_t tableSize(size_t entries) {
+  // keep the load factor at or below one half...
+  size_t size = 8;
+  while (size < entries * 2) size *= 2;
+  return size;
+}
+
+// ids are dense, so multiplicative (fibonacci) hashing spreads them well
+uint64_t hash(unsigned nameId) { return nameId * 0x9e3779b97f4a7c15ull; }
+
+}
+
+class CcsSnapshot::Impl {
+  std::vector<Slot> slots_;
+  size_t size_;
+  size_t shift_;
+
+  size_t bucket(unsigned nameId) const { return hash(nameId) >> shift_; }
+
+  void insert(const Slot &slot) {
+    size_t mask = slots_.size() - 1;
+    for (size_t i = bucket(slot.nameId); ; i = (i + 1) & mask) {
+      Slot &s = slots_[i];
+      if (!s.prop) {
+        s = slot;
+        size_++;
+        return;
+      }
+      if (s.nameId == slot.nameId) {
+        s = slot;
+        return;
+      }
+    }
+  }
+
+  void allocate(size_t entries) {
+    slots_.resize(tableSize(entries));
+    shift_ = 64;
+    for (size_t n = slots_.size(); n > 1; n >>= 1) shift_--;
+  }
+
+public:
+  CcsContext context;
+
+  Impl(const CcsContext &context, const SearchState &state,
+      const Impl *base) : size_(0), shift_(0), context(context) {
+    // collect the nearest setting for each property defined below the base
+    // snapshot. anything not set below the base is taken as-is from it.
+    std::unordered_map<unsigned, const PropertySetting *> overlay;
+    state.forEachProperty(base ? base->state() : nullptr,
+        [&](unsigned nameId, const PropertySetting &setting) {
+      overlay.insert(std::make_pair(nameId, &setting));
+    });
+
+    size_t expected = overlay.size() + (base ? base->size_ : 0);
+    if (base && base->slots_.size() >= tableSize(expected)) {
+      slots_ = base->slots_;
+      size_ = base->size_;
+      shift_ = base->shift_;
+    } else {
+      allocate(expected);
+      if (base)
+        for (auto it = base->slots_.cbegin(); it != base->slots_.cend(); ++it)
+          if (it->prop) insert(*it);
+    }
+
+    const PropertyNames &names = state.propertyNames();
+    for (auto it = overlay.cbegin(); it != overlay.cend(); ++it)
+      insert(Slot(it->first,
+          state.resolve(context, names.name(it->first), *it->second)));
+  }
+
+  const SearchState *state() const;
+
+  const Property *find(unsigned nameId) const {
+    if (nameId == PropertyNames::None) return nullptr;
+    size_t mask = slots_.size() - 1;
+    for (size_t i = bucket(nameId); slots_[i].prop; i = (i + 1) & mask)
+      if (slots_[i].nameId == nameId) return slots_[i].prop;
+    return nullptr;
+  }
+
+  const CcsProperty *trace(unsigned nameId, const std::string &name) const {
+    const Property *prop = find(nameId);
+    CcsTracer &tracer = state()->getTracer();
+    uint64_t domain = state()->propertyNames().id();
+    if (prop)
+      tracer.onInternedPropertyFound(context, name, domain, nameId, *prop);
+    else
+      tracer.onInternedPropertyNotFound(context, name, domain, nameId);
+    return prop;
+  }
+
+  const CcsProperty *trace(const std::string &name) const
+    { return trace(state()->propertyNames().find(name), name); }
+
+  const CcsProperty &require(const std::string &name) const {
+    const CcsProperty *prop = trace(name);
+    if (!prop) throw no_such_property(name, context);
+    return *prop;
+  }
+
+  size_t size() const { return size_; }
+  size_t memoryUsage() const
+    { return sizeof(Impl) + slots_.capacity() * sizeof(Slot); }
+};
+
+CcsSnapshot CcsContext::snapshot() const {
+  return CcsSnapshot(std::make_shared<CcsSnapshot::Impl>(*this, *searchState,
+      nullptr));
+}
+
+CcsSnapshot CcsContext::snapshot(const CcsSnapshot &base) const {
+  const CcsSnapshot::Impl *baseImpl = base.impl.get();
+  if (!searchState->hasAncestor(baseImpl->state())
+      && searchState != baseImpl->state())
+    return snapshot();
+  return CcsSnapshot(std::make_shared<CcsSnapshot::Impl>(*this, *searchState,
+      baseImpl));
+}
+
+const SearchState *CcsSnapshot::Impl::state() const
+  { return context.searchState; }
+
+CcsSnapshot::CcsSnapshot(std::shared_ptr<const Impl> impl) :
+  impl(std::move(impl)) {}
+
+const CcsContext &CcsSnapshot::context() const { return impl->context; }
+size_t CcsSnapshot::size() const { return impl->size(); }
+size_t CcsSnapshot::memoryUsage() const { return impl->memoryUsage(); }
+
+const CcsProperty &CcsSnapshot::getProperty(const std::string &propertyName)
+    const {
+  const CcsProperty *prop = impl->trace(propertyName);
+  if (prop) return *prop;
+  return missingProperty();
+}
+
+const CcsProperty &CcsSnapshot::getProperty(const PropertyKeyBase &key) const {
+  const CcsProperty *prop = impl->trace(impl->state()->nameId(key),
+      key.name());
+  if (prop) return *prop;
+  return missingProperty();
+}
+
+const std::string &CcsSnapshot::getString(const std::string &propertyName)
+    const {
+  return impl->require(propertyName).strValue();
+}
+
+const std::string &CcsSnapshot::getString(const std::string &propertyName,
+    const std::string &defaultVal) const {
+  const CcsProperty *prop = impl->trace(propertyName);
+  if (!prop) return defaultVal;
+  return prop->strValue();
+}
+
+bool CcsSnapshot::getInto(std::string &dest, const std::string &propertyName)
+    const {
+  const CcsProperty *prop = impl->trace(propertyName);
+  if (!prop) return false;
+  dest = prop->strValue();
+  return true;
+}
+
+int CcsSnapshot::getInt(const std::string &propertyName) const {
+  return impl->require(propertyName).intValue();
+}
+
+int CcsSnapshot::getInt(const std::string &propertyName, int defaultVal)
+    const {
+  const CcsProperty *prop = impl->trace(propertyName);
+  if (!prop) return defaultVal;
+  return prop->intValue();
+}
+
+bool CcsSnapshot::getInto(int &dest, const std::string &propertyName) const {
+  const CcsProperty *prop = impl->trace(propertyName);
+  if (!prop) return false;
+  dest = prop->intValue();
+  return true;
+}
+
+double CcsSnapshot::getDouble(const std::string &propertyName) const {
+  return impl->require(propertyName).doubleValue();
+}
+
+double CcsSnapshot::getDouble(const std::string &propertyName,
+    double defaultVal) const {
+  const CcsProperty *prop = impl->trace(propertyName);
+  if (!prop) return defaultVal;
+  return prop->doubleValue();
+}
+
+bool CcsSnapshot::getInto(double &dest, const std::string &propertyName)
+    const {
+  const CcsProperty *prop = impl->trace(propertyName);
+  if (!prop) return false;
+  dest = prop->doubleValue();
+  return true;
+}
+
+bool CcsSnapshot::getBool(const std::string &propertyName) const {
+  return impl->require(propertyName).boolValue();
+}
+
+bool CcsSnapshot::getBool(const std::string &propertyName, bool defaultVal)
+    const {
+  const CcsProperty *prop = impl->trace(propertyName);
+  if (!prop) return defaultVal;
+  return prop->boolValue();
+}
+
+bool CcsSnapshot::getInto(bool &dest, const std::string &propertyName) const {
+  const CcsProperty *prop = impl->trace(propertyName);
+  if (!prop) return false;
+  dest = prop->boolValue();
+  return true;
+}
+
+}
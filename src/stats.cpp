@@ -0,0 +1,417 @@
+#include "ccs/stats.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+namespace ccs {
+
+namespace {
+
+// ids for CountTables, so that a thread's caches can tell them apart. never
+// reused, unlike their addresses.
+std::atomic<uint64_t> nextTable(1);
+
+const unsigned NoId = ~0u; // as for an id the domain has never seen
+const unsigned NoSlot = ~0u;
+
+template <size_t N>
+using Totals = std::array<uint64_t, N>;
+
+// N counts, which only one thread ever adds to, though others read and zero
+// them.
+template <size_t N>
+struct Counters {
+  std::atomic<uint64_t> counts[N];
+
+  Counters() {
+    for (size_t i = 0; i < N; i++)
+      counts[i].store(0, std::memory_order_relaxed);
+  }
+
+  void add(size_t which, uint64_t n = 1)
+    { counts[which].fetch_add(n, std::memory_order_relaxed); }
+};
+
+// one thread's counters in a CountTable, by slot. they're allocated in
+// chunks, so that they never move as more are added.
+template <size_t N>
+class ThreadCounters {
+  static const size_t ChunkSize = 64;
+
+  // held to add a chunk, and by any other thread to read them.
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Counters<N>[]>> chunks_;
+
+public:
+  // only ever called by the owning thread.
+  Counters<N> &at(unsigned slot) {
+    size_t chunk = slot / ChunkSize;
+    if (chunk >= chunks_.size()) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      while (chunks_.size() <= chunk)
+        chunks_.emplace_back(new Counters<N>[ChunkSize]);
+    }
+    return chunks_[chunk][slot % ChunkSize];
+  }
+
+  void addTo(std::vector<Totals<N>> &totals) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t c = 0; c < chunks_.size(); c++)
+      for (size_t i = 0; i < ChunkSize && c * ChunkSize + i < totals.size();
+          i++)
+        for (size_t n = 0; n < N; n++)
+          totals[c * ChunkSize + i][n] +=
+              chunks_[c][i].counts[n].load(std::memory_order_relaxed);
+  }
+
+  void zero() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t c = 0; c < chunks_.size(); c++)
+      for (size_t i = 0; i < ChunkSize; i++)
+        for (size_t n = 0; n < N; n++)
+          chunks_[c][i].counts[n].store(0, std::memory_order_relaxed);
+  }
+};
+
+// counters by name, sharded per thread: each thread counts into its own, so
+// threads never contend on a counter, and snapshots add them all up. a name
+// gets a slot the first time any thread counts it, which takes the table's
+// lock. each thread then remembers the slot by name, and by the name's
+// interned id in the last few domains it looked it up in, so that from then
+// on, a lookup which knows the id costs no more than indexing a vector.
+template <size_t N>
+class CountTable {
+  static const size_t Domains = 4;
+
+  struct Shared {
+    std::mutex mutex;
+    std::unordered_map<std::string, unsigned> slots;
+    std::vector<const std::string *> names; // keys of slots, by slot
+    std::vector<std::shared_ptr<ThreadCounters<N>>> threads;
+    // what threads which have since exited had counted
+    std::vector<Totals<N>> retired;
+  };
+
+  // what a thread keeps for each table it counts into.
+  struct Cache {
+    uint64_t table;
+    std::weak_ptr<Shared> shared;
+    std::shared_ptr<ThreadCounters<N>> counters;
+    std::unordered_map<std::string, unsigned> byName;
+    // slots by interned id, for each of the domains seen most recently,
+    // most recent first.
+    std::vector<std::pair<uint64_t, std::vector<unsigned>>> byId;
+
+    ~Cache() {
+      // hand the counts over to the table, if it's still there.
+      auto table = shared.lock();
+      if (!table) return;
+      std::lock_guard<std::mutex> lock(table->mutex);
+      table->retired.resize(table->names.size());
+      counters->addTo(table->retired);
+      table->threads.erase(std::find(table->threads.begin(),
+          table->threads.end(), counters));
+    }
+
+    std::vector<unsigned> &slotsFor(uint64_t domain) {
+      for (size_t i = 0; i < byId.size(); i++) {
+        if (byId[i].first == domain) {
+          if (i) std::swap(byId[0], byId[i]);
+          return byId[0].second;
+        }
+      }
+      if (byId.size() == Domains) byId.pop_back();
+      byId.emplace(byId.begin(), domain, std::vector<unsigned>());
+      return byId[0].second;
+    }
+  };
+
+  static std::vector<std::unique_ptr<Cache>> &threadCaches() {
+    thread_local std::vector<std::unique_ptr<Cache>> caches;
+    return caches;
+  }
+
+  uint64_t id_;
+  std::shared_ptr<Shared> shared_;
+
+  Cache &cache() {
+    auto &caches = threadCaches();
+    // nearly always the first.
+    for (size_t i = 0; i < caches.size(); i++) {
+      if (caches[i]->table == id_) {
+        if (i) std::swap(caches[0], caches[i]);
+        return *caches[0];
+      }
+    }
+    // first time in this table for this thread. forget any that are gone.
+    caches.erase(std::remove_if(caches.begin(), caches.end(),
+        [](const std::unique_ptr<Cache> &c) { return c->shared.expired(); }),
+        caches.end());
+    std::unique_ptr<Cache> fresh(new Cache);
+    fresh->table = id_;
+    fresh->shared = shared_;
+    fresh->counters = std::make_shared<ThreadCounters<N>>();
+    {
+      std::lock_guard<std::mutex> lock(shared_->mutex);
+      shared_->threads.push_back(fresh->counters);
+    }
+    caches.insert(caches.begin(), std::move(fresh));
+    return *caches[0];
+  }
+
+  unsigned slot(Cache &cache, const std::string &name) {
+    auto it = cache.byName.find(name);
+    if (it != cache.byName.end()) return it->second;
+    unsigned slot;
+    {
+      std::lock_guard<std::mutex> lock(shared_->mutex);
+      auto pr = shared_->slots.insert(
+          std::make_pair(name, (unsigned)shared_->names.size()));
+      if (pr.second) shared_->names.push_back(&pr.first->first);
+      slot = pr.first->second;
+    }
+    cache.byName.insert(std::make_pair(name, slot));
+    return slot;
+  }
+
+public:
+  CountTable() : id_(nextTable.fetch_add(1, std::memory_order_relaxed)),
+    shared_(std::make_shared<Shared>()) {}
+
+  // this thread's counters for the given name, which the given domain (see
+  // PropertyKeyBase) interned as id, unless that's NoId.
+  Counters<N> &get(const std::string &name, uint64_t domain = 0,
+      unsigned id = NoId) {
+    Cache &c = cache();
+    if (id == NoId) return c.counters->at(slot(c, name));
+    auto &slots = c.slotsFor(domain);
+    if (id < slots.size() && slots[id] != NoSlot)
+      return c.counters->at(slots[id]);
+    if (id >= slots.size()) slots.resize(id + 1, NoSlot);
+    slots[id] = slot(c, name);
+    return c.counters->at(slots[id]);
+  }
+
+  // every name counted at all, with its counts summed across threads.
+  template <typename F>
+  void forEach(F &&f) const {
+    std::lock_guard<std::mutex> lock(shared_->mutex);
+    std::vector<Totals<N>> totals(shared_->retired);
+    totals.resize(shared_->names.size());
+    for (auto it = shared_->threads.cbegin(); it != shared_->threads.cend();
+        ++it)
+      (*it)->addTo(totals);
+    for (size_t i = 0; i < totals.size(); i++)
+      for (size_t n = 0; n < N; n++)
+        if (totals[i][n]) {
+          f(*shared_->names[i], totals[i]);
+          break;
+        }
+  }
+
+  // zero every count in place. a count racing with this may survive it.
+  void reset() {
+    std::lock_guard<std::mutex> lock(shared_->mutex);
+    for (auto it = shared_->threads.cbegin(); it != shared_->threads.cend();
+        ++it)
+      (*it)->zero();
+    shared_->retired.clear();
+  }
+};
+
+enum { Hits, Misses, Conflicts };
+
+std::string contextName(const CcsContext &context) {
+  std::ostringstream str;
+  str << context;
+  return str.str();
+}
+
+void jsonString(std::ostream &os, const std::string &str) {
+  os << '"';
+  for (auto it = str.cbegin(); it != str.cend(); ++it) {
+    switch (*it) {
+      case '"': os << "\\\""; break;
+      case '\\': os << "\\\\"; break;
+      case '\n': os << "\\n"; break;
+      case '\r': os << "\\r"; break;
+      case '\t': os << "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(*it) < 0x20) {
+          const char *hex = "0123456789abcdef";
+          os << "\\u00" << hex[(*it >> 4) & 0xf] << hex[*it & 0xf];
+        } else {
+          os << *it;
+        }
+    }
+  }
+  os << '"';
+}
+
+}
+
+class CcsStatsTracer::Impl {
+public:
+  std::shared_ptr<CcsTracer> delegate;
+  bool trackContexts;
+  CountTable<3> properties; // Hits, Misses, Conflicts
+  CountTable<1> contexts;
+
+  Impl(std::shared_ptr<CcsTracer> delegate, bool trackContexts) :
+    delegate(std::move(delegate)), trackContexts(trackContexts) {}
+
+  void countContext(const CcsContext &context, uint64_t lookups = 1) {
+    if (trackContexts) contexts.get(contextName(context)).add(0, lookups);
+  }
+};
+
+CcsStatsTracer::CcsStatsTracer(std::shared_ptr<CcsTracer> delegate,
+    bool trackContexts) :
+  impl(new Impl(std::move(delegate), trackContexts)) {}
+
+CcsStatsTracer::~CcsStatsTracer() {}
+
+void CcsStatsTracer::onPropertyFound(const CcsContext &ccsContext,
+    const std::string &propertyName, const CcsProperty &prop) {
+  impl->properties.get(propertyName).add(Hits);
+  impl->countContext(ccsContext);
+  if (impl->delegate)
+    impl->delegate->onPropertyFound(ccsContext, propertyName, prop);
+}
+
+void CcsStatsTracer::onPropertyNotFound(const CcsContext &ccsContext,
+    const std::string &propertyName) {
+  impl->properties.get(propertyName).add(Misses);
+  impl->countContext(ccsContext);
+  if (impl->delegate)
+    impl->delegate->onPropertyNotFound(ccsContext, propertyName);
+}
+
+void CcsStatsTracer::onConflict(const CcsContext &ccsContext,
+    const std::string &propertyName,
+    const std::vector<const CcsProperty *> values) {
+  // the lookup itself is counted by the onPropertyFound() that follows.
+  impl->properties.get(propertyName).add(Conflicts);
+  if (impl->delegate)
+    impl->delegate->onConflict(ccsContext, propertyName, values);
+}
+
+void CcsStatsTracer::onParseError(const std::string &msg) {
+  if (impl->delegate) impl->delegate->onParseError(msg);
+}
+
+void CcsStatsTracer::onPropertiesFound(const CcsContext &ccsContext,
+    const std::vector<std::string> &propertyNames,
+    const CcsProperty *const *props) {
+  for (size_t i = 0; i < propertyNames.size(); i++)
+    impl->properties.get(propertyNames[i]).add(props[i] ? Hits : Misses);
+  impl->countContext(ccsContext, propertyNames.size());
+  if (impl->delegate)
+    impl->delegate->onPropertiesFound(ccsContext, propertyNames, props);
+}
+
+void CcsStatsTracer::onInternedPropertyFound(const CcsContext &ccsContext,
+    const std::string &propertyName, uint64_t domain, unsigned id,
+    const CcsProperty &prop) {
+  impl->properties.get(propertyName, domain, id).add(Hits);
+  impl->countContext(ccsContext);
+  if (impl->delegate)
+    impl->delegate->onInternedPropertyFound(ccsContext, propertyName, domain,
+        id, prop);
+}
+
+void CcsStatsTracer::onInternedPropertyNotFound(const CcsContext &ccsContext,
+    const std::string &propertyName, uint64_t domain, unsigned id) {
+  impl->properties.get(propertyName, domain, id).add(Misses);
+  impl->countContext(ccsContext);
+  if (impl->delegate)
+    impl->delegate->onInternedPropertyNotFound(ccsContext, propertyName,
+        domain, id);
+}
+
+void CcsStatsTracer::onInternedPropertiesFound(const CcsContext &ccsContext,
+    const std::vector<std::string> &propertyNames, uint64_t domain,
+    const unsigned *ids, const CcsProperty *const *props) {
+  for (size_t i = 0; i < propertyNames.size(); i++)
+    impl->properties.get(propertyNames[i], domain, ids[i])
+        .add(props[i] ? Hits : Misses);
+  impl->countContext(ccsContext, propertyNames.size());
+  if (impl->delegate)
+    impl->delegate->onInternedPropertiesFound(ccsContext, propertyNames,
+        domain, ids, props);
+}
+
+CcsStatsTracer::Snapshot CcsStatsTracer::snapshot() const {
+  Snapshot result;
+  impl->properties.forEach([&](const std::string &name,
+      const Totals<3> &counts) {
+    result.properties.push_back(PropertyStats{name, counts[Hits],
+        counts[Misses], counts[Conflicts]});
+  });
+  impl->contexts.forEach([&](const std::string &name,
+      const Totals<1> &counts) {
+    result.contexts.push_back(ContextStats{name, counts[0]});
+  });
+
+  std::sort(result.properties.begin(), result.properties.end(),
+      [](const PropertyStats &l, const PropertyStats &r) {
+    if (l.lookups() != r.lookups()) return l.lookups() > r.lookups();
+    return l.name < r.name;
+  });
+  std::sort(result.contexts.begin(), result.contexts.end(),
+      [](const ContextStats &l, const ContextStats &r) {
+    if (l.lookups != r.lookups) return l.lookups > r.lookups;
+    return l.context < r.context;
+  });
+  return result;
+}
+
+void CcsStatsTracer::reset() {
+  impl->properties.reset();
+  impl->contexts.reset();
+}
+
+void CcsStatsTracer::dumpText(std::ostream &os) const {
+  Snapshot snap = snapshot();
+  os << "Property lookups (hits/misses/conflicts):\n";
+  for (auto it = snap.properties.cbegin(); it != snap.properties.cend(); ++it)
+    os << "  " << it->name << ": " << it->hits << '/' << it->misses << '/'
+        << it->conflicts << "\n";
+  if (!impl->trackContexts) return;
+  os << "Lookups by context:\n";
+  for (auto it = snap.contexts.cbegin(); it != snap.contexts.cend(); ++it)
+    os << "  [" << it->context << "]: " << it->lookups << "\n";
+}
+
+void CcsStatsTracer::dumpJson(std::ostream &os) const {
+  Snapshot snap = snapshot();
+  os << "{\"properties\":[";
+  bool first = true;
+  for (auto it = snap.properties.cbegin(); it != snap.properties.cend(); ++it) {
+    if (!first) os << ',';
+    first = false;
+    os << "{\"name\":";
+    jsonString(os, it->name);
+    os << ",\"hits\":" << it->hits << ",\"misses\":" << it->misses
+        << ",\"conflicts\":" << it->conflicts << '}';
+  }
+  os << "],\"contexts\":[";
+  first = true;
+  for (auto it = snap.contexts.cbegin(); it != snap.contexts.cend(); ++it) {
+    if (!first) os << ',';
+    first = false;
+    os << "{\"context\":";
+    jsonString(os, it->context);
+    os << ",\"lookups\":" << it->lookups << '}';
+  }
+  os << "]}";
+}
+
+}
@@ -1,5 +1,6 @@
 #include <cstdlib>
 #include <istream>
+#include <map>
 
 #include <gtest/gtest.h>
 
@@ -60,6 +61,65 @@ TEST(CcsTest, Import) {
   ASSERT_NO_THROW(EXPECT_EQ("nitz", ctx.getString("frob")));
 }
 
+namespace {
+
+struct MapImportResolver : ccs::ImportResolver {
+  std::map<std::string, std::string> files;
+
+  virtual bool resolve(const std::string &location,
+      std::function<bool(std::istream &)> load) {
+    auto it = files.find(location);
+    if (it == files.end()) return false;
+    std::istringstream stream(it->second);
+    return load(stream);
+  }
+};
+
+}
+
+TEST(CcsTest, ParseCache) {
+  CcsParseCache cache;
+  MapImportResolver ir;
+  ir.files["a"] = "@import 'b'; a = 1; x { @import 'c' }";
+  ir.files["b"] = "b = 2";
+  ir.files["c"] = "c = 3; a = 4";
+
+  auto load = [&]() {
+    auto ccs = std::make_shared<CcsDomain>();
+    std::istringstream input("@import 'a'; top = 0");
+    ccs->loadCcsStream(input, "<literal>", ir, cache);
+    return ccs;
+  };
+
+  CcsContext ctx = load()->build().constrain("x");
+  EXPECT_EQ(4u, cache.parses());
+  EXPECT_EQ(0u, cache.reuses());
+  EXPECT_EQ(4u, cache.size());
+  EXPECT_EQ(4, ctx.getInt("a"));
+
+  // only the changed file, nested two imports deep, is parsed again
+  ir.files["c"] = "c = 5; a = 6";
+  ctx = load()->build().constrain("x");
+  EXPECT_EQ(5u, cache.parses());
+  EXPECT_EQ(3u, cache.reuses());
+  EXPECT_EQ(2, ctx.getInt("b"));
+  EXPECT_EQ(5, ctx.getInt("c"));
+  EXPECT_EQ(6, ctx.getInt("a"));
+
+  // a failed import fails the whole load, as always, but a later fix is
+  // picked up without parsing anything else.
+  ir.files.erase("b");
+  EXPECT_TRUE(load()->loadFailed());
+  ir.files["b"] = "b = 7";
+  auto ccs = load();
+  EXPECT_FALSE(ccs->loadFailed());
+  EXPECT_EQ(7, ccs->build().getInt("b"));
+  EXPECT_EQ(6u, cache.parses());
+
+  cache.clear();
+  EXPECT_EQ(0u, cache.size());
+}
+
 TEST(CcsTest, Types) {
   CcsDomain ccs;
   std::istringstream input("a = 3; a2 = 0xff; b = true; c = 1.23; d = 'ok'");
@@ -195,6 +255,214 @@ TEST(CcsTest, DomainBuilder) {
   EXPECT_EQ("base", ctx.constrain("c").getString("a"));
 }
 
+TEST(CcsTest, RootTerms) {
+  // every kind of step a child of the root can be keyed by.
+  CcsDomain ccs;
+  std::istringstream input(
+      "@constrain e\n"
+      "p = 0\n"
+      "a { p = 1 }\n"
+      "a.x { p = 2 }\n"
+      "a.x.y { p = 3 }\n"
+      "a.x/b.y { p = 4 }\n"
+      "e a.z { p = 5 }\n"
+      "c : @constrain a.x\n");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsContext ctx = ccs.build();
+  EXPECT_EQ(0, ctx.getInt("p"));
+  EXPECT_EQ(1, ctx.constrain("a").getInt("p"));
+  EXPECT_EQ(2, ctx.constrain("a", v("x")).getInt("p"));
+  EXPECT_EQ(3, ctx.constrain("a", {"y", "x"}).getInt("p"));
+  EXPECT_EQ(4, ctx.builder().add("b", v("y")).add("a", v("x")).build()
+      .getInt("p"));
+  EXPECT_EQ(2, ctx.constrain("b", v("y")).constrain("a", v("x")).getInt("p"));
+  EXPECT_EQ(5, ctx.constrain("a", v("z")).getInt("p"));
+  EXPECT_EQ(2, ctx.constrain("c").getInt("p"));
+  EXPECT_EQ(1, ctx.constrain("q").constrain("a").getInt("p"));
+
+  // the root is shared between builds, but not across changes to the rules.
+  ccs.ruleBuilder().select("d").set("p", "6");
+  EXPECT_EQ(6, ccs.build().constrain("d").getInt("p"));
+  EXPECT_EQ(0, ctx.constrain("d").getInt("p"));
+}
+
+TEST(CcsTest, Specialize) {
+  CcsDomain ccs;
+  std::istringstream input(
+      "p = 0\n"
+      "env.prod { p = 1 }\n"
+      "env.dev { p = 2; q = 9 }\n"
+      "env.prod region.us { p = 3 }\n"
+      "env.dev region.us { p = 4 }\n"
+      "region.us { r = 1 }\n"
+      "env.prod > svc.api { t = 5 }\n"
+      "env.dev, svc.web { s = 1 }\n"
+      "env.prod, region.eu { u = 2 }\n"
+      "env.stage region.us { q = 7 }\n"
+      "svc.batch : @constrain env.stage\n");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsContext prod = ccs.build().constrain("env", v("prod"));
+  auto special = ccs.specialize(prod);
+  CcsContext root = special->build();
+
+  std::ostringstream str;
+  str << root;
+  EXPECT_EQ("env.prod", str.str());
+  std::vector<std::pair<std::string, std::string>> steps{
+      {"region", "us"}, {"region", "eu"}, {"svc", "api"}, {"svc", "web"},
+      {"svc", "batch"}};
+  auto same = [&](const CcsContext &a, const CcsContext &b) {
+    for (const char *name : {"p", "q", "r", "s", "t", "u"})
+      EXPECT_EQ(a.getString(name, "-"), b.getString(name, "-")) << name;
+  };
+  same(prod, root);
+  for (auto &first : steps) {
+    CcsContext a = prod.constrain(first.first, v(first.second));
+    CcsContext b = root.constrain(first.first, v(first.second));
+    same(a, b);
+    for (auto &second : steps)
+      same(a.constrain(second.first, v(second.second)),
+          b.constrain(second.first, v(second.second)));
+  }
+
+  // the rules for env.dev are gone, but those for env.stage are kept, since
+  // an @constrain can still reach them.
+  EXPECT_EQ(5u, ccs.definitionsOf("p").size());
+  EXPECT_EQ(3u, special->definitionsOf("p").size());
+  ASSERT_EQ(1u, special->definitionsOf("q").size());
+  EXPECT_EQ("7", special->definitionsOf("q")[0].value);
+  EXPECT_EQ(1u, special->definitionsOf("s").size());
+
+  EXPECT_THROW(special->specialize(prod), std::invalid_argument);
+  auto twice = special->specialize(root.constrain("region", v("us")));
+  str.str("");
+  str << twice->build();
+  EXPECT_EQ("env.prod > region.us", str.str());
+  EXPECT_EQ(3, twice->build().getInt("p"));
+  EXPECT_EQ(5, twice->build().constrain("svc", v("api")).getInt("t"));
+}
+
+TEST(CcsTest, SelectorNormalization) {
+  CcsDomain ccs;
+  std::istringstream input(
+      "(a, b) c { p = 1 }\n"
+      "b c, c a { q = 2 }\n"
+      "c b a { r = 3 }\n"
+      "a (b c) { s = 4 }\n"
+      "a, a.x, a { t = 5 }\n"
+      "a.x, a { u = 6 }\n"
+      "(a b) a { v = 7 }\n"
+      "a b { v = 8 }\n");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+
+  EXPECT_EQ("(c (a, b))", ccs.definitionsOf("p")[0].selector);
+  EXPECT_EQ(ccs.definitionsOf("p")[0].selector,
+      ccs.definitionsOf("q")[0].selector);
+  EXPECT_EQ("((a b) c)", ccs.definitionsOf("r")[0].selector);
+  EXPECT_EQ(ccs.definitionsOf("r")[0].selector,
+      ccs.definitionsOf("s")[0].selector);
+  EXPECT_EQ("(a, a.x)", ccs.definitionsOf("t")[0].selector);
+  EXPECT_EQ(ccs.definitionsOf("t")[0].selector,
+      ccs.definitionsOf("u")[0].selector);
+
+  CcsContext ctx = ccs.build();
+  EXPECT_EQ(1, ctx.constrain("a").constrain("c").getInt("p"));
+  EXPECT_EQ(2, ctx.constrain("b").constrain("c").getInt("q"));
+  EXPECT_FALSE(ctx.constrain("a").constrain("b").getInt("q", 0));
+  // a leg repeated in a conjunction still counts twice.
+  EXPECT_EQ(7, ctx.constrain("a").constrain("b").getInt("v"));
+}
+
+TEST(CcsTest, Optimize) {
+  const char *rules =
+      "a b c { p = 1 }\n"
+      "a { b c { q = 2 } }\n"
+      "a c { b { r = 3 } }\n"
+      "e { }\n"
+      "f > g { }\n"
+      "f, g { }\n"
+      "h { @constrain i.j }\n"
+      "i.j { s = 4 }\n";
+  CcsDomain plain;
+  CcsDomain ccs;
+  std::istringstream input1(rules);
+  plain.loadCcsStream(input1, "<literal>", ImportResolver::None);
+  std::istringstream input2(rules);
+  ccs.loadCcsStream(input2, "<literal>", ImportResolver::None);
+
+  CcsOptimizeStats stats = ccs.optimize();
+  std::ostringstream str;
+  str << stats;
+  EXPECT_EQ("Optimized rule dag: 17 -> 8 nodes (2 merged), 7 -> 2 tallies",
+      str.str());
+  str.str("");
+  str << ccs.optimize();
+  EXPECT_EQ("Optimized rule dag: 8 -> 8 nodes (0 merged), 2 -> 2 tallies",
+      str.str());
+
+  auto defs = ccs.definitionsOf("q");
+  ASSERT_EQ(1u, defs.size());
+  EXPECT_EQ(ccs.definitionsOf("p")[0].selector, defs[0].selector);
+  EXPECT_EQ("2", defs[0].value);
+
+  std::vector<std::string> names{"a", "b", "c", "e", "h"};
+  std::vector<std::pair<CcsContext, CcsContext>> contexts{
+      {plain.build(), ccs.build()}};
+  for (size_t depth = 0; depth < 3; depth++) {
+    size_t n = contexts.size();
+    for (size_t i = 0; i < n; i++)
+      for (auto &name : names)
+        contexts.emplace_back(contexts[i].first.constrain(name),
+            contexts[i].second.constrain(name));
+  }
+  for (auto &pr : contexts)
+    for (const char *name : {"p", "q", "r", "s"})
+      EXPECT_EQ(pr.first.getString(name, "-"), pr.second.getString(name, "-"))
+          << name << " in " << pr.first;
+}
+
+TEST(CcsTest, BulkLoad) {
+  CcsDomain ccs;
+  std::istringstream input("region.us env.prod { x = parsed }");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsBulkLoader loader = ccs.bulkLoader("<db>");
+  auto root = loader.selector({});
+  auto prod = loader.selector({{"env", {"prod"}}});
+  auto prodUs = loader.selector({{"env", {"prod"}}, {"region", {"us"}}});
+  EXPECT_EQ(prodUs, loader.selector(
+      {{"region", {"us"}}, {"env", {"prod"}}, {"region", {"us"}}}));
+  auto a = loader.property("a");
+  auto b = loader.property("b");
+  EXPECT_EQ(a, ccs.propertyKey<int>("a").id());
+
+  loader.add({{root, prod, prodUs}, {a, a, a}, {"1", "2", "3"}, {}});
+  loader.add({{prod, prodUs}, {b, b}, {"x", "y"}, {true, false}});
+  EXPECT_EQ(5u, loader.staged());
+  EXPECT_FALSE(ccs.build().getInt("a", 0));
+
+  EXPECT_EQ(5u, loader.commit());
+  EXPECT_EQ(0u, loader.staged());
+  CcsContext ctx = ccs.build();
+  EXPECT_EQ(1, ctx.getInt("a"));
+  CcsContext prodCtx = ctx.constrain("env", v("prod"));
+  EXPECT_EQ(2, prodCtx.getInt("a"));
+  EXPECT_EQ(3, prodCtx.constrain("region", v("us")).getInt("a"));
+  // the override wins over the more specific setting.
+  EXPECT_EQ("x", prodCtx.constrain("region", v("us")).getString("b"));
+
+  auto defs = ccs.definitionsOf("a");
+  ASSERT_EQ(3u, defs.size());
+  EXPECT_EQ(ccs.definitionsOf("x")[0].selector, defs[2].selector);
+  EXPECT_EQ("<db>", defs[2].origin.fileName);
+  EXPECT_EQ(3u, defs[2].origin.line);
+
+  EXPECT_THROW(loader.add({{root}, {a}, {}, {}}), std::invalid_argument);
+  EXPECT_THROW(loader.add({{42}, {a}, {"1"}, {}}), std::invalid_argument);
+  EXPECT_THROW(loader.add({{root}, {1000}, {"1"}, {}}),
+      std::invalid_argument);
+  EXPECT_EQ(0u, loader.staged());
+}
+
 TEST(CcsTest, DomainBuilderNestedSelect) {
   CcsDomain ccs;
   ccs.ruleBuilder()
@@ -283,3 +551,218 @@ TEST(CcsTest, Graphviz) {
   EXPECT_NE(std::string::npos, out.str().find("p1 = 1"));
   EXPECT_NE(std::string::npos, out.str().find("p2 = 2"));
 }
+
+namespace {
+
+std::vector<CcsConflict> conflicts(const std::string &rules) {
+  CcsDomain ccs(std::make_shared<FailingLogger>());
+  std::istringstream input(rules);
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  return ccs.findConflicts();
+}
+
+}
+
+TEST(CcsTest, FindConflicts) {
+  auto result = conflicts("a.b: x = 1; a.c: x = 2; y = 1");
+  ASSERT_EQ(1u, result.size());
+  EXPECT_EQ("x", result[0].propertyName);
+  EXPECT_FALSE(result[0].override);
+  ASSERT_EQ(2u, result[0].definitions.size());
+  EXPECT_EQ("1", result[0].definitions[0].value);
+  EXPECT_EQ(1u, result[0].definitions[0].origin.line);
+  EXPECT_FALSE(result[0].definitions[0].viaTally);
+  EXPECT_EQ("2", result[0].definitions[1].value);
+
+  std::ostringstream str;
+  str << result[0];
+  EXPECT_EQ("Potential conflict for property 'x': <literal>:1 (1), "
+      "<literal>:1 (2)", str.str());
+
+  result = conflicts("x = 1\nx = 2");
+  ASSERT_EQ(1u, result.size());
+  EXPECT_EQ(2u, result[0].definitions[1].origin.line);
+
+  result = conflicts("a b: x = 1; c d: x = 2");
+  ASSERT_EQ(1u, result.size());
+  EXPECT_TRUE(result[0].definitions[0].viaTally);
+  EXPECT_TRUE(result[0].definitions[1].viaTally);
+}
+
+TEST(CcsTest, FindConflictsNoFalsePositives) {
+  // resolved by a more specific conjunction
+  EXPECT_TRUE(conflicts("a: x = 1; b: x = 2; a b: x = 3").empty());
+  // different specificities
+  EXPECT_TRUE(conflicts("a b: x = 1; c: x = 2").empty());
+  EXPECT_TRUE(conflicts("a.b: x = 1; c: x = 2").empty());
+  // different override status
+  EXPECT_TRUE(conflicts("a: @override x = 1; b: x = 2").empty());
+  // a single definition reachable via several paths
+  EXPECT_TRUE(conflicts("a, b: x = 1").empty());
+  // but an override tie is still a tie
+  EXPECT_EQ(1u, conflicts("a: @override x = 1; b: @override x = 2; "
+      "a b: x = 3").size());
+}
+
+TEST(CcsTest, DefinitionsOf) {
+  CcsDomain ccs(std::make_shared<FailingLogger>());
+  std::istringstream input("x = 0\n"
+      "a.b { c { x = 1 } }\n"
+      "a b: @override x = 2\n"
+      "a, d: y = 3\n"
+      "a.b > c: x = 4");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  ccs.propertyKey<int>("unused");
+
+  auto defs = ccs.definitionsOf("x");
+  ASSERT_EQ(4u, defs.size());
+  EXPECT_EQ("", defs[0].selector);
+  EXPECT_EQ("0", defs[0].value);
+  EXPECT_EQ("(a.b c)", defs[1].selector);
+  EXPECT_EQ(2u, defs[1].origin.line);
+  EXPECT_EQ("(a b)", defs[2].selector);
+  EXPECT_TRUE(defs[2].override);
+  EXPECT_EQ("a.b > c", defs[3].selector);
+  EXPECT_EQ("4", defs[3].value);
+
+  defs = ccs.definitionsOf("y");
+  ASSERT_EQ(1u, defs.size());
+  EXPECT_EQ("(a, d)", defs[0].selector);
+
+  EXPECT_TRUE(ccs.definitionsOf("unused").empty());
+  EXPECT_TRUE(ccs.definitionsOf("nope").empty());
+  EXPECT_EQ((std::vector<std::string>{"x", "y"}), ccs.definedProperties());
+}
+
+TEST(CcsTest, BatchLookup) {
+  CcsDomain ccs;
+  std::istringstream input("a = 1; b = 2; c.d { b = 3; e = 4 }");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsContext ctx = ccs.build().constrain("c", v("d"));
+
+  const CcsProperty *props[4];
+  EXPECT_EQ(3u, ctx.getProperties({"a", "b", "nope", "e"}, props));
+  EXPECT_EQ(1, props[0]->intValue());
+  EXPECT_EQ(3, props[1]->intValue());
+  EXPECT_EQ(nullptr, props[2]);
+  EXPECT_EQ(4, props[3]->intValue());
+
+  CcsContext::PropertySet set({"e", "a", "e"});
+  EXPECT_EQ(3u, ctx.getProperties(set, props));
+  EXPECT_EQ(4, props[0]->intValue());
+  EXPECT_EQ(1, props[1]->intValue());
+  EXPECT_EQ(4, props[2]->intValue());
+
+  // interned by the domain, including a name defined nowhere
+  auto interned = ccs.propertySet({"b", "nope", "a", "e"});
+  EXPECT_EQ(4u, interned.ids().size());
+  EXPECT_EQ(3u, ctx.getProperties(interned, props));
+  EXPECT_EQ(3, props[0]->intValue());
+  EXPECT_EQ(nullptr, props[1]);
+  EXPECT_EQ(1, props[2]->intValue());
+  EXPECT_EQ(4, props[3]->intValue());
+
+  // another domain's set falls back to looking names up
+  CcsDomain other;
+  std::istringstream otherInput("nope = 5; a = 6");
+  other.loadCcsStream(otherInput, "<literal>", ImportResolver::None);
+  EXPECT_EQ(2u, other.build().getProperties(interned, props));
+  EXPECT_EQ(nullptr, props[0]);
+  EXPECT_EQ(5, props[1]->intValue());
+  EXPECT_EQ(6, props[2]->intValue());
+  EXPECT_EQ(nullptr, props[3]);
+}
+
+TEST(CcsTest, PropertyKeys) {
+  CcsDomain ccs;
+  auto early = ccs.propertyKey<int>("early");
+  std::istringstream input("a = 3; b = 'x'; c = 1.5; d = true; early = 7\n"
+      "e.f { a = 4 }");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  auto a = ccs.propertyKey<int>("a");
+  auto b = ccs.propertyKey<std::string>("b");
+  auto c = ccs.propertyKey<double>("c");
+  auto d = ccs.propertyKey<bool>("d");
+  auto foo = ccs.propertyKey<Foo>("a");
+  auto nope = ccs.propertyKey<int>("nope");
+  auto badInt = ccs.propertyKey<int>("b");
+  CcsContext ctx = ccs.build();
+
+  EXPECT_EQ(3, ctx.get(a));
+  EXPECT_EQ(4, ctx.constrain("e", v("f")).get(a));
+  EXPECT_EQ("x", ctx.get(b));
+  EXPECT_EQ(1.5, ctx.get(c));
+  EXPECT_TRUE(ctx.get(d));
+  EXPECT_EQ(3, ctx.get(foo).x);
+  EXPECT_EQ(7, ctx.get(early));
+  EXPECT_THROW(ctx.get(nope), no_such_property);
+  EXPECT_EQ(5, ctx.get(nope, 5));
+  int i = 0;
+  EXPECT_FALSE(ctx.getInto(i, nope));
+  EXPECT_TRUE(ctx.getInto(i, a));
+  EXPECT_EQ(3, i);
+  EXPECT_THROW(ctx.get(badInt), bad_coercion);
+  EXPECT_EQ(5, ctx.get(badInt, 5));
+  EXPECT_FALSE(ctx.getInto(i, badInt));
+  EXPECT_EQ(3, i);
+  Foo f{0};
+  EXPECT_TRUE(ctx.getInto(f, foo));
+  EXPECT_EQ(3, f.x);
+  EXPECT_EQ(9, ctx.get(ccs.propertyKey<Foo>("b"), Foo{9}).x);
+
+  CcsSnapshot snap = ctx.snapshot();
+  EXPECT_EQ(3, snap.get(a));
+  EXPECT_EQ("x", snap.get(b));
+  EXPECT_EQ(5, snap.get(nope, 5));
+  EXPECT_THROW(snap.get(badInt), bad_coercion);
+  EXPECT_EQ(5, snap.get(badInt, 5));
+  EXPECT_FALSE(snap.getInto(i, badInt));
+
+  // keys from another domain fall back to the name
+  CcsDomain other;
+  other.ruleBuilder().set("x", "1").set("a", "2");
+  EXPECT_EQ(2, other.build().get(a));
+  EXPECT_EQ(2, other.build().snapshot().get(a));
+
+  // nor is a later domain mistaken for a freed one, even at the same address
+  std::unique_ptr<CcsDomain> gone(new CcsDomain);
+  gone->ruleBuilder().set("a", "1").set("b", "2");
+  auto stale = gone->propertyKey<int>("b");
+  gone.reset();
+  for (int n = 0; n < 20; n++) {
+    std::unique_ptr<CcsDomain> later(new CcsDomain);
+    later->ruleBuilder().set("b", "3").set("a", "4");
+    EXPECT_EQ(3, later->build().get(stale));
+  }
+}
+
+namespace {
+
+// implements only what CcsProperty requires, as code outside ccs might.
+struct FixedProperty : public CcsProperty {
+  std::string value;
+  explicit FixedProperty(std::string value) : value(std::move(value)) {}
+  virtual bool exists() const { return true; }
+  virtual Origin origin() const { return Origin(); }
+  virtual const std::string &strValue() const { return value; }
+  virtual int intValue() const { return std::stoi(value); }
+  virtual double doubleValue() const { return std::stod(value); }
+  virtual bool boolValue() const { return value == "true"; }
+};
+
+}
+
+TEST(CcsTest, DefaultCoercion) {
+  int i = 0;
+  double d = 0;
+  bool b = false;
+  EXPECT_TRUE(FixedProperty("12").coerce(i));
+  EXPECT_EQ(12, i);
+  EXPECT_FALSE(FixedProperty("12x").coerce(i));
+  EXPECT_EQ(12, i);
+  EXPECT_TRUE(FixedProperty("1.5").coerce(d));
+  EXPECT_EQ(1.5, d);
+  EXPECT_TRUE(FixedProperty("true").coerce(b));
+  EXPECT_TRUE(b);
+  EXPECT_FALSE(FixedProperty("yes").coerce(b));
+}
@@ -0,0 +1,214 @@
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "ccs/ccs.h"
+
+using namespace ccs;
+
+// these are most useful when built with -DTSAN=On, but they at least check
+// that readers on different threads agree with each other otherwise.
+
+namespace {
+
+const int Threads = 8;
+const int Iterations = 200;
+
+std::string rules() {
+  std::ostringstream str;
+  str << "base = 0\n";
+  for (int i = 0; i < 10; i++) {
+    str << "svc.s" << i << " { base = " << i << "; x = 'svc" << i << "' }\n";
+    str << "svc.s" << i << " env.prod { x = 'prod" << i << "' }\n";
+    str << "svc.s" << i << " > region { @constrain tier.t" << i << " }\n";
+  }
+  str << "tier.t3 { y = 3 }\n";
+  str << "env.prod, env.staging { z = true }\n";
+  return str.str();
+}
+
+template <typename F>
+void inParallel(F &&f) {
+  std::vector<std::thread> threads;
+  for (int t = 0; t < Threads; t++)
+    threads.emplace_back([&f, t]() { f(t); });
+  for (auto it = threads.begin(); it != threads.end(); ++it)
+    it->join();
+}
+
+}
+
+TEST(ConcurrencyTest, SharedContexts) {
+  auto stats = std::make_shared<CcsStatsTracer>();
+  CcsDomain ccs(stats);
+  std::istringstream input(rules());
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  auto baseKey = ccs.propertyKey<int>("base");
+  CcsContext root = ccs.build();
+  CcsContext shared = root.constrain("env", {"prod"});
+  CcsSnapshot sharedSnap = shared.snapshot();
+
+  std::atomic<int> failures(0);
+  inParallel([&](int t) {
+    for (int i = 0; i < Iterations; i++) {
+      int svc = (t + i) % 10;
+      std::string s = "s" + std::to_string(svc);
+      CcsContext ctx = shared.constrain("svc", {s});
+      if (ctx.getInt("base") != svc) failures++;
+      if (ctx.get(baseKey) != svc) failures++;
+      if (ctx.getString("x") != "prod" + std::to_string(svc)) failures++;
+      if (!ctx.getBool("z")) failures++;
+
+      CcsContext region = ctx.constrain("region");
+      if (region.getInt("y", -1) != (svc == 3 ? 3 : -1)) failures++;
+
+      const CcsProperty *props[2];
+      if (region.getProperties({"base", "x"}, props) != 2) failures++;
+
+      CcsSnapshot snap = region.snapshot(sharedSnap);
+      if (snap.get(baseKey) != svc) failures++;
+      if (sharedSnap.getInt("base") != 0) failures++;
+
+      if (ccs.build().getInt("base") != 0) failures++;
+    }
+  });
+
+  EXPECT_EQ(0, failures.load());
+  auto snap = stats->snapshot();
+  ASSERT_FALSE(snap.properties.empty());
+  EXPECT_EQ("base", snap.properties[0].name);
+  EXPECT_EQ(uint64_t(Threads * Iterations * 6), snap.properties[0].lookups());
+}
+
+TEST(ConcurrencyTest, StatsReset) {
+  // counters must stay valid while another thread resets them.
+  auto stats = std::make_shared<CcsStatsTracer>(nullptr, true);
+  CcsDomain ccs(stats);
+  std::istringstream input(rules());
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsContext root = ccs.build();
+
+  inParallel([&](int t) {
+    for (int i = 0; i < Iterations; i++) {
+      if (t == 0) {
+        stats->reset();
+        continue;
+      }
+      root.constrain("svc", {"s" + std::to_string(i % 10)}).getInt("base");
+      root.getInt("p" + std::to_string(i % 10), 0);
+    }
+  });
+
+  stats->reset();
+  EXPECT_TRUE(stats->snapshot().properties.empty());
+  root.getInt("base");
+  EXPECT_EQ(1u, stats->snapshot().properties.size());
+}
+
+TEST(ConcurrencyTest, ContextLifetimes) {
+  // deep chains built from a shared root on one thread, read and released
+  // on others, after the domain itself is gone.
+  CcsContext root = [] {
+    CcsDomain ccs;
+    std::istringstream input(rules());
+    ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+    return ccs.build();
+  }();
+
+  std::vector<CcsContext> contexts(Threads, root);
+  inParallel([&](int t) {
+    CcsContext ctx = root.constrain("svc", {"s" + std::to_string(t % 10)});
+    for (int i = 0; i < Iterations; i++)
+      ctx = ctx.constrain("level", {std::to_string(i)});
+    contexts[t] = ctx;
+  });
+
+  std::atomic<int> failures(0);
+  inParallel([&](int t) {
+    int other = (t + 1) % Threads;
+    if (contexts[other].getInt("base") != other % 10) failures++;
+  });
+  inParallel([&](int t) {
+    contexts[t] = root;
+  });
+  EXPECT_EQ(0, failures.load());
+}
+
+TEST(ConcurrencyTest, LazyFirstAccess) {
+  // every thread races to be the first to read the same lazy contexts.
+  CcsDomain ccs;
+  std::istringstream input(rules());
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsContext lazy = ccs.build().lazy().constrain("env", {"prod"});
+
+  for (int i = 0; i < Iterations; i++) {
+    int svc = i % 10;
+    CcsContext ctx = lazy.constrain("svc", {"s" + std::to_string(svc)})
+        .constrain("region");
+    std::atomic<int> failures(0);
+    inParallel([&](int t) {
+      switch (t % 3) {
+      case 0:
+        if (ctx.getInt("base") != svc) failures++;
+        break;
+      case 1:
+        if (ctx.getInt("y", -1) != (svc == 3 ? 3 : -1)) failures++;
+        break;
+      default:
+        if (ctx.snapshot().getString("x") != "prod" + std::to_string(svc))
+          failures++;
+      }
+    });
+    ASSERT_EQ(0, failures.load());
+  }
+}
+
+TEST(ConcurrencyTest, ContextCache) {
+  // threads share a cache small enough to keep evicting.
+  CcsDomain ccs;
+  std::istringstream input(rules());
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsContext root = ccs.build();
+  CcsContextCache cache(16 * 2048);
+
+  std::atomic<int> failures(0);
+  inParallel([&](int t) {
+    for (int i = 0; i < Iterations; i++) {
+      int svc = (i + t) % 10;
+      CcsContext env = cache.constrain(root, "env", {"prod"});
+      CcsContext ctx = cache.constrain(env, "svc",
+          {"s" + std::to_string(svc)});
+      if (ctx.getString("x") != "prod" + std::to_string(svc)) failures++;
+      cache.constrain(ctx, "host", {"h" + std::to_string(i)});
+    }
+  });
+  EXPECT_EQ(0, failures.load());
+  auto stats = cache.stats();
+  EXPECT_EQ(uint64_t(Threads * Iterations * 3), stats.hits + stats.misses);
+  EXPECT_LT(0u, stats.evictions);
+}
+
+TEST(ConcurrencyTest, Matcher) {
+  // threads race to build and follow the same branches.
+  CcsDomain ccs;
+  std::istringstream input(rules());
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsMatcher matcher = ccs.matcher({"env", "svc"});
+
+  std::atomic<int> failures(0);
+  inParallel([&](int t) {
+    for (int i = 0; i < Iterations; i++) {
+      int svc = (i + t) % 10;
+      CcsSnapshot snapshot = matcher.match({"prod",
+          "s" + std::to_string(svc)});
+      if (snapshot.getString("x") != "prod" + std::to_string(svc))
+        failures++;
+    }
+  });
+  EXPECT_EQ(0, failures.load());
+  EXPECT_EQ(11u, matcher.size());
+}
@@ -45,3 +45,331 @@ TEST(ContextTest, StringFormatWithEmptyContext) {
   os << ctx;
   EXPECT_EQ("c > b/d.e", os.str());
 }
+
+TEST(ContextTest, Snapshot) {
+  CcsDomain ccs;
+  std::istringstream input(
+      "a = 1; b = 'x'; c = true; d = 1.5\n"
+      "e.f { a = 2; g = 3 }\n"
+      "e.f h { b = 'y' }");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsContext root = ccs.build();
+  CcsContext ctx = root.constrain("e", {"f"}).constrain("h");
+
+  CcsSnapshot snap = ctx.snapshot();
+  EXPECT_EQ(5u, snap.size());
+  EXPECT_GT(snap.memoryUsage(), 0u);
+  EXPECT_EQ(2, snap.getInt("a"));
+  EXPECT_EQ(2.0, snap.getDouble("a"));
+  EXPECT_EQ("y", snap.getString("b"));
+  EXPECT_TRUE(snap.getBool("c"));
+  EXPECT_EQ(1.5, snap.getDouble("d"));
+  EXPECT_EQ(3, snap.getInt("g"));
+  EXPECT_THROW(snap.getInt("b"), bad_coercion);
+  EXPECT_THROW(snap.getString("nope"), no_such_property);
+  EXPECT_EQ(7, snap.getInt("nope", 7));
+  EXPECT_FALSE(snap.getProperty("nope").exists());
+
+  int i = 0;
+  EXPECT_TRUE(snap.getInto(i, "g"));
+  EXPECT_EQ(3, i);
+
+  std::ostringstream os;
+  os << snap.context();
+  EXPECT_EQ("e.f > h", os.str());
+}
+
+TEST(ContextTest, IncrementalSnapshot) {
+  CcsDomain ccs;
+  std::istringstream input(
+      "a = 1; b = 2\n"
+      "e.f { a = 3; c = 4 }\n"
+      "e.f h { b = 5 }");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsContext root = ccs.build();
+  CcsSnapshot base = root.snapshot();
+  EXPECT_EQ(2u, base.size());
+
+  CcsContext ctx = root.constrain("e", {"f"}).constrain("h");
+  CcsSnapshot snap = ctx.snapshot(base);
+  EXPECT_EQ(3u, snap.size());
+  EXPECT_EQ(3, snap.getInt("a"));
+  EXPECT_EQ(5, snap.getInt("b"));
+  EXPECT_EQ(4, snap.getInt("c"));
+  // the base is unaffected
+  EXPECT_EQ(1, base.getInt("a"));
+
+  // not an ancestor, falls back to a full snapshot
+  CcsSnapshot other = root.constrain("h").snapshot(snap);
+  EXPECT_EQ(2u, other.size());
+  EXPECT_EQ(1, other.getInt("a"));
+}
+
+TEST(ContextTest, Template) {
+  CcsDomain ccs;
+  std::istringstream input(
+      "x = 0; y = 0; z = 0\n"
+      "service { x = 1 }\n"
+      "service.a { x = 2; y = 1 }\n"
+      "service.a > region.east { y = 2 }\n"
+      "region.east customer.c { x = 3 }\n"
+      "region.west customer.d, region.north customer.z { y = 4 }\n"
+      "customer.e : @constrain debug\n"
+      "debug { z = 5 }\n"
+      "service.a.b { x = 6 }");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsContextTemplate tmpl = ccs.contextTemplate(
+      {"service", "region", "customer"});
+  EXPECT_EQ(3u, tmpl.names().size());
+
+  std::vector<std::vector<std::string>> cases = {
+    {"a", "east", "c"}, {"a", "west", "d"}, {"b", "east", "e"},
+    {"a", "north", "z"}, {"z", "east", "d"}};
+  for (auto it = cases.cbegin(); it != cases.cend(); ++it) {
+    CcsContext expected = ccs.build().constrain("service", {(*it)[0]})
+        .constrain("region", {(*it)[1]}).constrain("customer", {(*it)[2]});
+    CcsContext actual = tmpl.build(*it);
+    std::ostringstream e, a;
+    e << expected;
+    a << actual;
+    EXPECT_EQ(e.str(), a.str());
+    EXPECT_EQ(expected.getInt("x"), actual.getInt("x")) << a.str();
+    EXPECT_EQ(expected.getInt("y"), actual.getInt("y")) << a.str();
+    EXPECT_EQ(expected.getInt("z"), actual.getInt("z")) << a.str();
+  }
+
+  CcsContext ctx = tmpl.build({"a", "east", "e"});
+  EXPECT_EQ(2, ctx.getInt("x"));
+  EXPECT_EQ(2, ctx.getInt("y"));
+  EXPECT_EQ(5, ctx.getInt("z"));
+
+  // starting somewhere other than the root...
+  ctx = tmpl.build(ccs.build().constrain("region", {"east"}),
+      {"a", "south", "c"});
+  EXPECT_EQ(3, ctx.getInt("x"));
+
+  EXPECT_THROW(tmpl.build({"a"}), std::invalid_argument);
+
+  // ...or in another domain entirely.
+  CcsDomain other;
+  std::istringstream otherInput("service.a { x = 7 }");
+  other.loadCcsStream(otherInput, "<literal>", ImportResolver::None);
+  EXPECT_EQ(7, tmpl.build(other.build(), {"a", "east", "c"}).getInt("x"));
+
+  // the index is out of date once the domain changes, so a newer parent
+  // falls back to constrain().
+  std::istringstream more("service.q { x = 8 }");
+  ccs.loadCcsStream(more, "<literal>", ImportResolver::None);
+  ccs.optimize();
+  EXPECT_EQ(8, tmpl.build(ccs.build(), {"q", "east", "d"}).getInt("x"));
+}
+
+TEST(ContextTest, Lazy) {
+  CcsDomain ccs;
+  std::istringstream input(
+      "a = 0\n"
+      "b.x { a = 1; c > d { a = 2 } }\n"
+      "c : @constrain e.f\n"
+      "e.f { g = 3 }");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsContext root = ccs.build();
+  CcsContext lazy = root.lazy();
+  EXPECT_EQ(0, lazy.getInt("a"));
+
+  CcsContext eager = root.constrain("b", {"x"}).constrain("c").constrain("d");
+  CcsContext ctx = lazy.constrain("b", {"x"}).constrain("c").constrain("d");
+  EXPECT_EQ(eager.getInt("a"), ctx.getInt("a"));
+  EXPECT_EQ(2, ctx.getInt("a"));
+  EXPECT_EQ(3, ctx.getInt("g"));
+
+  // nothing has read the intermediate context yet; printing it must still
+  // show the constraint it picked up.
+  std::ostringstream os;
+  os << lazy.constrain("b", {"x"}).constrain("c");
+  EXPECT_EQ("b.x > c/e.f", os.str());
+
+  // lazy contexts work as snapshot bases, in either direction.
+  CcsContext base = lazy.constrain("b", {"x"});
+  EXPECT_EQ(2, ctx.snapshot(base.snapshot()).getInt("a"));
+  EXPECT_EQ(1, root.constrain("b", {"x"}).lazy().snapshot().getInt("a"));
+}
+
+TEST(ContextTest, Compact) {
+  CcsDomain ccs;
+  std::istringstream input(
+      "@constrain r.s\n"
+      "a = 0; b = 0; c = 0\n"
+      "x { a = 1 }\n"
+      "x > y { b = 2 }\n"
+      "x > y > z { c = 3 }\n"
+      "x w { a = 4 }\n"
+      "y : @constrain w\n"
+      "x v > z { b = 5 }");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsContext root = ccs.build();
+  CcsContext deep = root.constrain("x").constrain("q").constrain("y");
+  CcsContext compacted = deep.compact();
+
+  std::ostringstream expected, actual;
+  expected << deep;
+  actual << compacted;
+  EXPECT_EQ("r.s > x > q > w/y", actual.str());
+  EXPECT_EQ(expected.str(), actual.str());
+  EXPECT_EQ(4, compacted.getInt("a"));
+  EXPECT_EQ(2, compacted.getInt("b"));
+
+  // descendants of the compacted context still see every ancestor's
+  // constraints, including half-matched conjunctions.
+  CcsContext child = compacted.constrain("z");
+  EXPECT_EQ(3, child.getInt("c"));
+  EXPECT_EQ(2, child.getInt("b"));
+  EXPECT_EQ(5, root.constrain("x").compact().constrain("v").compact()
+      .constrain("z").getInt("b"));
+  expected.str("");
+  expected << deep.constrain("z");
+  actual.str("");
+  actual << child.compact();
+  EXPECT_EQ(expected.str(), actual.str());
+
+  actual.str("");
+  actual << root.compact();
+  EXPECT_EQ("r.s", actual.str());
+}
+
+TEST(ContextTest, LongChainRelease) {
+  // releasing a chain this deep mustn't recurse once per ancestor.
+  CcsDomain ccs;
+  CcsContext ctx = ccs.build().lazy();
+  for (int i = 0; i < 100000; i++) ctx = ctx.constrain("a");
+  CcsContext copy = ctx;
+  ctx = ccs.build();
+  copy = ctx;
+  EXPECT_FALSE(copy.getProperty("a").exists());
+}
+
+TEST(ContextTest, Arena) {
+  CcsDomain ccs;
+  std::istringstream input(
+      "a = 0; b = 0; c = 0\n"
+      "x { a = 1 }\n"
+      "x > y { b = 2 }\n"
+      "x > y > z.v { c = 3 }\n"
+      "x w { a = 4 }\n"
+      "y : @constrain w");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsContext root = ccs.build();
+  CcsContext heap = root.constrain("x").constrain("y").constrain("z", {"v"});
+
+  CcsStackArena<256> arena;
+  CcsContext compacted = root;
+  for (int i = 0; i < 3; i++) {
+    {
+      // children inherit the arena, so only the first step names it.
+      CcsContext ctx = root.constrain(arena, "x").constrain("y")
+          .constrain("z", {"v"});
+      EXPECT_EQ(4, ctx.getInt("a"));
+      EXPECT_EQ(2, ctx.getInt("b"));
+      EXPECT_EQ(3, ctx.getInt("c"));
+      std::ostringstream expected, actual;
+      expected << heap;
+      actual << ctx;
+      EXPECT_EQ(expected.str(), actual.str());
+      EXPECT_EQ(4, ctx.lazy().constrain("q").getInt("a"));
+      // compacting copies everything back to the heap.
+      compacted = ctx.compact();
+    }
+    // every context in the arena is gone before it's reset. the first pass
+    // spills past the buffer; later ones reuse those blocks.
+    size_t used = arena.heapBytes();
+    EXPECT_LT(0u, used);
+    arena.reset();
+    EXPECT_EQ(used, arena.heapBytes());
+  }
+  EXPECT_EQ(3, compacted.getInt("c"));
+  std::ostringstream os;
+  os << compacted;
+  EXPECT_EQ("x > w/y > z.v", os.str());
+}
+
+TEST(ContextTest, Cache) {
+  CcsDomain ccs;
+  std::istringstream input(
+      "a = 0\n"
+      "x.p { a = 1 }\n"
+      "x.q x.p { a = 2 }");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsContext root = ccs.build();
+
+  CcsContextCache cache;
+  CcsContext first = cache.constrain(root, "x", {"q", "p"});
+  EXPECT_EQ(2, first.getInt("a"));
+  // values are normalized, so this is the same entry.
+  CcsContext second = cache.constrain(root, "x", {"p", "q", "p"});
+  EXPECT_EQ(2, second.getInt("a"));
+  EXPECT_EQ(1, cache.constrain(root, "x", {"p"}).getInt("a"));
+  EXPECT_EQ(2, cache.constrain(first, "x", {"p"}).getInt("a"));
+  auto stats = cache.stats();
+  EXPECT_EQ(1u, stats.hits);
+  EXPECT_EQ(3u, stats.misses);
+  EXPECT_EQ(3u, stats.entries);
+  EXPECT_EQ(0u, stats.evictions);
+  EXPECT_LT(0u, stats.bytes);
+
+  // a budget too small for even one entry per shard keeps nothing.
+  CcsContextCache tiny(16);
+  for (int i = 0; i < 100; i++)
+    EXPECT_EQ(0, tiny.constrain(root, "y", {"v" + std::to_string(i)})
+        .getInt("a"));
+  stats = tiny.stats();
+  EXPECT_EQ(100u, stats.evictions);
+  EXPECT_EQ(0u, stats.entries);
+  EXPECT_EQ(0u, stats.bytes);
+
+  // whereas a moderate budget holds some, but not all.
+  CcsContextCache bounded(16 * 4096);
+  for (int i = 0; i < 1000; i++)
+    bounded.constrain(root, "y", {"v" + std::to_string(i)});
+  stats = bounded.stats();
+  EXPECT_LT(0u, stats.entries);
+  EXPECT_GT(1000u, stats.entries);
+  EXPECT_GE(16u * 4096, stats.bytes);
+  EXPECT_EQ(1000u, stats.entries + stats.evictions);
+
+  cache.clear();
+  EXPECT_EQ(0u, cache.stats().entries);
+  EXPECT_EQ(2, cache.constrain(root, "x", {"p", "q"}).getInt("a"));
+}
+
+TEST(ContextTest, Matcher) {
+  CcsDomain ccs;
+  std::istringstream input(
+      "a = 0; b = 0\n"
+      "env.prod { a = 1 }\n"
+      "env.prod host { b = 2 }\n"
+      "host.special { a = 3; @constrain tier.gold }\n"
+      "env.prod tier.gold { b = 4 }\n"
+      "env.dev > host.special { a = 5 }");
+  ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  CcsMatcher matcher = ccs.matcher({"env", "host"});
+  CcsContext root = ccs.build();
+
+  const char *envs[] = {"prod", "dev", "qa"};
+  const char *hosts[] = {"special", "h1", "h2", "h3"};
+  for (auto env : envs) {
+    for (auto host : hosts) {
+      CcsSnapshot snapshot = matcher.match({env, host});
+      CcsContext ctx = root.constrain("env", {env}).constrain("host", {host});
+      EXPECT_EQ(ctx.getInt("a"), snapshot.getInt("a")) << env << " " << host;
+      EXPECT_EQ(ctx.getInt("b"), snapshot.getInt("b")) << env << " " << host;
+      EXPECT_EQ(ctx.getInt("a"),
+          matcher.context({env, host}).getInt("a"));
+    }
+  }
+  // every host but the one the rules mention shares a branch, as does every
+  // env but prod and dev.
+  EXPECT_EQ(3u + 3 * 2, matcher.size());
+  std::ostringstream os;
+  os << matcher.match({"prod", "h9"}).context();
+  EXPECT_EQ("env.prod > host.*", os.str());
+  EXPECT_THROW(matcher.match({"prod"}), std::invalid_argument);
+}
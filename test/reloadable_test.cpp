@@ -0,0 +1,458 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "ccs/ccs.h"
+
+using namespace ccs;
+
+namespace {
+
+struct QuietLogger : public CcsLogger {
+  virtual void info(const std::string &) {}
+  virtual void warn(const std::string &) {}
+  virtual void error(const std::string &) {}
+};
+
+CcsReloadableDomain::Loader loadString(const std::string &rules) {
+  return [rules](CcsDomain &ccs) {
+    std::istringstream input(rules);
+    ccs.loadCcsStream(input, "<literal>", ImportResolver::None);
+  };
+}
+
+std::shared_ptr<CcsTracer> quietTracer() {
+  return CcsTracer::makeLoggingTracer(std::make_shared<QuietLogger>());
+}
+
+struct MapImportResolver : ImportResolver {
+  std::map<std::string, std::string> files;
+
+  virtual bool resolve(const std::string &location,
+      std::function<bool(std::istream &)> load) {
+    auto it = files.find(location);
+    if (it == files.end()) return false;
+    std::istringstream stream(it->second);
+    return load(stream);
+  }
+};
+
+// every definition in a domain, in load order, as "selector: value" per
+// line, which is the same for two domains with the same rules.
+std::string definitions(const CcsDomain &ccs) {
+  std::ostringstream str;
+  auto names = ccs.definedProperties();
+  for (auto name = names.cbegin(); name != names.cend(); ++name) {
+    auto defs = ccs.definitionsOf(*name);
+    for (auto it = defs.cbegin(); it != defs.cend(); ++it)
+      str << *name << " (" << it->selector << "): " << it->value << "\n";
+  }
+  return str.str();
+}
+
+}
+
+TEST(ReloadableTest, Basics) {
+  CcsReloadableDomain ccs(loadString("a = 1; x.y { a = 2 }"));
+  EXPECT_EQ(1u, ccs.version());
+  CcsContext v1 = ccs.build().constrain("x", {"y"});
+  EXPECT_EQ(2, v1.getInt("a"));
+
+  EXPECT_TRUE(ccs.reload(loadString("a = 3; x.y { a = 4 }")));
+  EXPECT_EQ(2u, ccs.version());
+  EXPECT_EQ(3, ccs.build().getInt("a"));
+
+  // contexts stay pinned to the version they were built from
+  EXPECT_EQ(2, v1.getInt("a"));
+  EXPECT_EQ(2, v1.constrain("z").getInt("a"));
+  EXPECT_EQ(4, ccs.build().constrain("x", {"y"}).getInt("a"));
+}
+
+TEST(ReloadableTest, FailedReload) {
+  CcsReloadableDomain ccs(loadString("a = 1"), quietTracer());
+  EXPECT_FALSE(ccs.reload(loadString("a = ")));
+  EXPECT_EQ(1u, ccs.version());
+  EXPECT_EQ(1, ccs.build().getInt("a"));
+
+  EXPECT_THROW(ccs.reload([](CcsDomain &) {
+    throw std::runtime_error("no config");
+  }), std::runtime_error);
+  EXPECT_EQ(1u, ccs.version());
+
+  CcsReloadableDomain empty(loadString("a = "), quietTracer());
+  EXPECT_EQ(0u, empty.version());
+  EXPECT_FALSE(empty.build().getProperty("a").exists());
+
+  CcsReloadableDomain thrown([](CcsDomain &) {
+    throw std::runtime_error("no config yet");
+  }, quietTracer());
+  EXPECT_EQ(0u, thrown.version());
+  EXPECT_TRUE(thrown.reload(loadString("a = 1")));
+  EXPECT_EQ(1u, thrown.version());
+}
+
+TEST(ReloadableTest, ReloadAsync) {
+  auto ccs = new CcsReloadableDomain(loadString("a = 1"));
+  ccs->reload(loadString("a = 2"));
+  std::future<bool> result = ccs->reloadAsync();
+  delete ccs;
+  EXPECT_TRUE(result.get());
+}
+
+TEST(ReloadableTest, ConcurrentReaders) {
+  // each version defines a and b equal to each other, and to the version
+  // number. readers should never see them disagree.
+  auto rules = [](int n) {
+    std::ostringstream str;
+    str << "a = " << n << "; x { b = " << n << " }";
+    return loadString(str.str());
+  };
+  CcsReloadableDomain ccs(rules(1));
+  auto liveA = ccs.live(ccs.build(), "a", 0);
+
+  std::atomic<bool> done(false);
+  std::atomic<int> failures(0);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&]() {
+      int last = 0;
+      int lastLive = 0;
+      while (!done) {
+        int live = liveA.get();
+        if (live < lastLive) failures++;
+        lastLive = live;
+
+        auto version = ccs.current();
+        CcsContext ctx = version->root.constrain("x");
+        int a = ctx.getInt("a");
+        if (a != ctx.getInt("b")) failures++;
+        if (uint64_t(a) != version->number) failures++;
+        if (a < last) failures++;
+        last = a;
+      }
+    });
+  }
+  for (int n = 2; n <= 50; n++) ccs.reload(rules(n));
+  done = true;
+  for (auto it = readers.begin(); it != readers.end(); ++it) it->join();
+
+  EXPECT_EQ(0, failures.load());
+  EXPECT_EQ(50u, ccs.version());
+  EXPECT_EQ(50, liveA.get());
+}
+
+TEST(ReloadableTest, LiveProperties) {
+  CcsReloadableDomain ccs(loadString(
+      "a = 1; s = 'x'; svc.web { a = 2; @constrain tier.front } "
+      "tier.front { t = 10 }"));
+  CcsContext web = ccs.build().constrain("svc", {"web"});
+  auto a = ccs.live(web, "a", 0);
+  auto s = ccs.live<std::string>(web, "s");
+  auto t = ccs.live(web, "t", -1);
+  auto missing = ccs.live(ccs.build(), "nope", 42.5);
+  auto compacted = ccs.live(web.constrain("x").compact(), "a", 0);
+  auto copy = a;
+  EXPECT_EQ(2, a.get());
+  EXPECT_EQ(2, compacted.get());
+  EXPECT_EQ("x", s.get());
+  EXPECT_EQ(10, t.get());
+  EXPECT_EQ(42.5, missing.get());
+
+  // the @constrain is re-applied from the new rules, not carried over
+  ccs.reload(loadString(
+      "a = 1; s = 'y'; svc.web { a = 3; @constrain tier.back } "
+      "tier.front { t = 10 } tier.back { nope = 1.5 }"));
+  EXPECT_EQ(3, a.get());
+  EXPECT_EQ(3, copy.get());
+  EXPECT_EQ(3, compacted.get());
+  EXPECT_EQ("y", s.get());
+  EXPECT_EQ(-1, t.get());
+  EXPECT_EQ(42.5, missing.get());
+
+  // bad coercions fall back to the default
+  ccs.reload(loadString("svc.web { a = 'many' }"));
+  EXPECT_EQ(0, a.get());
+  EXPECT_EQ("", s.get());
+}
+
+TEST(ReloadableTest, LivePropertiesOnlyChangedResolved) {
+  auto stats = std::make_shared<CcsStatsTracer>(quietTracer());
+  CcsReloadableDomain ccs(loadString("a = 1; b = 2"), stats);
+  auto a = ccs.live(ccs.build().constrain("x"), "a", 0);
+  auto b = ccs.live(ccs.build().constrain("x"), "b", 0);
+  auto lookups = [&](const std::string &name) {
+    auto snapshot = stats->snapshot();
+    for (auto it = snapshot.properties.cbegin();
+        it != snapshot.properties.cend(); ++it)
+      if (it->name == name) return it->lookups();
+    return uint64_t(0);
+  };
+  EXPECT_EQ(1u, lookups("a"));
+  EXPECT_EQ(1u, lookups("b"));
+
+  // only b's definitions changed, so a isn't looked up again
+  ccs.reload(loadString("a = 1; b = 3"));
+  EXPECT_EQ(1, a.get());
+  EXPECT_EQ(3, b.get());
+  EXPECT_EQ(1u, lookups("a"));
+  EXPECT_EQ(2u, lookups("b"));
+
+  ccs.reload(loadString("a = 4; b = 3"));
+  EXPECT_EQ(4, a.get());
+  EXPECT_EQ(3, b.get());
+  EXPECT_EQ(2u, lookups("a"));
+  EXPECT_EQ(2u, lookups("b"));
+}
+
+TEST(ReloadableTest, ChangeNotifications) {
+  CcsReloadableDomain ccs(loadString(
+      "a = 1; b = 2; svc.web { c = 3; d = 4 }"));
+  CcsContext web = ccs.build().constrain("svc", {"web"});
+
+  std::mutex mutex;
+  std::vector<std::vector<CcsChange>> some;
+  std::vector<std::vector<CcsChange>> all;
+  auto record = [&mutex](std::vector<std::vector<CcsChange>> &batches) {
+    return [&mutex, &batches](const std::vector<CcsChange> &changes) {
+      std::lock_guard<std::mutex> lock(mutex);
+      batches.push_back(changes);
+    };
+  };
+  auto subSome = ccs.subscribe(web, {"a", "c"}, record(some));
+  auto subAll = ccs.subscribe(web, record(all));
+
+  // b and d change, but only the whole-context subscriber cares.
+  ccs.reload(loadString("a = 1; b = 5; svc.web { c = 3; d = 6 }"));
+  ccs.waitForNotifications();
+  EXPECT_TRUE(some.empty());
+  ASSERT_EQ(1u, all.size());
+  ASSERT_EQ(2u, all[0].size());
+  EXPECT_EQ("b", all[0][0].propertyName);
+  EXPECT_EQ("2", all[0][0].oldValue);
+  EXPECT_EQ("5", all[0][0].newValue);
+  EXPECT_EQ("d", all[0][1].propertyName);
+  EXPECT_EQ(6, all[0][1].context.getInt("d"));
+
+  // definitions move around and get renumbered, but resolve the same way
+  EXPECT_TRUE(ccs.reload(
+      loadString("svc.web { d = 6; c = 3 } a = 1; b = 5")));
+  ccs.waitForNotifications();
+  EXPECT_TRUE(some.empty());
+  ASSERT_EQ(1u, all.size());
+
+  // a new, more specific definition, and a property going away
+  EXPECT_TRUE(ccs.reload(
+      loadString("a = 1; svc.web { a = 7; c = 3; d = 6 } x = 0")));
+  ccs.waitForNotifications();
+  ASSERT_EQ(1u, some.size());
+  ASSERT_EQ(1u, some[0].size());
+  EXPECT_EQ("a", some[0][0].propertyName);
+  EXPECT_EQ("7", some[0][0].newValue);
+  ASSERT_EQ(2u, all.size());
+  ASSERT_EQ(3u, all[1].size());
+  EXPECT_EQ("b", all[1][1].propertyName);
+  EXPECT_TRUE(all[1][1].existed);
+  EXPECT_FALSE(all[1][1].exists);
+  EXPECT_EQ("x", all[1][2].propertyName);
+
+  // an @constrain can change anything
+  subAll.cancel();
+  EXPECT_TRUE(ccs.reload(loadString(
+      "a = 1; svc.web { a = 7; c = 3; d = 6; @constrain env.x } x = 0; "
+      "env.x { c = 8 }")));
+  ccs.waitForNotifications();
+  ASSERT_EQ(2u, some.size());
+  ASSERT_EQ(1u, some[1].size());
+  EXPECT_EQ("c", some[1][0].propertyName);
+  EXPECT_EQ(2u, all.size());
+}
+
+namespace {
+
+void writeFile(const std::string &path, const std::string &contents) {
+  std::ofstream(path.c_str()) << contents;
+}
+
+template <typename F>
+bool eventually(F &&f) {
+  for (int i = 0; i < 500 && !f(); i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  return f();
+}
+
+}
+
+TEST(ReloadableTest, SubscriberDropsDomain) {
+  auto ccs = std::make_shared<CcsReloadableDomain>(loadString("a = 1"));
+  std::weak_ptr<CcsReloadableDomain> weak = ccs;
+  std::atomic<bool> called(false);
+  // the callback holds the last reference, and drops it on the notifier
+  // thread, which then mustn't try to join itself.
+  auto held = std::make_shared<std::shared_ptr<CcsReloadableDomain>>(ccs);
+  auto sub = ccs->subscribe(ccs->build(),
+      [held, &called](const std::vector<CcsChange> &) {
+    held->reset();
+    called = true;
+  });
+  ccs->reload(loadString("a = 2"));
+  ccs.reset();
+  EXPECT_TRUE(eventually([&] { return called.load(); }));
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST(ReloadableTest, IncrementalReload) {
+  MapImportResolver ir;
+  ir.files["one"] = "x { p = 1 } @import 'nested'; q = 1";
+  ir.files["nested"] = "y { @import 'deep' } r = 1";
+  ir.files["deep"] = "s = 1";
+  ir.files["two"] = "x { p = 2 } x.a { y { t = 1 } }";
+  std::vector<std::string> roots{"one", "two"};
+  CcsParseCache cache;
+  auto load = [&](CcsDomain &ccs) {
+    for (auto it = roots.cbegin(); it != roots.cend(); ++it) {
+      std::istringstream input(ir.files[*it]);
+      ccs.loadCcsStream(input, *it, ir, cache);
+    }
+  };
+  // the same rules, loaded afresh without a cache
+  auto fresh = [&]() {
+    CcsDomain ccs(quietTracer());
+    for (auto it = roots.cbegin(); it != roots.cend(); ++it) {
+      std::istringstream input(ir.files[*it]);
+      ccs.loadCcsStream(input, *it, ir);
+    }
+    return definitions(ccs);
+  };
+  auto current = [](const CcsReloadableDomain &ccs) {
+    return definitions(*ccs.current()->domain);
+  };
+
+  CcsReloadableDomain ccs(load, quietTracer());
+  EXPECT_FALSE(ccs.current()->incremental);
+  EXPECT_EQ(2, ccs.build().constrain("x").getInt("p"));
+  auto q = ccs.live(ccs.build(), "q", 0);
+
+  // only the changed file's rules are replaced. two's setting of p is
+  // still the later one, and wins.
+  ir.files["one"] = "x { p = 3 } @import 'nested'; q = 1; x { u = 1 }";
+  EXPECT_TRUE(ccs.reload());
+  EXPECT_TRUE(ccs.current()->incremental);
+  EXPECT_EQ(fresh(), current(ccs));
+  EXPECT_EQ(2, ccs.build().constrain("x").getInt("p"));
+  EXPECT_EQ(1, ccs.build().constrain("x").getInt("u"));
+  EXPECT_EQ(1, q.get());
+  ir.files["one"] = "x { p = 3 } @import 'nested'; q = 2; x { u = 1 }";
+  EXPECT_TRUE(ccs.reload());
+  EXPECT_TRUE(ccs.current()->incremental);
+  EXPECT_EQ(2, q.get());
+
+  // likewise for a file imported two deep, beneath a selector
+  ir.files["deep"] = "s = 2; z { s = 3 }";
+  EXPECT_TRUE(ccs.reload());
+  EXPECT_TRUE(ccs.current()->incremental);
+  EXPECT_EQ(fresh(), current(ccs));
+  EXPECT_EQ(3, ccs.build().constrain("y").constrain("z").getInt("s"));
+
+  // rules removed leave nothing behind, so p falls back to one's setting
+  ir.files["two"] = "w = 1";
+  EXPECT_TRUE(ccs.reload());
+  EXPECT_TRUE(ccs.current()->incremental);
+  EXPECT_EQ(fresh(), current(ccs));
+  EXPECT_EQ(3, ccs.build().constrain("x").getInt("p"));
+  EXPECT_FALSE(ccs.build().constrain("x.a").constrain("y").getProperty("t")
+      .exists());
+
+  // a file failing to parse fails the reload, and is left as it was
+  ir.files["deep"] = "s = ";
+  EXPECT_FALSE(ccs.reload());
+  ir.files["deep"] = "s = 4";
+  EXPECT_TRUE(ccs.reload());
+  EXPECT_EQ(fresh(), current(ccs));
+  EXPECT_EQ(4, ccs.build().constrain("y").getInt("s"));
+
+  // files added and dropped
+  ir.files["three"] = "x { p = 5 }";
+  roots = {"one", "three"};
+  EXPECT_TRUE(ccs.reload());
+  EXPECT_TRUE(ccs.current()->incremental);
+  EXPECT_EQ(fresh(), current(ccs));
+  EXPECT_EQ(5, ccs.build().constrain("x").getInt("p"));
+
+  // a file that grows too much for its place is loaded afresh
+  std::string grown = "x { p = 6 }";
+  for (int i = 0; i < 100; i++) grown += " v" + std::to_string(i) + " = 1;";
+  ir.files["one"] = grown;
+  EXPECT_TRUE(ccs.reload());
+  EXPECT_FALSE(ccs.current()->incremental);
+  EXPECT_EQ(fresh(), current(ccs));
+  EXPECT_EQ(5, ccs.build().constrain("x").getInt("p"));
+
+  // and so is one whose previous version is still in use
+  EXPECT_TRUE(ccs.reload());
+  CcsContext pinned = ccs.build();
+  EXPECT_TRUE(ccs.reload());
+  EXPECT_TRUE(ccs.reload());
+  EXPECT_FALSE(ccs.current()->incremental);
+  EXPECT_EQ(fresh(), current(ccs));
+}
+
+TEST(ReloadableTest, FileWatcher) {
+  char tmpl[] = "/tmp/ccs_watch_XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(tmpl));
+  std::string dir = tmpl;
+  writeFile(dir + "/main.ccs", "@import 'other.ccs'; a = 1");
+  writeFile(dir + "/other.ccs", "b = 2");
+
+  {
+    CcsFileWatcher watcher(dir + "/main.ccs", quietTracer(),
+        std::chrono::milliseconds(20));
+    CcsReloadableDomain &ccs = watcher.domain();
+    EXPECT_EQ(1u, ccs.version());
+    EXPECT_EQ(2u, watcher.files().size());
+    EXPECT_EQ(2, ccs.build().getInt("b"));
+
+    // an imported file changes
+    writeFile(dir + "/other.ccs", "b = 3");
+    EXPECT_TRUE(eventually([&] { return ccs.version() == 2; }));
+    EXPECT_EQ(3, ccs.build().getInt("b"));
+
+    // rewritten, but with the same contents
+    writeFile(dir + "/other.ccs", "b = 3");
+    EXPECT_TRUE(eventually([&] { return watcher.skippedReloads() > 0; }));
+    EXPECT_EQ(2u, ccs.version());
+
+    // a broken file isn't published, but a fix is picked up, along with a
+    // new import.
+    writeFile(dir + "/main.ccs", "a = ");
+    writeFile(dir + "/main.ccs", "@import 'third.ccs'; a = 4");
+    writeFile(dir + "/third.ccs", "c = 5");
+    EXPECT_TRUE(eventually([&] {
+      return ccs.build().getInt("c", 0) == 5;
+    }));
+    ASSERT_EQ(2u, watcher.files().size());
+    EXPECT_NE(std::string::npos, watcher.files()[1].find("third.ccs"));
+    writeFile(dir + "/third.ccs", "c = 6");
+    EXPECT_TRUE(eventually([&] {
+      return ccs.build().getInt("c", 0) == 6;
+    }));
+  }
+
+  remove((dir + "/main.ccs").c_str());
+  remove((dir + "/other.ccs").c_str());
+  remove((dir + "/third.ccs").c_str());
+  rmdir(dir.c_str());
+}
@@ -0,0 +1,140 @@
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "ccs/ccs.h"
+
+using namespace ccs;
+
+namespace {
+
+std::shared_ptr<CcsStatsTracer> loadWithStats(CcsDomain *&ccs,
+    const std::string &rules) {
+  auto stats = std::make_shared<CcsStatsTracer>(nullptr, true);
+  ccs = new CcsDomain(stats);
+  std::istringstream input(rules);
+  ccs->loadCcsStream(input, "<literal>", ImportResolver::None);
+  return stats;
+}
+
+}
+
+TEST(StatsTest, CountsLookups) {
+  CcsDomain *ccs;
+  auto stats = loadWithStats(ccs, "a = 1; b = 2; c.d: a = 3");
+  CcsContext root = ccs->build();
+  CcsContext ctx = root.constrain("c", {"d"});
+  root.getInt("a");
+  root.getInt("a");
+  ctx.getInt("a");
+  ctx.getInt("nope", 0);
+  delete ccs;
+
+  auto snap = stats->snapshot();
+  ASSERT_EQ(2u, snap.properties.size());
+  EXPECT_EQ("a", snap.properties[0].name);
+  EXPECT_EQ(3u, snap.properties[0].hits);
+  EXPECT_EQ(0u, snap.properties[0].misses);
+  EXPECT_EQ("nope", snap.properties[1].name);
+  EXPECT_EQ(0u, snap.properties[1].hits);
+  EXPECT_EQ(1u, snap.properties[1].misses);
+
+  ASSERT_EQ(2u, snap.contexts.size());
+  EXPECT_EQ("<root>", snap.contexts[0].context);
+  EXPECT_EQ(2u, snap.contexts[0].lookups);
+  EXPECT_EQ("c.d", snap.contexts[1].context);
+  EXPECT_EQ(2u, snap.contexts[1].lookups);
+
+  stats->reset();
+  EXPECT_TRUE(stats->snapshot().properties.empty());
+  EXPECT_TRUE(stats->snapshot().contexts.empty());
+}
+
+TEST(StatsTest, ContextsOptIn) {
+  auto stats = std::make_shared<CcsStatsTracer>();
+  CcsDomain ccs(stats);
+  ccs.build().constrain("c", {"d"}).getInt("a", 0);
+  auto snap = stats->snapshot();
+  EXPECT_EQ(1u, snap.properties.size());
+  EXPECT_TRUE(snap.contexts.empty());
+}
+
+TEST(StatsTest, CountsConflicts) {
+  CcsDomain *ccs;
+  auto stats = loadWithStats(ccs, "a.b: x = 1; a.c: x = 2");
+  ccs->build().constrain("a", {"b", "c"}).getInt("x");
+  delete ccs;
+
+  auto snap = stats->snapshot();
+  ASSERT_EQ(1u, snap.properties.size());
+  EXPECT_EQ(1u, snap.properties[0].hits);
+  EXPECT_EQ(1u, snap.properties[0].conflicts);
+}
+
+TEST(StatsTest, Dump) {
+  CcsDomain *ccs;
+  auto stats = loadWithStats(ccs, "'a \"b\"' = 1");
+  ccs->build().getInt("a \"b\"");
+  delete ccs;
+
+  std::ostringstream json;
+  stats->dumpJson(json);
+  EXPECT_EQ("{\"properties\":[{\"name\":\"a \\\"b\\\"\",\"hits\":1,"
+      "\"misses\":0,\"conflicts\":0}],"
+      "\"contexts\":[{\"context\":\"<root>\",\"lookups\":1}]}", json.str());
+
+  std::ostringstream text;
+  stats->dumpText(text);
+  EXPECT_NE(std::string::npos, text.str().find("a \"b\": 1/0/0"));
+  EXPECT_NE(std::string::npos, text.str().find("[<root>]: 1"));
+}
+
+TEST(StatsTest, CountsBatchLookups) {
+  CcsDomain *ccs;
+  auto stats = loadWithStats(ccs, "a = 1; b = 2");
+  const CcsProperty *props[3];
+  ccs->build().getProperties({"a", "b", "c"}, props);
+  delete ccs;
+
+  auto snap = stats->snapshot();
+  ASSERT_EQ(3u, snap.properties.size());
+  EXPECT_EQ(1u, snap.properties[0].hits);
+  EXPECT_EQ(1u, snap.properties[1].hits);
+  EXPECT_EQ("c", snap.properties[2].name);
+  EXPECT_EQ(1u, snap.properties[2].misses);
+  ASSERT_EQ(1u, snap.contexts.size());
+  EXPECT_EQ(3u, snap.contexts[0].lookups);
+}
+
+TEST(StatsTest, CountsAcrossThreadsAndDomains) {
+  auto stats = std::make_shared<CcsStatsTracer>();
+  CcsDomain first(stats);
+  first.ruleBuilder().set("a", "1");
+  CcsDomain second(stats);
+  second.ruleBuilder().set("b", "2").set("a", "3");
+  CcsContext contexts[] = {first.build(), second.build()};
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&, t] {
+      for (int n = 0; n < 1000; n++) contexts[(n + t) % 2].getInt("a");
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  // counts from threads which have exited are kept, along with these.
+  contexts[0].getInt("a");
+  contexts[1].getInt("b");
+
+  auto snap = stats->snapshot();
+  ASSERT_EQ(2u, snap.properties.size());
+  EXPECT_EQ("a", snap.properties[0].name);
+  EXPECT_EQ(4001u, snap.properties[0].hits);
+  EXPECT_EQ(1u, snap.properties[1].hits);
+
+  stats->reset();
+  EXPECT_TRUE(stats->snapshot().properties.empty());
+  contexts[1].getInt("a");
+  EXPECT_EQ(1u, stats->snapshot().properties[0].hits);
+}